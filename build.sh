@@ -30,6 +30,7 @@ make -C examples/21_fresnel clean
 make -C examples/22_bigtex clean
 make -C examples/23_hdr clean
 make -C examples/24_hdr_bloom clean
+make -C examples/25_instancing clean
 make -C examples/99_testscene clean
 
 # Build Tiny3D
@@ -69,6 +70,7 @@ make -C examples/21_fresnel -j4
 make -C examples/22_bigtex -j4
 make -C examples/23_hdr -j4
 make -C examples/24_hdr_bloom -j4
+make -C examples/25_instancing -j4
 make -C examples/99_testscene -j4
 
 echo "Build done!"
\ No newline at end of file
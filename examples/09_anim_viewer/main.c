@@ -247,7 +247,7 @@ int main()
     posY += 10;
 
     rdpq_set_prim_color(RGBA32(0xFF, 0xFF, 0xFF, 0xFF));
-    rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, posX, posY, "Channels: %d+%d", anim->channelsQuat, anim->channelsScalar);
+    rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, posX, posY, "Channels: %d+%d (%d const.)", anim->channelsQuat, anim->channelsScalar, anim->channelsConst);
     posY += 24;
 
     rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, posX, posY, "Speed: %.2fx", md->animInst[activeAnim].speed);
@@ -76,19 +76,21 @@ static uint16_t DEBUG_COLORS[8] = {
 };
 
 static void debugDrawBVTreeNode(
-  uint16_t *fb, T3DViewport *vp,
+  uint16_t *fb, T3DViewport *vp, const T3DBvh *bvh,
   const T3DBvhNode *node, const T3DFrustum *frustum, float scale, int level
 ) {
-  if((node->value & 0b1111) == 0) {
-    if(t3d_frustum_vs_aabb_s16(frustum, node->aabbMin, node->aabbMax)) {
-      int dataOffset = (int16_t)node->value >> 4;
-      debugDrawAABB(fb, node->aabbMin, node->aabbMax, vp, scale, DEBUG_COLORS[level & 7]);
-      debugDrawBVTreeNode(fb, vp, &node[dataOffset], frustum, scale, level+1);
-      debugDrawBVTreeNode(fb, vp, &node[dataOffset+1], frustum, scale, level+1);
+  for(int c=0; c<node->childCount; ++c) {
+    if(node->dataCount[c] != 0)continue; // only draw inner nodes
+
+    int16_t aabbMin[3], aabbMax[3];
+    t3d_model_bvh_get_child_aabb(node, c, aabbMin, aabbMax);
+    if(t3d_frustum_vs_aabb_s16(frustum, aabbMin, aabbMax)) {
+      debugDrawAABB(fb, aabbMin, aabbMax, vp, scale, DEBUG_COLORS[level & 7]);
+      debugDrawBVTreeNode(fb, vp, bvh, &bvh->nodes[node->childIdx[c]], frustum, scale, level+1);
     }
   }
 }
 
 static void debugDrawBVTree(uint16_t *fb, const T3DBvh *bvh, T3DViewport *vp, const T3DFrustum *frustum, float scale) {
-  debugDrawBVTreeNode(fb, vp, bvh->nodes, frustum, scale, 0);
+  debugDrawBVTreeNode(fb, vp, bvh, bvh->nodes, frustum, scale, 0);
 }
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include <libdragon.h>
+
+#include <t3d/t3d.h>
+
+#define FB_COUNT 3
+#define GRID_SIZE 8
+#define INSTANCE_COUNT (GRID_SIZE * GRID_SIZE)
+#define CUBE_VERT_COUNT 8
+#define CUBE_TRI_COUNT 12
+
+/**
+ * Example showing instanced vertex loads, drawing a grid of spinning cubes.
+ * With 't3d_vert_load_instanced', the vertices of the cube are only DMA'd once per batch,
+ * each further instance only transforms them again with its own matrix.
+ * All instances of a batch are stored next to each other, so triangles are drawn with an index offset.
+ * Press 'A' to switch to one regular load per instance to compare.
+ */
+
+static const uint8_t cubeIndices[CUBE_TRI_COUNT * 3] = {
+  0, 2, 1,  1, 2, 3, // -Z
+  4, 5, 6,  5, 7, 6, // +Z
+  0, 1, 4,  1, 5, 4, // -Y
+  2, 6, 3,  3, 6, 7, // +Y
+  0, 4, 2,  2, 4, 6, // -X
+  1, 3, 5,  3, 7, 5, // +X
+};
+
+static void draw_cube_tris(uint32_t idxOffset) {
+  for(int i = 0; i < CUBE_TRI_COUNT * 3; i += 3) {
+    t3d_tri_draw(cubeIndices[i] + idxOffset, cubeIndices[i+1] + idxOffset, cubeIndices[i+2] + idxOffset);
+  }
+}
+
+int main()
+{
+	debug_init_isviewer();
+	debug_init_usblog();
+
+  display_init(RESOLUTION_320x240, DEPTH_16_BPP, FB_COUNT, GAMMA_NONE, FILTERS_RESAMPLE);
+  rdpq_init();
+  joypad_init();
+  rdpq_text_register_font(FONT_BUILTIN_DEBUG_MONO, rdpq_font_load_builtin(FONT_BUILTIN_DEBUG_MONO));
+
+  t3d_init((T3DInitParams){});
+  T3DViewport viewport = t3d_viewport_create_buffered(FB_COUNT);
+
+  // one matrix per instance, buffered since the RSP may still read the ones of the previous frames
+  T3DMat4FP* matrices = malloc_uncached(sizeof(T3DMat4FP) * INSTANCE_COUNT * FB_COUNT);
+
+  // cube with one vertex per corner, normals point away from the center
+  T3DVertPacked* vertices = malloc_uncached(sizeof(T3DVertPacked) * CUBE_VERT_COUNT / 2);
+  for(int i = 0; i < CUBE_VERT_COUNT; ++i) {
+    int16_t pos[3] = {(i & 1) ? 8 : -8, (i & 2) ? 8 : -8, (i & 4) ? 8 : -8};
+    fm_vec3_t normal = {{pos[0], pos[1], pos[2]}};
+    fm_vec3_norm(&normal, &normal);
+    uint16_t norm = t3d_vert_pack_normal(&normal);
+    uint32_t color = ((i & 1) ? 0xFF000000 : 0x40000000) | ((i & 2) ? 0xFF0000 : 0x400000) | ((i & 4) ? 0xFF00 : 0x4000) | 0xFF;
+
+    T3DVertPacked *v = &vertices[i / 2];
+    if(i % 2 == 0) {
+      v->posA[0] = pos[0]; v->posA[1] = pos[1]; v->posA[2] = pos[2];
+      v->normA = norm; v->rgbaA = color; v->stA[0] = 0; v->stA[1] = 0;
+    } else {
+      v->posB[0] = pos[0]; v->posB[1] = pos[1]; v->posB[2] = pos[2];
+      v->normB = norm; v->rgbaB = color; v->stB[0] = 0; v->stB[1] = 0;
+    }
+  }
+
+  uint8_t colorAmbient[4] = {80, 80, 80, 0xFF};
+  uint8_t colorDir[4]     = {0xEE, 0xEE, 0xEE, 0xFF};
+  fm_vec3_t lightDirVec = {{-1.0f, 1.0f, 1.0f}};
+  fm_vec3_norm(&lightDirVec, &lightDirVec);
+
+  const fm_vec3_t camPos = {{0, 90, -110}};
+  const fm_vec3_t camTarget = {{0, 0, 0}};
+
+  // how many cubes fit into the vertex buffer next to each other
+  const uint32_t batchSize = t3d_vert_load_instanced_max(0, CUBE_VERT_COUNT);
+  bool useInstancing = true;
+  float time = 0.0f;
+  int frameIdx = 0;
+
+  for(;;)
+  {
+    // ======== Update ======== //
+    joypad_poll();
+    joypad_buttons_t pressed = joypad_get_buttons_pressed(JOYPAD_PORT_1);
+    if(pressed.a)useInstancing = !useInstancing;
+
+    frameIdx = (frameIdx + 1) % FB_COUNT;
+    time += 0.02f;
+
+    t3d_viewport_set_projection(&viewport, T3D_DEG_TO_RAD(70.0f), 10.0f, 300.0f);
+    t3d_viewport_look_at(&viewport, &camPos, &camTarget, &(fm_vec3_t){{0,1,0}});
+
+    T3DMat4FP *frameMatrices = &matrices[frameIdx * INSTANCE_COUNT];
+    for(int i = 0; i < INSTANCE_COUNT; ++i) {
+      float posX = ((i % GRID_SIZE) - (GRID_SIZE - 1) * 0.5f) * 20.0f;
+      float posZ = ((i / GRID_SIZE) - (GRID_SIZE - 1) * 0.5f) * 20.0f;
+      float rot = time + i * 0.3f;
+      t3d_mat4fp_from_srt_euler(&frameMatrices[i],
+        (float[3]){0.6f, 0.6f, 0.6f},
+        (float[3]){rot, rot * 0.7f, 0.0f},
+        (float[3]){posX, fm_sinf(time * 2.0f + i * 0.5f) * 6.0f, posZ}
+      );
+    }
+
+    // ======== Draw ======== //
+    rdpq_attach(display_get(), display_get_zbuf());
+    t3d_frame_start();
+    t3d_viewport_attach(&viewport);
+
+    rdpq_mode_combiner(RDPQ_COMBINER_SHADE);
+    t3d_screen_clear_color(RGBA32(30, 30, 50, 0xFF));
+    t3d_screen_clear_depth();
+
+    t3d_light_set_ambient(colorAmbient);
+    t3d_light_set_directional(0, colorDir, &lightDirVec);
+    t3d_light_set_count(1);
+    t3d_state_set_drawflags(T3D_FLAG_SHADED | T3D_FLAG_DEPTH);
+
+    uint64_t ticks = get_ticks();
+    if(useInstancing) {
+      for(uint32_t i = 0; i < INSTANCE_COUNT; i += batchSize) {
+        uint32_t count = INSTANCE_COUNT - i < batchSize ? INSTANCE_COUNT - i : batchSize;
+        t3d_vert_load_instanced(vertices, 0, CUBE_VERT_COUNT, &frameMatrices[i], count);
+        for(uint32_t b = 0; b < count; ++b) {
+          draw_cube_tris(b * CUBE_VERT_COUNT);
+        }
+        t3d_tri_sync();
+      }
+    } else {
+      for(uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+        t3d_matrix_push(&frameMatrices[i]);
+        t3d_vert_load(vertices, 0, CUBE_VERT_COUNT);
+        t3d_matrix_pop(1);
+        draw_cube_tris(0);
+        t3d_tri_sync();
+      }
+    }
+    ticks = get_ticks() - ticks;
+
+    rdpq_sync_pipe();
+    rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, 16, 20, "[A] %s", useInstancing ? "Instanced" : "Per instance");
+    rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, 16, 32, "Cubes: %d, batch: %ld", INSTANCE_COUNT, batchSize);
+    rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, 16, 44, "CPU: %lluus, FPS: %.2f", TICKS_TO_US(ticks), display_get_fps());
+
+    rdpq_detach_show();
+  }
+
+  t3d_destroy();
+  return 0;
+}
@@ -41,6 +41,7 @@ uint32_t T3D_RSP_ID = 0;
 
 #define VERT_INPUT_SIZE  16
 #define VERT_OUTPUT_SIZE 36
+#define VERT_OUTPUT_SPILL 38 // fog is stored 72 bytes after a vertex until set via 't3d_fog_set_enabled'
 
 static T3DViewport *currentViewport = NULL;
 static T3DMat4FP *matrixStack = NULL;
@@ -173,6 +174,50 @@ void t3d_vert_load(const T3DVertPacked *vertices, uint32_t offset, uint32_t coun
   );
 }
 
+// the input of an instanced load stays in DMEM, it ends where the matrix temp. buffer starts
+static inline uint32_t vert_instanced_input_addr(uint32_t inputSize) {
+  return (RSP_T3D_BSS_CLIP_BUFFER_RESULT & 0xFFFF) - inputSize;
+}
+
+uint32_t t3d_vert_load_instanced_max(uint32_t offset, uint32_t count) {
+  uint32_t countEven = (count+1) & ~1;
+  uint32_t inputAddr = vert_instanced_input_addr(countEven * VERT_INPUT_SIZE);
+
+  // without fog, a load may write a few bytes past its last vertex, which must not reach the input
+  uint32_t outputEnd = (RSP_T3D_VERT_BUFFER & 0xFFFF) + T3D_VERTEX_CACHE_SIZE * VERT_OUTPUT_SIZE;
+  outputEnd = MIN(outputEnd, inputAddr - VERT_OUTPUT_SPILL);
+
+  uint32_t maxVerts = (outputEnd - (RSP_T3D_VERT_BUFFER & 0xFFFF)) / VERT_OUTPUT_SIZE;
+  if(maxVerts < offset + countEven)return 0;
+  return (maxVerts - offset) / countEven;
+}
+
+void t3d_vert_load_instanced(const T3DVertPacked *vertices, uint32_t offset, uint32_t count,
+                             const T3DMat4FP *matrices, uint32_t instanceCount)
+{
+  assertf(instanceCount <= t3d_vert_load_instanced_max(offset, count), "Instances don't fit into the vertex buffer!");
+
+  // unlike 't3d_vert_load', the input must not overlap the output, since it's used again for each instance
+  uint32_t countEven = (count+1) & ~1;
+  uint32_t inputSize = countEven * VERT_INPUT_SIZE;
+  uint16_t offsetDest = vert_instanced_input_addr(inputSize);
+  uint16_t offsetInput = (RSP_T3D_VERT_BUFFER & 0xFFFF) + offset * VERT_OUTPUT_SIZE;
+
+  // all instances share one stack level, 'set' replaces the matrix of the previous one
+  t3d_matrix_push_pos(1);
+  for(uint32_t i = 0; i < instanceCount; i++) {
+    t3d_matrix_set(&matrices[i], true);
+    if(i == 0) {
+      rspq_write(T3D_RSP_ID, T3D_CMD_VERT_LOAD, inputSize, PhysicalAddr(vertices), (offsetDest << 16) | offsetInput);
+    } else {
+      // vertices are still in DMEM, only transform them again
+      rspq_write(T3D_RSP_ID, T3D_CMD_VERT_XFORM, inputSize, 0, (offsetDest << 16) | offsetInput);
+    }
+    offsetInput += countEven * VERT_OUTPUT_SIZE;
+  }
+  t3d_matrix_pop(1);
+}
+
 void t3d_frame_start(void) {
   // Reset render state
   rdpq_mode_begin();
@@ -691,3 +736,10 @@ void t3d_indexbuffer_convert(int16_t indices[], int count) {
     );
   }
 }
+
+void t3d_indexbuffer_rebase(int16_t indices[], int count) {
+  uint16_t *data = (uint16_t*)indices;
+  for(int i = 0; i < count; ++i) {
+    data[i] += RSP_T3D_VERT_BUFFER & 0xFFFF;
+  }
+}
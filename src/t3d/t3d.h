@@ -15,6 +15,7 @@ extern "C"
 #endif
 
 #define T3D_VERTEX_CACHE_SIZE 70
+#define T3D_VERTEX_INSTANCED_MAX 30 // max. vertices per instance for at least 2 instances in 't3d_vert_load_instanced'
 
 extern uint32_t T3D_RSP_ID;
 
@@ -33,7 +34,7 @@ enum T3DCmd {
   T3D_CMD_TRI_SYNC     = 0xA,
   T3D_CMD_TRI_STRIP    = 0xB,
   T3D_CMD_TRI_SEQ      = 0xC,
-  //                   = 0xD,
+  T3D_CMD_VERT_XFORM   = 0xD,
   //                   = 0xE,
   //                   = 0xF,
 };
@@ -394,7 +395,7 @@ void t3d_quad_draw_unindexed(uint32_t baseIndex, uint32_t quadCount);
  * E.g. if you loaded 68 vertices, you have 2 slots free or 36*2 bytes, meaning you can load 36 indices.
  * Note that due to alignment reasons, a safety margin of 4 indices should be added if the free vertex count is odd.
  *
- * The built-in model format will use this function internally, if you plan on manually using it for model data,
+ * The built-in model format stores strips already converted (see 't3d_indexbuffer_rebase'), if you plan on manually using it for model data,
  * check out 'tools/gltf_importer/src/optimizer/meshOptimizer.cpp' for an algorithm to do so.
  *
  * @param indexBuff index buffer to load
@@ -472,6 +473,32 @@ void t3d_matrix_set_proj(const T3DMat4FP *mat);
  */
 void t3d_vert_load(const T3DVertPacked *vertices, uint32_t offset, uint32_t count);
 
+/**
+ * Loads a vertex buffer once and transforms it for multiple instances, each with its own matrix.\n
+ * Instance 'i' is stored at 'offset + i * count' in the buffer (with 'count' rounded up to be even),\n
+ * so triangles of each instance are drawn by offsetting their indices.\n
+ * Matrices are multiplied with the current one, which is still set afterwards.\n
+ *
+ * The input stays in DMEM behind the vertex buffer, so the instances can't use all of it.\n
+ * Use 't3d_vert_load_instanced_max' to get how many instances fit.
+ *
+ * @param vertices vertex buffer
+ * @param offset offset in the target buffer of the first instance
+ * @param count how many vertices to load per instance
+ * @param matrices matrices, one per instance
+ * @param instanceCount number of instances
+ */
+void t3d_vert_load_instanced(const T3DVertPacked *vertices, uint32_t offset, uint32_t count,
+                             const T3DMat4FP *matrices, uint32_t instanceCount);
+
+/**
+ * Returns how many instances fit into the buffer in 't3d_vert_load_instanced'.
+ * @param offset offset in the target buffer of the first instance
+ * @param count how many vertices to load per instance
+ * @return max. instance count, 0 if not even one fits
+ */
+uint32_t t3d_vert_load_instanced_max(uint32_t offset, uint32_t count);
+
 /**
  * Sets the global ambient light color.
  * This color is always active and applied to all objects.
@@ -703,6 +730,17 @@ static inline void* t3d_segment_address(uint8_t segmentId, void* ptr) {
  */
 void t3d_indexbuffer_convert(int16_t indices[], int count);
 
+/**
+ * Adds the DMEM address of the vertex buffer to an already encoded index buffer for triangle strips.
+ * This is the last step of 't3d_indexbuffer_convert', for data that is stored as byte offsets
+ * into the vertex buffer (index * 36) with all flags already set.
+ * Models from the gltf importer are stored like this, so only this step is needed at load time.
+ *
+ * @param indices encoded index buffer, will be modified in-place
+ * @param count index count
+ */
+void t3d_indexbuffer_rebase(int16_t indices[], int count);
+
 // Vertex-buffer helpers:
 
 /**
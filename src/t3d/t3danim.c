@@ -5,35 +5,109 @@
 
 #include "t3d/t3danim.h"
 #include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define SQRT_2_INV 0.70710678118f
 #define KF_TIME_TICK (1.0f / 60.0f)
 
-// Maps the input data streamed from the animation data file
-typedef struct {
-  uint16_t nextTime;
-  uint16_t channelIdx;
-  uint16_t data[2]; // can be either 1 or 2 16-bit values (scalar / quat)
-} T3DAnimKF;
+// Header of a keyframe in the stream, see 'docs/modelFormat.md' for the encoding
+#define KF_HEADER_RUN          0x80
+#define KF_HEADER_CHANNEL_ABS  0x0F
+#define KF_HEADER_TIME_VARINT  0x07
+
+#define STREAM_ADDR_FILE 0xFFFFFFFF // stream is read with 'asset_fopen' instead of DMA
+
+/**
+ * Looks up the ROM address of the stream file of an animation.
+ * Streams outside of DFS or compressed by 'mkasset' can't be read with a plain DMA,
+ * these fall back to 'asset_fopen' (see 'STREAM_ADDR_FILE').
+ * Animations packed into an archive share the same path, so all of them are set at once.
+ */
+static void resolve_stream_addr(const T3DModel *model, const T3DChunkAnim *animDef) {
+  const char *path = animDef->filePath;
+  uint32_t addr = 0;
+  if(strncmp(path, "rom:/", 5) == 0) {
+    addr = dfs_rom_addr(path + 4); // DFS paths start at the root
+  }
+
+  if(addr) {
+    char magic[4] __attribute__((aligned(8)));
+    dma_read(magic, addr, sizeof(magic));
+    if(memcmp(magic, "DCA", 3) == 0)addr = 0; // asset compression header
+  }
+  if(!addr)addr = STREAM_ADDR_FILE;
+
+  T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_ANIM);
+  while(t3d_model_iter_next(&it)) {
+    if(it.anim->filePath == animDef->filePath)it.anim->streamAddr = addr;
+  }
+}
 
 T3DAnim t3d_anim_create(const T3DModel *model, const char *name) {
   T3DChunkAnim* animDef = t3d_model_get_animation(model, name);
   assertf(animDef, "Animation '%s' not found in model", name);
+  if(!animDef->streamAddr)resolve_stream_addr(model, animDef);
+
+  FILE *file = NULL;
+  if(animDef->streamAddr == STREAM_ADDR_FILE) {
+    file = asset_fopen(animDef->filePath, NULL);
+    assertf(file, "Animation stream '%s' not found", animDef->filePath);
+  }
+
+  // keep a copy of the definition, so the model can drop its animations afterwards (see 't3d_model_compact')
+  size_t defSize = sizeof(T3DChunkAnim)
+    + sizeof(T3DAnimChannelMapping) * (animDef->channelsQuat + animDef->channelsScalar)
+    + sizeof(T3DAnimChannelConst) * animDef->channelsConst;
+
+  // bones are matched by name on attach, store their hashes so the model doesn't need to be kept around
+  const T3DChunkSkeleton *skeleton = t3d_model_get_skeleton(model);
+  uint32_t boneCount = skeleton ? skeleton->boneCount : 0;
+
+  T3DChunkAnim *animCopy = malloc(defSize + sizeof(uint32_t) * boneCount);
+  memcpy(animCopy, animDef, defSize);
+  // strings stay in the model and may be dropped, the stream is already resolved at this point
+  animCopy->name = NULL;
+  animCopy->filePath = NULL;
+  uint32_t *boneHashes = (uint32_t*)((uint8_t*)animCopy + defSize);
+  for(uint32_t i = 0; i < boneCount; i++) {
+    boneHashes[i] = t3d_model_name_hash(skeleton->bones[i].name);
+  }
 
   return (T3DAnim){
-    .animRef = animDef,
+    .animRef = animCopy,
+    .boneHashes = boneCount ? boneHashes : NULL,
+    .boneCount = boneCount,
     .targetsScalar = NULL,
     .targetsQuat = NULL,
+    .targetsConst = NULL,
+    .file = file,
     .time = 0.0f,
     .speed = 1.0f,
-    .nextKfSize = sizeof(T3DAnimKF),
-    .file = asset_fopen(animDef->filePath, NULL),
     .isPlaying = 1,
     .isLooping = 1
   };
 }
 
-static void rewind_anim(T3DAnim *anim)
+static inline T3DAnimChannelConst* get_const_channels(const T3DChunkAnim *animDef) {
+  return (T3DAnimChannelConst*)&animDef->channelMappings[animDef->channelsQuat + animDef->channelsScalar];
+}
+
+static void apply_const_channel(T3DAnim *anim, uint32_t idx, int32_t updateFlag) {
+  const T3DAnimChannelConst *channel = &get_const_channels(anim->animRef)[idx];
+  T3DAnimTargetConst *target = &anim->targetsConst[idx];
+  if(!target->target)return;
+
+  if(channel->targetType == T3D_ANIM_TARGET_ROTATION) {
+    memcpy(target->target, channel->value, sizeof(T3DQuat));
+  } else {
+    *target->target = channel->value[0];
+  }
+  *target->changedFlag = updateFlag;
+  if(target->lastAnim)*target->lastAnim = anim;
+}
+
+static void rewind_anim(T3DAnim *anim, int32_t updateFlag)
 {
   for(int c=0; c<anim->animRef->channelsScalar; c++) {
     anim->targetsScalar[c].base.timeEnd = 0;
@@ -41,8 +115,63 @@ static void rewind_anim(T3DAnim *anim)
   for(int c=0; c<anim->animRef->channelsQuat; c++) {
     anim->targetsQuat[c].base.timeEnd = 0;
   }
-  anim->nextKfSize = sizeof(T3DAnimKF);
-  rewind(anim->file);
+  anim->lastChannel = anim->animRef->channelsQuat + anim->animRef->channelsScalar - 1;
+  anim->lastTicks = 0;
+  anim->runLeft = 0;
+  anim->streamPos = 0;
+  anim->buffPos = 0;
+  anim->buffSize = 0;
+  if(anim->file)fseek(anim->file, anim->animRef->streamOffset, SEEK_SET);
+
+  // constant channels are not part of the stream, set them here in case the animation is not playing
+  for(uint32_t c=0; c<anim->animRef->channelsConst; c++) {
+    apply_const_channel(anim, c, updateFlag);
+  }
+}
+
+typedef struct {
+  uint32_t hash;
+  uint32_t idx;
+} BoneHash;
+
+static int bone_hash_compare(const void *a, const void *b) {
+  uint32_t hashA = ((const BoneHash*)a)->hash;
+  uint32_t hashB = ((const BoneHash*)b)->hash;
+  return (hashA > hashB) - (hashA < hashB);
+}
+
+/**
+ * Maps bone indices of the animation to the ones of the given skeleton by their name hash.
+ * Returns NULL if both have the same bones in the same order, bones not found are set to 0xFFFF.
+ */
+static uint16_t* create_bone_map(const T3DAnim *anim, const T3DSkeleton *skeleton) {
+  const T3DChunkSkeleton *skelDst = skeleton->skeletonRef;
+  if(!anim->boneHashes)return NULL;
+
+  BoneHash *hashesDst = malloc(sizeof(BoneHash) * skelDst->boneCount);
+  bool isSameSkeleton = anim->boneCount == skelDst->boneCount;
+  for(uint32_t i = 0; i < skelDst->boneCount; i++) {
+    hashesDst[i] = (BoneHash){t3d_model_name_hash(skelDst->bones[i].name), i};
+    if(hashesDst[i].hash != anim->boneHashes[i])isSameSkeleton = false;
+  }
+
+  uint16_t *boneMap = NULL;
+  if(!isSameSkeleton) {
+    qsort(hashesDst, skelDst->boneCount, sizeof(BoneHash), bone_hash_compare);
+    boneMap = malloc(sizeof(uint16_t) * anim->boneCount);
+    for(uint32_t i = 0; i < anim->boneCount; i++) {
+      BoneHash key = {anim->boneHashes[i], 0};
+      const BoneHash *res = bsearch(&key, hashesDst, skelDst->boneCount, sizeof(BoneHash), bone_hash_compare);
+      boneMap[i] = res ? res->idx : 0xFFFF;
+    }
+  }
+  free(hashesDst);
+  return boneMap;
+}
+
+static T3DBone* get_target_bone(const T3DSkeleton *skeleton, const uint16_t *boneMap, uint32_t targetIdx) {
+  if(!boneMap)return &skeleton->bones[targetIdx];
+  return boneMap[targetIdx] == 0xFFFF ? NULL : &skeleton->bones[boneMap[targetIdx]];
 }
 
 void t3d_anim_attach(T3DAnim *anim, const T3DSkeleton *skeleton) {
@@ -50,35 +179,74 @@ void t3d_anim_attach(T3DAnim *anim, const T3DSkeleton *skeleton) {
 
   size_t allocQuat = sizeof(T3DAnimTargetQuat) * anim->animRef->channelsQuat;
   size_t allocScalar = sizeof(T3DAnimTargetScalar) * anim->animRef->channelsScalar;
-  anim->targetsQuat = calloc(allocQuat + allocScalar, 1); // only allocate a single block
+  size_t allocConst = sizeof(T3DAnimTargetConst) * anim->animRef->channelsConst;
+  anim->targetsQuat = calloc(allocQuat + allocScalar + allocConst, 1); // only allocate a single block
   anim->targetsScalar = (T3DAnimTargetScalar*)((uint8_t*)anim->targetsQuat + allocQuat);
-  rewind_anim(anim);
+  anim->targetsConst = (T3DAnimTargetConst*)((uint8_t*)anim->targetsScalar + allocScalar);
 
   uint32_t channelCount = anim->animRef->channelsScalar + anim->animRef->channelsQuat;
+  uint16_t *boneMap = create_bone_map(anim, skeleton);
 
   uint32_t idxQuat = 0;
   uint32_t idxScalar = 0;
   for(uint32_t i = 0; i < channelCount; i++)
   {
     T3DAnimChannelMapping *channelMap = &anim->animRef->channelMappings[i];
-    T3DBone *bone = &skeleton->bones[channelMap->targetIdx];
+    T3DBone *bone = get_target_bone(skeleton, boneMap, channelMap->targetIdx);
+    assertf(bone, "Bone %d of the animation not found in skeleton", channelMap->targetIdx);
 
     switch(channelMap->targetType) {
       case T3D_ANIM_TARGET_TRANSLATION:
         anim->targetsScalar[idxScalar].targetScalar = &bone->position.v[channelMap->attributeIdx];
+        anim->targetsScalar[idxScalar].base.lastAnim = &bone->lastAnim;
         anim->targetsScalar[idxScalar++].base.changedFlag = &bone->hasChanged;
         break;
       case T3D_ANIM_TARGET_SCALE_XYZ:
         anim->targetsScalar[idxScalar].targetScalar = &bone->scale.v[channelMap->attributeIdx];
+        anim->targetsScalar[idxScalar].base.lastAnim = &bone->lastAnim;
         anim->targetsScalar[idxScalar++].base.changedFlag = &bone->hasChanged;
         break;
       case T3D_ANIM_TARGET_ROTATION:
         anim->targetsQuat[idxQuat].targetQuat = &bone->rotation;
+        anim->targetsQuat[idxQuat].base.lastAnim = &bone->lastAnim;
         anim->targetsQuat[idxQuat++].base.changedFlag = &bone->hasChanged;
       break;
       default: {assertf(false, "Unknown animation target %d", channelMap->targetType);}
     }
   }
+
+  T3DAnimChannelConst *channelsConst = get_const_channels(anim->animRef);
+  for(uint32_t i = 0; i < anim->animRef->channelsConst; i++)
+  {
+    T3DAnimChannelConst *channel = &channelsConst[i];
+    T3DBone *bone = get_target_bone(skeleton, boneMap, channel->targetIdx);
+    assertf(bone, "Bone %d of the animation not found in skeleton", channel->targetIdx);
+
+    switch(channel->targetType) {
+      case T3D_ANIM_TARGET_TRANSLATION: anim->targetsConst[i].target = &bone->position.v[channel->attributeIdx]; break;
+      case T3D_ANIM_TARGET_SCALE_XYZ  : anim->targetsConst[i].target = &bone->scale.v[channel->attributeIdx]; break;
+      case T3D_ANIM_TARGET_ROTATION   : anim->targetsConst[i].target = bone->rotation.v; break;
+      default: {assertf(false, "Unknown animation target %d", channel->targetType);}
+    }
+    anim->targetsConst[i].changedFlag = &bone->hasChanged;
+    anim->targetsConst[i].lastAnim = &bone->lastAnim;
+  }
+
+  if(boneMap)free(boneMap);
+  rewind_anim(anim, 1);
+}
+
+inline static void attach_const(T3DAnim* anim, uint32_t targetIdx, float* target, int32_t *updateFlag, uint8_t targetType) {
+  T3DAnimChannelConst *channels = get_const_channels(anim->animRef);
+  for(int i = 0; i < anim->animRef->channelsConst; i++) {
+    if(channels[i].targetIdx == targetIdx && channels[i].targetType == targetType) {
+      bool isRot = targetType == T3D_ANIM_TARGET_ROTATION;
+      anim->targetsConst[i].target = isRot ? target : &target[channels[i].attributeIdx];
+      anim->targetsConst[i].changedFlag = updateFlag;
+      anim->targetsConst[i].lastAnim = NULL;
+      apply_const_channel(anim, i, 1);
+    }
+  }
 }
 
 inline static void attach_scalar(T3DAnim* anim, uint32_t targetIdx, T3DVec3* target, int32_t *updateFlag, uint8_t targetType) {
@@ -87,8 +255,10 @@ inline static void attach_scalar(T3DAnim* anim, uint32_t targetIdx, T3DVec3* tar
     if(channelMap->targetIdx == targetIdx && channelMap->targetType == targetType) {
       anim->targetsScalar[i].targetScalar = &target->v[channelMap->attributeIdx];
       anim->targetsScalar[i].base.changedFlag = updateFlag;
+      anim->targetsScalar[i].base.lastAnim = NULL;
     }
   }
+  attach_const(anim, targetIdx, target->v, updateFlag, targetType);
 }
 
 void t3d_anim_attach_pos(T3DAnim* anim, uint32_t targetIdx, T3DVec3* target, int32_t *updateFlag) {
@@ -105,29 +275,67 @@ void t3d_anim_attach_rot(T3DAnim *anim, uint32_t targetIdx, T3DQuat *target, int
     if(channelMap->targetIdx == targetIdx && channelMap->targetType == T3D_ANIM_TARGET_ROTATION) {
       anim->targetsQuat[i].targetQuat = target;
       anim->targetsQuat[i].base.changedFlag = updateFlag;
+      anim->targetsQuat[i].base.lastAnim = NULL;
+    }
+  }
+  attach_const(anim, targetIdx, target->v, updateFlag, T3D_ANIM_TARGET_ROTATION);
+}
+
+static inline float unormToFloat(uint32_t value, float maxValue, float offset, float scale) {
+  return (float)value / maxValue * scale + offset;
+}
+
+static int read_stream_byte(T3DAnim *anim) {
+  if(anim->buffPos >= anim->buffSize) {
+    uint32_t sizeLeft = anim->animRef->streamSize - anim->streamPos;
+    if(sizeLeft == 0)return -1;
+
+    anim->buffSize = sizeLeft < sizeof(anim->buff) ? sizeLeft : sizeof(anim->buff);
+    anim->buffPos = 0;
+    if(anim->file) {
+      fread(anim->buff, anim->buffSize, 1, anim->file);
+    } else {
+      dma_read(anim->buff, anim->animRef->streamAddr + anim->animRef->streamOffset + anim->streamPos, anim->buffSize);
     }
+    anim->streamPos += anim->buffSize;
   }
+  return anim->buff[anim->buffPos++];
 }
 
-static inline float s10ToFloat(uint32_t value, float offset, float scale) {
-  return (float)value / 1023.0f * scale + offset;
+static uint32_t read_stream_varint(T3DAnim *anim) {
+  uint32_t value = 0;
+  for(uint32_t shift=0;; shift += 7) {
+    int byte = read_stream_byte(anim);
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if(!(byte & 0x80))return value;
+  }
 }
 
-static inline void unpack_quat(uint16_t dataHi, uint16_t dataLo, T3DQuat *out) {
-  int largestIdx = dataHi >> 14;
+static inline uint64_t read_kf_data(T3DAnim *anim, uint32_t size) {
+  uint64_t value = 0;
+  for(uint32_t i=0; i<size; ++i) {
+    value = (value << 8) | (uint8_t)read_stream_byte(anim);
+  }
+  return value;
+}
+
+// unpacks a "smallest three" quaternion, with 'bits' per component and the largest index in the 2 MSBs
+static inline void unpack_quat(uint64_t value, uint32_t bits, T3DQuat *out) {
+  int largestIdx = (value >> (bits * 3)) & 0b11;
   int idx0 = (largestIdx + 1) & 0b11;
   int idx1 = (largestIdx + 2) & 0b11;
   int idx2 = (largestIdx + 3) & 0b11;
 
-  uint16_t dataMid = (dataHi << 6) | (dataLo >> 10);
-  float q0 = s10ToFloat((dataHi >> 4) & 0x3FF, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
-  float q1 = s10ToFloat((dataMid    ) & 0x3FF, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
-  float q2 = s10ToFloat((dataLo     ) & 0x3FF, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
+  uint32_t mask = (1 << bits) - 1;
+  float maxValue = (float)mask;
+  float q0 = unormToFloat((value >> (bits * 2)) & mask, maxValue, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
+  float q1 = unormToFloat((value >> bits      ) & mask, maxValue, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
+  float q2 = unormToFloat((value              ) & mask, maxValue, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
 
   out->v[idx0] = q0;
   out->v[idx1] = q1;
   out->v[idx2] = q2;
-  out->v[largestIdx] = sqrtf(1.0f - q0*q0 - q1*q1 - q2*q2);
+  out->v[largestIdx] = sqrtf(fmaxf(1.0f - q0*q0 - q1*q1 - q2*q2, 0.0f));
 }
 
 static inline T3DAnimTargetBase* get_base_target(T3DAnim *anim, uint64_t channelIdx, bool isRot) {
@@ -137,31 +345,53 @@ static inline T3DAnimTargetBase* get_base_target(T3DAnim *anim, uint64_t channel
 }
 
 static inline bool load_keyframe(T3DAnim *anim) {
-  T3DAnimKF kf;
-  size_t readBytes = fread(&kf, anim->nextKfSize, 1, anim->file);
-  if(readBytes == 0)return false;
+  uint32_t channelCount = anim->animRef->channelsQuat + anim->animRef->channelsScalar;
+  uint32_t channelIdx = anim->lastChannel + 1;
+  if(channelIdx >= channelCount)channelIdx = 0;
 
-  bool isLarge = kf.nextTime & 0x8000;
-  anim->nextKfSize = isLarge ? sizeof(T3DAnimKF) : (sizeof(T3DAnimKF)-2);
-  kf.nextTime &= 0x7FFF;
+  if(anim->runLeft) {
+    // inside a run, uses the next channel with the same time as before
+    --anim->runLeft;
+  } else {
+    int header = read_stream_byte(anim);
+    if(header < 0)return false;
+
+    if(header & KF_HEADER_RUN) {
+      anim->runLeft = header & 0x7F; // current KF is the first one of the run
+    } else {
+      uint32_t codeChannel = header & 0x0F;
+      uint32_t codeTime = (header >> 4) & 0x07;
+
+      if(codeChannel == KF_HEADER_CHANNEL_ABS) {
+        channelIdx = read_stream_varint(anim);
+      } else {
+        channelIdx = anim->lastChannel + codeChannel + 1;
+        if(channelIdx >= channelCount)channelIdx -= channelCount;
+      }
+      anim->lastTicks = codeTime == KF_HEADER_TIME_VARINT ? read_stream_varint(anim) : codeTime;
+    }
+  }
+  anim->lastChannel = channelIdx;
+  uint32_t nextTime = anim->lastTicks;
 
-  T3DAnimChannelMapping *channelMap = &anim->animRef->channelMappings[kf.channelIdx];
+  T3DAnimChannelMapping *channelMap = &anim->animRef->channelMappings[channelIdx];
 
-  bool isRot = kf.channelIdx < anim->animRef->channelsQuat;
-  T3DAnimTargetBase *targetBase = get_base_target(anim, kf.channelIdx, isRot);
+  bool isRot = channelIdx < anim->animRef->channelsQuat;
+  T3DAnimTargetBase *targetBase = get_base_target(anim, channelIdx, isRot);
 
   targetBase->timeStart = targetBase->timeEnd;
-  targetBase->timeEnd += (float)kf.nextTime * KF_TIME_TICK;
-  if(kf.nextTime == 0)targetBase->timeStart -= 0.00001f; // avoid zero-div for overlapping keyframes
+  targetBase->timeEnd += (float)nextTime * KF_TIME_TICK;
+  if(nextTime == 0)targetBase->timeStart -= 0.00001f; // avoid zero-div for overlapping keyframes
 
   if(channelMap->targetType == T3D_ANIM_TARGET_ROTATION) {
     T3DAnimTargetQuat *target = (T3DAnimTargetQuat*)targetBase;
     target->kfCurr = target->kfNext;
-    unpack_quat(kf.data[0], kf.data[1], &target->kfNext);
+    uint32_t bits = (channelMap->dataSize * 8 - 2) / 3;
+    unpack_quat(read_kf_data(anim, channelMap->dataSize), bits, &target->kfNext);
   } else {
     T3DAnimTargetScalar *target = (T3DAnimTargetScalar*)targetBase;
     target->kfCurr = target->kfNext;
-    target->kfNext = (float)kf.data[0] * channelMap->quantScale + channelMap->quantOffset;
+    target->kfNext = (float)read_kf_data(anim, channelMap->dataSize) * channelMap->quantScale + channelMap->quantOffset;
   }
 
   return true;
@@ -174,8 +404,8 @@ void t3d_anim_update(T3DAnim *anim, float deltaTime) {
 
   if(anim->time >= anim->animRef->duration) {
     anim->time -= anim->animRef->duration;
-    rewind_anim(anim);
     updateFlag = 2;
+    rewind_anim(anim, updateFlag);
 
     if(!anim->isLooping) {
       anim->isPlaying = 0;
@@ -183,6 +413,12 @@ void t3d_anim_update(T3DAnim *anim, float deltaTime) {
     }
   }
 
+  // constant channels are only written again if another animation on the same skeleton took over the bone
+  for(uint32_t c=0; c<anim->animRef->channelsConst; c++) {
+    const void **lastAnim = anim->targetsConst[c].lastAnim;
+    if(lastAnim && *lastAnim != anim)apply_const_channel(anim, c, updateFlag);
+  }
+
   uint32_t channelCount = anim->animRef->channelsScalar + anim->animRef->channelsQuat;
   for(uint32_t c=0; c<channelCount; c++)
   {
@@ -193,9 +429,22 @@ void t3d_anim_update(T3DAnim *anim, float deltaTime) {
       if(!load_keyframe(anim))break;
     }
 
+    *target->changedFlag = updateFlag;
+    if(target->lastAnim)*target->lastAnim = anim;
+
+    if(anim->animRef->channelMappings[c].flags & T3D_ANIM_CHANNEL_FLAG_STEP) {
+      if(isRot) {
+        T3DAnimTargetQuat *t = (T3DAnimTargetQuat*)target;
+        *t->targetQuat = t->kfCurr;
+      } else {
+        T3DAnimTargetScalar *t = (T3DAnimTargetScalar*)target;
+        *t->targetScalar = t->kfCurr;
+      }
+      continue;
+    }
+
     float timeDiff = target->timeEnd - target->timeStart;
     float interp = (anim->time - target->timeStart) / timeDiff;
-    *target->changedFlag = updateFlag;
 
     if(isRot) {
       T3DAnimTargetQuat *t = (T3DAnimTargetQuat*)target;
@@ -209,15 +458,18 @@ void t3d_anim_update(T3DAnim *anim, float deltaTime) {
 }
 
 void t3d_anim_destroy(T3DAnim *anim) {
-  if(anim->targetsQuat)free(anim->targetsQuat); // 'targetsScalar' is part of this memory-block
+  if(anim->targetsQuat)free(anim->targetsQuat); // 'targetsScalar' and 'targetsConst' are part of this memory-block
+  if(anim->animRef)free(anim->animRef);
   if(anim->file)fclose(anim->file);
+  anim->animRef = NULL;
+  anim->file = NULL;
   anim->targetsQuat = NULL;
   anim->targetsScalar = NULL;
-  anim->file = NULL;
+  anim->targetsConst = NULL;
 }
 
 void t3d_anim_set_time(T3DAnim *anim, float time) {
   if(time > anim->animRef->duration)time = anim->animRef->duration;
-  if(time < anim->time)rewind_anim(anim);
+  if(time < anim->time)rewind_anim(anim, 1);
   anim->time = time;
 }
@@ -19,10 +19,13 @@ extern "C"
 #define T3D_ANIM_TARGET_SCALE_S     2
 #define T3D_ANIM_TARGET_ROTATION    3
 
+#define T3D_ANIM_CHANNEL_FLAG_STEP  (1 << 0) // values are held until the next keyframe
+
 typedef struct {
   float timeStart;
   float timeEnd;
   int32_t* changedFlag; // flag to increment when target is changed
+  const void** lastAnim; // 'lastAnim' of the target bone, NULL for single targets
 } T3DAnimTargetBase;
 
 typedef struct {
@@ -40,22 +43,44 @@ typedef struct {
 } T3DAnimTargetScalar;
 
 typedef struct {
-  T3DChunkAnim *animRef;
+  float* target; // scalar, or the 4 components of a quaternion
+  int32_t* changedFlag;
+  const void** lastAnim; // 'lastAnim' of the target bone, NULL for single targets
+} T3DAnimTargetConst;
+
+typedef struct {
+  T3DChunkAnim *animRef; // copy of the definition, owned by the animation ('name' and 'filePath' are NULL)
+  const uint32_t *boneHashes; // name hashes of the bones the animation was made for (part of 'animRef')
   T3DAnimTargetQuat *targetsQuat;
   T3DAnimTargetScalar *targetsScalar;
+  T3DAnimTargetConst *targetsConst; // set on attach/rewind, and again if another animation wrote to the bone
+  FILE *file; // only for streams outside of DFS or compressed ones, others are read via DMA
 
   float speed;
   float time;
 
-  FILE *file;
-  int nextKfSize;
+  uint32_t streamPos; // read position in the stream, relative to its start
+  uint16_t boneCount; // number of entries in 'boneHashes'
+  uint16_t lastChannel; // decoder state of the keyframe stream
+  uint16_t lastTicks;
+  uint8_t runLeft;
   uint8_t isPlaying;
   uint8_t isLooping;
+
+  uint8_t buffPos; // buffered data from the stream
+  uint8_t buffSize;
+  uint8_t buff[31];
 } T3DAnim;
 
 /**
- * Creates an animation instance from a model's animation definition
- * @param model The model to create the animation from
+ * Creates an animation instance from a model's animation definition.
+ * The model can also be an animation library (see '--anim-lib' in the importer),
+ * which allows sharing animations across different models using the same bone names.
+ * The definition and the bone names (as hashes) are copied, so the model may drop its animations
+ * via 't3d_model_compact', or an animation library may be freed afterwards.
+ * Strings are not copied, the name of the animation is not available through the instance.
+ *
+ * @param model The model or animation library to create the animation from
  * @param name The name of the animation to create
  * @return The created animation
  */
@@ -63,6 +88,9 @@ T3DAnim t3d_anim_create(const T3DModel *model, const char* name);
 
 /**
  * Attaches an animation to a skeleton.
+ * If the skeleton has different bones than the model of the animation, they are matched by their name hash.
+ * Note that the single-target functions ('t3d_anim_attach_pos' etc.) always use the bone index of the animation.
+ *
  * @param anim The animation to attach
  * @param skeleton The skeleton to attach the animation to
  */
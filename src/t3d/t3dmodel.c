@@ -4,12 +4,9 @@
 */
 
 #include "t3dmodel.h"
+#include <malloc.h>
 
-#define T3DM_VERSION 0x04
-
-static inline void* patch_pointer(void *ptr, uint32_t offset) {
-  return (void*)(offset + (int32_t)ptr);
-}
+#define T3DM_VERSION 0x09
 
 static inline void* align_pointer(void *ptr, uint32_t alignment) {
   return (void*)(((uint32_t)ptr + alignment - 1) & ~(alignment - 1));
@@ -19,84 +16,195 @@ static inline bool is_power_of_two(uint16_t x) {
   return (x & (x - 1)) == 0;
 }
 
+#define BVH_STACK_SIZE 64
+#define TMEM_SIZE 4096
+
+// All pointers in a model are stored as offsets relative to the model itself
+typedef struct {
+  uint32_t pointerCount;
+  uint32_t stripCount;
+  uint32_t data[]; // offsets of all pointers, followed by all strip buffers as: (offset << 8) | count
+} T3DModelRelocs;
+
 typedef struct {
-  uint16_t objectPtr;
-} T3DBvhData;
+  uint32_t vertCount;
+  uint32_t indexSize;
+  uint32_t vertDataSize;
+  uint32_t indexDataSize;
+  uint8_t data[]; // vertices, followed by indices
+} T3DChunkMeshCodec;
+
+#define TEXTURE_CACHE_MIN_CAPACITY 32
 
+// Open-addressing (linear probing) hash table, 'hash' of 0 marks an empty slot
 typedef struct {
   uint32_t hash;
+  uint32_t refCount;
+  uint32_t lastUse; // used to evict the least-recently released texture first
+  uint32_t size; // approx. size in RDRAM
   sprite_t *texture;
-  uint32_t count;
+  bool noTmemTracking; // set once an upload used more TMEM than expected (e.g. mipmaps)
 } T3DTextureEntry;
 
-static uint32_t textureCacheSize = 0;
 static T3DTextureEntry *textureCache = NULL;
+static uint32_t textureCacheCapacity = 0; // always a power of two
+static uint32_t textureCacheCount = 0;
+static uint32_t textureCacheUnusedSize = 0; // size of all textures no longer referenced by any model
+static uint32_t textureCacheBudget = 0;
+static uint32_t textureCacheUseCounter = 0;
 static T3DModelState dummyState;
 
-static sprite_t* texture_cache_get(uint32_t hash) {
-  for(uint32_t i = 0; i < textureCacheSize; i++) {
-    if(textureCache[i].hash == hash) {
-      textureCache[i].count++;
-      return textureCache[i].texture;
-    }
+static inline uint32_t texture_cache_slot(uint32_t hash) {
+  return (hash ^ (hash >> 16)) & (textureCacheCapacity - 1);
+}
+
+static T3DTextureEntry* texture_cache_find(uint32_t hash) {
+  if(textureCacheCapacity == 0)return NULL;
+  uint32_t mask = textureCacheCapacity - 1;
+  for(uint32_t i = texture_cache_slot(hash);; i = (i + 1) & mask) {
+    if(textureCache[i].hash == hash)return &textureCache[i];
+    if(textureCache[i].hash == 0)return NULL;
   }
-  return NULL;
 }
 
-static void texture_cache_add(uint32_t hash, sprite_t *texture) {
-  T3DTextureEntry *cacheEntry = NULL;
-  for(uint32_t i = 0; i < textureCacheSize; i++) {
-    if(textureCache[i].hash == 0) {
-      cacheEntry = &textureCache[i];
-      break;
+static void texture_cache_insert(const T3DTextureEntry *entry) {
+  uint32_t mask = textureCacheCapacity - 1;
+  uint32_t i = texture_cache_slot(entry->hash);
+  while(textureCache[i].hash != 0)i = (i + 1) & mask;
+  textureCache[i] = *entry;
+}
+
+static void texture_cache_grow() {
+  T3DTextureEntry *oldCache = textureCache;
+  uint32_t oldCapacity = textureCacheCapacity;
+
+  textureCacheCapacity = oldCapacity ? (oldCapacity * 2) : TEXTURE_CACHE_MIN_CAPACITY;
+  textureCache = calloc(textureCacheCapacity, sizeof(T3DTextureEntry));
+  for(uint32_t i = 0; i < oldCapacity; i++) {
+    if(oldCache[i].hash != 0)texture_cache_insert(&oldCache[i]);
+  }
+  if(oldCache)free(oldCache);
+}
+
+// Removes an unreferenced entry, following entries are shifted back to keep all probe sequences intact
+static void texture_cache_remove(T3DTextureEntry *entry) {
+  sprite_free(entry->texture);
+  textureCacheUnusedSize -= entry->size;
+  --textureCacheCount;
+
+  uint32_t mask = textureCacheCapacity - 1;
+  uint32_t i = entry - textureCache;
+  for(uint32_t j = (i + 1) & mask; textureCache[j].hash != 0; j = (j + 1) & mask) {
+    uint32_t home = texture_cache_slot(textureCache[j].hash);
+    bool canMove = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+    if(canMove) {
+      textureCache[i] = textureCache[j];
+      i = j;
     }
   }
+  textureCache[i].hash = 0;
+}
 
-  if(cacheEntry == NULL) {
-    textureCacheSize++;
-    if(textureCache == NULL) {
-      textureCache = malloc(sizeof(T3DTextureEntry));
-    } else {
-      textureCache = realloc(textureCache, sizeof(T3DTextureEntry) * textureCacheSize);
+// Frees unreferenced textures (oldest first) until they are within the budget
+static void texture_cache_evict() {
+  while(textureCacheUnusedSize > textureCacheBudget) {
+    T3DTextureEntry *oldest = NULL;
+    for(uint32_t i = 0; i < textureCacheCapacity; i++) {
+      T3DTextureEntry *entry = &textureCache[i];
+      if(entry->hash != 0 && entry->refCount == 0 && (!oldest || entry->lastUse < oldest->lastUse)) {
+        oldest = entry;
+      }
     }
-    cacheEntry = &textureCache[textureCacheSize-1];
+    if(!oldest)return;
+    texture_cache_remove(oldest);
+  }
+}
+
+static sprite_t* texture_cache_get(uint32_t hash) {
+  T3DTextureEntry *entry = texture_cache_find(hash);
+  if(!entry)return NULL;
+  if(entry->refCount++ == 0)textureCacheUnusedSize -= entry->size;
+  return entry->texture;
+}
+
+static void texture_cache_add(uint32_t hash, sprite_t *texture) {
+  if((textureCacheCount + 1) * 2 > textureCacheCapacity) {
+    texture_cache_grow();
   }
 
-  cacheEntry->hash = hash;
-  cacheEntry->texture = texture;
-  cacheEntry->count = 1;
+  surface_t surf = sprite_get_pixels(texture);
+  T3DTextureEntry entry = {
+    .hash = hash,
+    .refCount = 1,
+    .lastUse = 0,
+    .size = surf.stride * surf.height,
+    .texture = texture
+  };
+  texture_cache_insert(&entry);
+  ++textureCacheCount;
 }
 
 static void texture_cache_free(uint32_t hash)
 {
-  for(uint32_t i = 0; i < textureCacheSize; i++) {
-    if(textureCache[i].hash == hash) {
-      textureCache[i].count--;
-      //debugf("Free Texture: %08lX, count=%lu\n", hash, textureCache[i].count);
-      if(textureCache[i].count == 0) {
-        sprite_free(textureCache[i].texture);
-        textureCache[i].hash = 0;
-      }
-      return;
-    }
+  T3DTextureEntry *entry = texture_cache_find(hash);
+  if(!entry)return;
+  //debugf("Free Texture: %08lX, count=%lu\n", hash, entry->refCount-1);
+  if(--entry->refCount == 0) {
+    entry->lastUse = ++textureCacheUseCounter;
+    textureCacheUnusedSize += entry->size;
+    texture_cache_evict();
   }
 }
 
 static void texture_cache_free_mem()
 {
-  uint32_t emptyEntries = 0;
-
-  for(uint32_t i = 0; i < textureCacheSize; i++) {
-    if(textureCache[i].hash == 0) {
-      emptyEntries++;
-    }
-  }
-
-  if(textureCache && emptyEntries == textureCacheSize)
+  if(textureCache && textureCacheCount == 0)
   {
     free(textureCache);
     textureCache = NULL;
-    textureCacheSize = 0;
+    textureCacheCapacity = 0;
+  }
+}
+
+void t3d_texture_cache_set_budget(uint32_t bytes) {
+  textureCacheBudget = bytes;
+  texture_cache_evict();
+  texture_cache_free_mem();
+}
+
+static void texture_load(T3DMaterialTexture *tex) {
+  if(!tex->texPath || tex->texture)return;
+  tex->texture = texture_cache_get(tex->textureHash);
+  if(tex->texture == NULL) {
+    //debugf("Not in cache, load %s (%08lX)\n", tex->texPath, tex->textureHash);
+    tex->texture = sprite_load(tex->texPath);
+    texture_cache_add(tex->textureHash, tex->texture);
+  }
+}
+
+void t3d_model_preload_textures(const T3DModel *model) {
+  T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_MATERIAL);
+  while(t3d_model_iter_next(&it)) {
+    texture_load(&it.material->textureA);
+    texture_load(&it.material->textureB);
+  }
+}
+
+static void get_texparms(const T3DMaterialTexture *tex, rdpq_tile_t tile, T3DModelDrawConf *conf, rdpq_texparms_t *texParam)
+{
+  *texParam = (rdpq_texparms_t){};
+  texParam->s.translate = tex->s.low;
+  texParam->s.mirror = tex->s.mirror;
+  texParam->s.repeats = tex->s.repeats;
+  texParam->s.scale_log = (int)tex->s.shift;
+
+  texParam->t.translate = tex->t.low;
+  texParam->t.mirror = tex->t.mirror;
+  texParam->t.repeats = tex->t.repeats;
+  texParam->t.scale_log = (int)tex->t.shift;
+
+  if(conf && conf->tileCb) {
+    conf->tileCb(conf->userData, texParam, tile);
   }
 }
 
@@ -106,59 +214,272 @@ static void set_texture(T3DMaterial *mat, rdpq_tile_t tile, T3DModelDrawConf *co
   if(tex->texPath || tex->texReference)
   {
     //debugf("Load Texture: %s (%08lX)\n", tex->texPath, tex->textureHash);
-    if(tex->texPath && !tex->texture) {
-      tex->texture = texture_cache_get(tex->textureHash);
-      if(tex->texture == NULL) {
-        //debugf("Not in cache, load %s (%08lX)\n", tex->texPath, tex->textureHash);
-        tex->texture = sprite_load(tex->texPath);
-        //const char* formatName = tex_format_name(sprite_get_format(mat->texture));
-        //debugf(" -> %s\n", formatName);
-        texture_cache_add(tex->textureHash, tex->texture);
-      }
-    }
-
-    rdpq_texparms_t texParam = (rdpq_texparms_t){};
-    texParam.s.translate = tex->s.low;
-    texParam.s.mirror = tex->s.mirror;
-    texParam.s.repeats = REPEAT_INFINITE;
-    texParam.s.scale_log = (int)tex->s.shift;
-
-    if(tex->s.clamp) {
-      if(is_power_of_two(tex->texWidth)) {
-        texParam.s.repeats = (tex->s.height-tex->s.low+1) / (float)tex->texWidth;
+    texture_load(tex);
+
+    rdpq_texparms_t texParam;
+    get_texparms(tex, tile, conf, &texParam);
+
+    if(tex->texReference) {
+      if(conf && conf->dynTextureCb)conf->dynTextureCb(conf->userData, mat, &texParam, tile);
+    } else {
+      if(tile == TILE1 && mat->textureA.textureHash == mat->textureB.textureHash) {
+        rdpq_tex_reuse(TILE1, &texParam);
       } else {
-        texParam.s.repeats = 1;
+        rdpq_sprite_upload(tile, tex->texture, &texParam);
       }
     }
+  }
+}
 
-    texParam.t.translate = tex->t.low;
-    texParam.t.mirror = tex->t.mirror;
-    texParam.t.repeats = REPEAT_INFINITE;
-    texParam.t.scale_log = (int)tex->t.shift;
+static inline uint32_t tmem_pitch(tex_format_t fmt, uint32_t width) {
+  return (TEX_FORMAT_PIX2BYTES(fmt, width) + 7) & ~7;
+}
 
-    if(tex->t.clamp) {
-      if(is_power_of_two(tex->texHeight)) {
-        texParam.t.repeats = (tex->t.height-tex->t.low+1) / (float)tex->texHeight;
-      } else {
-        texParam.t.repeats = 1;
+// Only plain textures are tracked, palettes and RGBA32 use TMEM in ways not covered here
+static bool tmem_can_track(T3DMaterialTexture *tex) {
+  if(tex->texReference)return false;
+  if(!tex->texPath)return true;
+
+  texture_load(tex);
+  if(texture_cache_find(tex->textureHash)->noTmemTracking)return false;
+  tex_format_t fmt = sprite_get_format(tex->texture);
+  if(fmt == FMT_CI4 || fmt == FMT_CI8 || fmt == FMT_RGBA32 || fmt == FMT_YUV16)return false;
+  return is_power_of_two(tex->texture->width) && is_power_of_two(tex->texture->height);
+}
+
+static T3DTmemEntry* tmem_find(T3DTmemState *tmem, uint32_t hash) {
+  for(uint32_t i = 0; i < T3D_TMEM_MAX_ENTRIES; i++) {
+    if(tmem->entries[i].hash == hash)return &tmem->entries[i];
+  }
+  return NULL;
+}
+
+/**
+ * Finds the first gap in TMEM that fits 'size' bytes, so small textures end up next to each other.
+ * If there is none, the least-recently used textures are evicted until it fits.
+ * Textures of the current material are never evicted, returns NULL if it doesn't fit regardless.
+ */
+static T3DTmemEntry* tmem_alloc(T3DTmemState *tmem, uint32_t hash, uint32_t size) {
+  for(;;) {
+    uint32_t addr = 0;
+    T3DTmemEntry *freeEntry = NULL;
+    T3DTmemEntry *lruEntry = NULL;
+    for(bool moved = true; moved;) {
+      moved = false;
+      for(uint32_t i = 0; i < T3D_TMEM_MAX_ENTRIES; i++) {
+        T3DTmemEntry *entry = &tmem->entries[i];
+        if(!entry->hash)continue;
+        if(addr < entry->addr + entry->size && entry->addr < addr + size) {
+          addr = entry->addr + entry->size;
+          moved = true;
+        }
       }
     }
 
-    if(conf && conf->tileCb) {
-      conf->tileCb(conf->userData, &texParam, tile);
+    for(uint32_t i = 0; i < T3D_TMEM_MAX_ENTRIES; i++) {
+      T3DTmemEntry *entry = &tmem->entries[i];
+      if(!entry->hash) {
+        freeEntry = entry;
+      } else if(entry->lastUse != tmem->useCounter && (!lruEntry || entry->lastUse < lruEntry->lastUse)) {
+        lruEntry = entry;
+      }
     }
 
-    // @TODO: don't upload texture if only the tile settings differ
-    if(tex->texReference) {
-      if(conf && conf->dynTextureCb)conf->dynTextureCb(conf->userData, mat, &texParam, tile);
-    } else {
-      if(tile == TILE1 && mat->textureA.textureHash == mat->textureB.textureHash) {
-        rdpq_tex_reuse(TILE1, &texParam);
+    if(freeEntry && addr + size <= TMEM_SIZE) {
+      *freeEntry = (T3DTmemEntry){.hash = hash, .addr = addr, .size = size, .lastUse = tmem->useCounter};
+      return freeEntry;
+    }
+    if(!lruEntry)return NULL;
+    lruEntry->hash = 0;
+  }
+}
+
+// Sets up a tile for a texture in TMEM, using the same parameters that are passed to 'rdpq_sprite_upload'
+static void tmem_set_tile(rdpq_tile_t tile, sprite_t *sprite, uint32_t addr, const rdpq_texparms_t *texParam) {
+  tex_format_t fmt = sprite_get_format(sprite);
+  bool clampS = texParam->s.repeats != REPEAT_INFINITE;
+  bool clampT = texParam->t.repeats != REPEAT_INFINITE;
+
+  rdpq_set_tile(tile, fmt, addr, tmem_pitch(fmt, sprite->width), &(rdpq_tileparms_t){
+    .s = {.clamp = clampS, .mirror = texParam->s.mirror, .mask = __builtin_ctz(sprite->width), .shift = texParam->s.scale_log},
+    .t = {.clamp = clampT, .mirror = texParam->t.mirror, .mask = __builtin_ctz(sprite->height), .shift = texParam->t.scale_log},
+  });
+
+  float s0 = texParam->s.translate;
+  float t0 = texParam->t.translate;
+  rdpq_set_tile_size(tile, s0, t0,
+    s0 + sprite->width * (clampS ? texParam->s.repeats : 1.0f),
+    t0 + sprite->height * (clampT ? texParam->t.repeats : 1.0f)
+  );
+}
+
+/**
+ * Sets both textures of a material, textures still in TMEM only get their tile set up again.
+ * Returns false if any texture can't be tracked, in that case TMEM has to be treated as unknown.
+ */
+static bool set_textures_tracked(T3DMaterial *mat, T3DModelState *state)
+{
+  if(!tmem_can_track(&mat->textureA) || !tmem_can_track(&mat->textureB))return false;
+
+  T3DTmemState *tmem = &state->tmem;
+  ++tmem->useCounter;
+  for(uint32_t i = 0; i < 2; i++) {
+    rdpq_tile_t tile = i ? TILE1 : TILE0;
+    T3DMaterialTexture *tex = i ? &mat->textureB : &mat->textureA;
+    if(!tex->texPath)continue;
+
+    rdpq_texparms_t texParam;
+    get_texparms(tex, tile, state->drawConf, &texParam);
+
+    T3DTmemEntry *entry = tmem_find(tmem, tex->textureHash);
+    if(!entry) {
+      uint32_t size = tmem_pitch(sprite_get_format(tex->texture), tex->texture->width) * tex->texture->height;
+      entry = tmem_alloc(tmem, tex->textureHash, size);
+      if(!entry)return false;
+
+      // sprites with mipmaps or detail textures need more space than expected, these are not tracked
+      texParam.tmem_addr = entry->addr;
+      if(rdpq_sprite_upload(tile, tex->texture, &texParam) != (int)size) {
+        texture_cache_find(tex->textureHash)->noTmemTracking = true;
+        return false;
+      }
+    }
+
+    entry->lastUse = tmem->useCounter;
+    tmem_set_tile(tile, tex->texture, entry->addr, &texParam);
+  }
+  return true;
+}
+
+/**
+ * Decoder for the compressed vertex/index chunk.
+ * This is a port of meshoptimizer's vertex codec (version 0, scalar path).
+ * Data is split into blocks of up to 256 elements, each byte of an element is stored
+ * as delta to the previous element in groups of 16 using either 0, 2, 4 or 8 bits.
+ */
+#define CODEC_BLOCK_MAX_SIZE 256
+#define CODEC_GROUP_SIZE 16
+#define CODEC_GROUP_DECODE_LIMIT 24
+#define CODEC_TAIL_SIZE 32
+
+// byte offset of each deinterleaved vertex byte inside a T3DVertPacked, for the first vertex
+static const uint8_t CODEC_VERT_OFFSETS[16] = {0,1,2,3,4,5,6,7, 16,17,18,19, 24,25,26,27};
+// added to the offsets above for the second vertex of a pair
+static const uint8_t CODEC_VERT_OFFSETS_B[16] = {8,8,8,8,8,8,8,8, 4,4,4,4, 4,4,4,4};
+
+static const uint8_t* codec_decode_group(const uint8_t *data, uint8_t *buffer, int bitsLog2)
+{
+  if(bitsLog2 == 0) {
+    memset(buffer, 0, CODEC_GROUP_SIZE);
+    return data;
+  }
+  if(bitsLog2 == 3) {
+    memcpy(buffer, data, CODEC_GROUP_SIZE);
+    return data + CODEC_GROUP_SIZE;
+  }
+
+  // values are packed into bytes, values with all bits set are stored in a full byte after that
+  int bits = 1 << bitsLog2;
+  uint8_t sentinel = (1 << bits) - 1;
+  const uint8_t *dataVar = data + bits * 2;
+  for(int i=0; i<CODEC_GROUP_SIZE; i += 8/bits) {
+    uint8_t byte = *data++;
+    for(int b=0; b<8/bits; ++b) {
+      uint8_t enc = byte >> (8 - bits);
+      byte <<= bits;
+      *buffer++ = (enc == sentinel) ? *dataVar++ : enc;
+    }
+  }
+  return dataVar;
+}
+
+static const uint8_t* codec_decode_block(
+  const uint8_t *data, const uint8_t *dataEnd, uint8_t *dst,
+  uint32_t count, uint32_t stride, uint8_t *lastElem, bool isVertex
+) {
+  uint8_t buffer[CODEC_BLOCK_MAX_SIZE];
+  uint32_t countAligned = (count + CODEC_GROUP_SIZE - 1) & ~(CODEC_GROUP_SIZE - 1);
+  uint32_t headerSize = (countAligned / CODEC_GROUP_SIZE + 3) / 4;
+
+  for(uint32_t k=0; k<stride; ++k)
+  {
+    const uint8_t *header = data;
+    if((uint32_t)(dataEnd - data) < headerSize)return NULL;
+    data += headerSize;
+
+    for(uint32_t i=0; i<countAligned; i += CODEC_GROUP_SIZE) {
+      if((uint32_t)(dataEnd - data) < CODEC_GROUP_DECODE_LIMIT)return NULL;
+      uint32_t g = i / CODEC_GROUP_SIZE;
+      data = codec_decode_group(data, buffer + i, (header[g / 4] >> ((g % 4) * 2)) & 3);
+    }
+
+    // undo zigzag + delta encoding, vertices are written back into their interleaved layout
+    uint8_t p = lastElem[k];
+    for(uint32_t i=0; i<count; ++i) {
+      uint8_t v = buffer[i];
+      p += (uint8_t)(-(v & 1) ^ (v >> 1));
+      if(isVertex) {
+        dst[(i >> 1) * sizeof(T3DVertPacked) + CODEC_VERT_OFFSETS[k] + (i & 1) * CODEC_VERT_OFFSETS_B[k]] = p;
       } else {
-        rdpq_sprite_upload(tile, tex->texture, &texParam);
+        dst[i * stride + k] = p;
       }
     }
+    lastElem[k] = p;
+  }
+  return data;
+}
+
+static bool codec_decode(uint8_t *dst, uint32_t count, uint32_t stride, const uint8_t *data, uint32_t dataSize, bool isVertex)
+{
+  const uint8_t *dataEnd = data + dataSize;
+  if(dataSize < 1 + stride || (*data++ & 0xF0) != 0xA0)return false;
+
+  uint8_t lastElem[16];
+  memcpy(lastElem, dataEnd - stride, stride);
+
+  uint32_t blockSize = 8192 / stride;
+  blockSize &= ~(CODEC_GROUP_SIZE - 1);
+  if(blockSize > CODEC_BLOCK_MAX_SIZE)blockSize = CODEC_BLOCK_MAX_SIZE;
+
+  for(uint32_t offset=0; offset < count; offset += blockSize) {
+    uint32_t size = (count - offset) < blockSize ? (count - offset) : blockSize;
+    // vertex blocks are always even in size, so each block starts at a new pair
+    uint8_t *blockDst = isVertex ? (dst + (offset / 2) * sizeof(T3DVertPacked)) : (dst + offset * stride);
+    data = codec_decode_block(data, dataEnd, blockDst, size, stride, lastElem, isVertex);
+    if(!data)return false;
+  }
+  return (uint32_t)(dataEnd - data) == CODEC_TAIL_SIZE;
+}
+
+// Decodes a compressed vertex/index chunk.
+// Returns a new (larger) buffer with the decoded data placed at the start of the chunk,
+// anything after the chunk is moved back to make room (the importer already accounts for that).
+static T3DModel* model_decode_mesh(T3DModel *model, uint32_t chunkIdx, int *size)
+{
+  uint32_t offset = model->chunkOffsets[chunkIdx].offset & 0x00FFFFFF;
+  const T3DChunkMeshCodec *codec = (const T3DChunkMeshCodec*)((char*)model + offset);
+
+  uint32_t vertSize = codec->vertCount * sizeof(T3DVertPacked) / 2;
+  uint32_t indexSizeAligned = (codec->indexSize + 7) & ~7;
+  uint32_t restOffset = (offset + sizeof(T3DChunkMeshCodec) + codec->vertDataSize + codec->indexDataSize + 15) & ~15;
+  uint32_t restOffsetNew = (offset + vertSize + indexSizeAligned + 15) & ~15;
+  uint32_t newSize = restOffsetNew + (*size - restOffset);
+
+  T3DModel *newModel = memalign(16, newSize);
+  memcpy(newModel, model, offset);
+  memcpy((char*)newModel + restOffsetNew, (char*)model + restOffset, *size - restOffset);
+
+  uint8_t *dst = (uint8_t*)newModel + offset;
+  const uint8_t *data = codec->data;
+  bool valid = codec_decode(dst, codec->vertCount, 16, data, codec->vertDataSize, true);
+  if(valid && codec->indexSize) {
+    valid = codec_decode(dst + vertSize, indexSizeAligned / 8, 8, data + codec->vertDataSize, codec->indexDataSize, false);
   }
+  assertf(valid, "Invalid compressed mesh data in T3D model");
+
+  free(model);
+  *size = newSize;
+  return newModel;
 }
 
 static bool handle_bone_matrix(const T3DObjectPart *part, const T3DMat4FP* matStack, bool hadMatrixPush)
@@ -181,93 +502,74 @@ static bool handle_bone_matrix(const T3DObjectPart *part, const T3DMat4FP* matSt
   return hadMatrixPush;
 }
 
+/**
+ * Turns all offsets into pointers and adds the DMEM address to the strip indices.
+ * Everything else is already stored in its final form by the importer.
+ */
+static void model_relocate(T3DModel *model)
+{
+  const T3DModelRelocs *relocs = (const T3DModelRelocs*)((char*)model + model->relocTableOffset);
+  uint32_t base = (uint32_t)model;
+  for(uint32_t i = 0; i < relocs->pointerCount; i++) {
+    *(uint32_t*)((char*)model + relocs->data[i]) += base;
+  }
+
+  uint8_t *basePtrIndices = (uint8_t*)t3d_model_get_chunk(model, model->chunkIdxIndices);
+  const uint32_t *strips = &relocs->data[relocs->pointerCount];
+  for(uint32_t i = 0; i < relocs->stripCount; i++) {
+    t3d_indexbuffer_rebase((int16_t*)(basePtrIndices + (strips[i] >> 8)), strips[i] & 0xFF);
+  }
+}
+
 T3DModel *t3d_model_load(const char *path) {
   int size = 0;
   T3DModel* model = asset_load(path, &size);
-  int32_t ptrOffset = (int32_t)(void*)model;
 
   if(memcmp(model->magic, "T3M", 3) != 0) {
     assertf(false, "Invalid T3D model file: %s", path);
   }
+  return t3d_model_load_buffer(model, size);
+}
+
+T3DModel *t3d_model_load_buffer(void *data, int size) {
+  T3DModel* model = (T3DModel*)data;
+  assertf(memcmp(model->magic, "T3M", 3) == 0, "Invalid T3D model data");
   assertf(model->magic[3] == T3DM_VERSION,
     "Invalid T3D model version: %d != %d\n"
     "Please make a clean build of t3d and your project",
     T3DM_VERSION, model->magic[3]);
 
-  void* basePtrVertices = (char*)model + (model->chunkOffsets[model->chunkIdxVertices].offset & 0xFFFFFF);
-  void* basePtrIndices = (char*)model + (model->chunkOffsets[model->chunkIdxIndices].offset & 0xFFFFFF);
-  model->stringTablePtr = patch_pointer(model->stringTablePtr, ptrOffset);
-
-  for(uint32_t i = 0; i < model->chunkCount; i++)
-  {
-    char chunkType = model->chunkOffsets[i].type;
-    uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-    //debugf("Chunk[%lu] '%c': %lx\n", i, chunkType, (uint32_t)offset);
-
-    if(chunkType == T3D_CHUNK_TYPE_OBJECT) {
-      T3DObject *obj = (T3DObject*)((char*)model + offset);
-      if(obj->name != NULL) {
-        obj->name = patch_pointer(obj->name, (uint32_t)model->stringTablePtr);
-      }
-
-      uint32_t matIdx = model->chunkIdxMaterials + (uint32_t)obj->material;
-      obj->material = (T3DMaterial*)((char*)model + (model->chunkOffsets[matIdx].offset & 0xFFFFFF));
-
-      for(uint32_t j = 0; j < obj->numParts; j++) {
-        T3DObjectPart *part = &obj->parts[j];
-        part->indices = patch_pointer(part->indices, (uint32_t)basePtrIndices);
-        part->vert = patch_pointer(part->vert, (uint32_t)basePtrVertices);
-
-        uint8_t *stripPtr = align_pointer(part->indices + part->numIndices, 8);
-        for(int s=0; s<4; ++s) {
-          if(part->numStripIndices[s] == 0)break;
-          t3d_indexbuffer_convert((int16_t*)stripPtr, part->numStripIndices[s]);
-          stripPtr = (uint8_t*)align_pointer(stripPtr + part->numStripIndices[s]*2, 8);
-        }
-      }
-    }
-
-    if(chunkType == T3D_CHUNK_TYPE_MATERIAL) {
-      T3DMaterial *mat = (T3DMaterial*)((char*)model + offset);
-
-      if(mat->name)mat->name += (uint32_t)model->stringTablePtr;
-      if(mat->textureA.texPath)mat->textureA.texPath += (uint32_t)model->stringTablePtr;
-      if(mat->textureB.texPath)mat->textureB.texPath += (uint32_t)model->stringTablePtr;
+  // the lookup is not relocated yet, so scan for the compressed vertices/indices.
+  // Decoding needs a larger buffer, the caller handed over ownership of 'data' so it is freed in there
+  for(uint32_t i = 0; i < model->chunkCount; i++) {
+    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_MESH_CODEC) {
+      model = model_decode_mesh(model, i, &size);
+      break;
     }
+  }
 
-    if(chunkType == T3D_CHUNK_TYPE_SKELETON) {
-      T3DChunkSkeleton *skel = (T3DChunkSkeleton*)((char*)model + offset);
-      for(int j = 0; j < skel->boneCount; j++) {
-        T3DChunkBone *bone = &skel->bones[j];
-        bone->name = patch_pointer(bone->name, (uint32_t)model->stringTablePtr);
-      }
-    }
+  model_relocate(model);
 
-    if(chunkType == T3D_CHUNK_TYPE_ANIM) {
-      T3DChunkAnim *anim = (T3DChunkAnim*)((char*)model + offset);
-      anim->name = patch_pointer(anim->name, (uint32_t)model->stringTablePtr);
-      anim->filePath = patch_pointer(anim->filePath, (uint32_t)model->stringTablePtr);
-    }
+  data_cache_hit_writeback_invalidate(model, size);
+  return model;
+}
 
-    if(chunkType == T3D_CHUNK_TYPE_BVH) {
-      // node leafs are stored as indices to the objects, we convert that to an relative address
-      // to the actual object, shifted by 2 since it's 4 byte aligned (and nodes use 16bit indices)
-      T3DBvh *bvh = (T3DBvh*)((char*)model + offset);
-      T3DBvhData *data = (T3DBvhData*)&bvh->nodes[bvh->nodeCount]; // data is right after nodes
+static void draw_object_with_material(const T3DModel* model, const T3DObject *object, T3DModelState *state)
+{
+  const T3DModelDrawConf *conf = state->drawConf;
+  if(conf->filterCb && !conf->filterCb(conf->userData, object)) {
+    return;
+  }
 
-      for(int d=0; d<bvh->dataCount; ++d) {
-        T3DObject *obj = t3d_model_get_object_by_index(model, data[d].objectPtr);
-        uint32_t addr = (uint32_t)bvh  - (uint32_t)obj;
-        assert((addr & 0b11) == 0);
-        addr >>= 2;
-        assert(addr < 0x10000);
-        data[d].objectPtr = addr;
-      }
-    }
+  if(object->material) {
+    t3d_model_draw_material(object->material, state);
   }
 
-  data_cache_hit_writeback_invalidate(model, size);
-  return model;
+  if(object->isInstanced) {
+    t3d_model_draw_instances(t3d_model_get_instances(model, object), conf->frustum);
+  } else {
+    t3d_model_draw_object_culled(object, conf->matrices, conf->camPos);
+  }
 }
 
 void t3d_model_draw_custom(const T3DModel* model, T3DModelDrawConf conf)
@@ -276,16 +578,20 @@ void t3d_model_draw_custom(const T3DModel* model, T3DModelDrawConf conf)
   state.drawConf = &conf;
 
   T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_OBJECT);
-  while(t3d_model_iter_next(&it))
-  {
-    if(conf.filterCb && !conf.filterCb(conf.userData, it.object)) {
-      continue;
-    }
+  while(t3d_model_iter_next(&it)) {
+    draw_object_with_material(model, it.object, &state);
+  }
 
-    if(it.object->material) {
-      t3d_model_draw_material(it.object->material, &state);
-    }
-    t3d_model_draw_object(it.object, conf.matrices);
+  if(state.lastVertFXFunc != T3D_VERTEX_FX_NONE)t3d_state_set_vertex_fx(T3D_VERTEX_FX_NONE, 0, 0);
+}
+
+void t3d_model_draw_objects(const T3DModel* model, T3DObject * const *objects, uint32_t count, T3DModelDrawConf conf)
+{
+  T3DModelState state = t3d_model_state_create();
+  state.drawConf = &conf;
+
+  for(uint32_t i=0; i<count; ++i) {
+    draw_object_with_material(model, objects[i], &state);
   }
 
   if(state.lastVertFXFunc != T3D_VERTEX_FX_NONE)t3d_state_set_vertex_fx(T3D_VERTEX_FX_NONE, 0, 0);
@@ -301,12 +607,78 @@ void t3d_model_make_object_vert_placeholder(const T3DModel *model, T3DObject *ob
   }
 }
 
+// normal cone test, see 'meshopt_computeClusterBounds' in the importer
+static inline bool part_faces_away(const T3DObjectPart *part, const T3DVec3 *camPos)
+{
+  if(part->coneCutoff == 127)return false;
+  float dotAxis = 0.0f;
+  float distSq = 0.0f;
+  for(int i = 0; i < 3; i++) {
+    float d = part->coneCenter[i] - camPos->v[i];
+    dotAxis += d * part->coneAxis[i];
+    distSq += d * d;
+  }
+  // both sides are scaled by 127 to keep the quantized axis and cutoff as is
+  return dotAxis >= part->coneCutoff * sqrtf(distSq) + part->coneRadius * 127.0f;
+}
+
+/**
+ * Draws all triangles of a part, 'idxOffset' moves them to another place in the vertex cache.
+ * Strips store final DMEM addresses, so they are always drawn as is.
+ * Returns true if the last command already synced.
+ */
+static bool draw_part_triangles(const T3DObjectPart *part, uint32_t idxOffset)
+{
+  bool didSync = false;
+  for(int i = 0; i < part->numIndices; i+=3) {
+    t3d_tri_draw(part->indices[i] + idxOffset, part->indices[i+1] + idxOffset, part->indices[i+2] + idxOffset);
+  }
+
+  // ...then sequences (aka unindexed triangles)
+  if(part->idxSeqCount != 0) {
+    t3d_tri_draw_unindexed(part->idxSeqBase + idxOffset, part->idxSeqCount);
+    didSync = true;
+  }
+
+  // ...then strips, which are an encoded index buffer DMA'd by the RSP.
+  // Internally, this will re-use the space of the vertex cache of verts. that are not used anymore
+  uint8_t *idxPtrBase = (uint8_t*)align_pointer(part->indices + part->numIndices, 8);
+
+  if (part->numStripIndices[0] != 0) {
+    didSync = false;
+    for(int s=0; s<4; ++s) {
+      bool isLastStrip = s == 3 || part->numStripIndices[s+1] == 0;
+      if (isLastStrip) {
+        t3d_tri_draw_strip_and_sync((int16_t*)idxPtrBase, part->numStripIndices[s]);
+        didSync = true;
+        break;
+      }
+
+      t3d_tri_draw_strip((int16_t*)idxPtrBase, part->numStripIndices[s]);
+      idxPtrBase = (uint8_t*)align_pointer(idxPtrBase + part->numStripIndices[s] * 2, 8);
+    }
+  }
+  return didSync;
+}
+
 void t3d_model_draw_object(const T3DObject *object, const T3DMat4FP *boneMatrices)
 {
+  t3d_model_draw_object_culled(object, boneMatrices, NULL);
+}
+
+void t3d_model_draw_object_culled(const T3DObject *object, const T3DMat4FP *boneMatrices, const T3DVec3 *camPos)
+{
+  if(object->drawBlock && !boneMatrices && !camPos) {
+    rspq_block_run(object->drawBlock);
+    return;
+  }
+
   bool hadMatrixPush = false;
   for(uint32_t p = 0; p < object->numParts; p++)
   {
     const T3DObjectPart *part = &object->parts[p];
+    if(camPos && part_faces_away(part, camPos))continue;
+
     hadMatrixPush = handle_bone_matrix(part, boneMatrices, hadMatrixPush);
 
     // load vertices, this will already do T&L (so matrices/fog/lighting must be set before)
@@ -319,35 +691,7 @@ void t3d_model_draw_object(const T3DObject *object, const T3DMat4FP *boneMatrice
       continue; // partial-load, last chunk of a sequence will both indices & material data
     }
 
-    bool didSync = false;
-    for(int i = 0; i < part->numIndices; i+=3) {
-      t3d_tri_draw(part->indices[i], part->indices[i+1], part->indices[i+2]);
-    }
-
-    // ...then sequences (aka unindexed triangles)
-    if(part->idxSeqCount != 0) {
-      t3d_tri_draw_unindexed(part->idxSeqBase, part->idxSeqCount);
-      didSync = true;
-    }
-
-    // ...then strips, which are an encoded index buffer DMA'd by the RSP.
-    // Internally, this will re-use the space of the vertex cache of verts. that are not used anymore
-    uint8_t *idxPtrBase = (uint8_t*)align_pointer(part->indices + part->numIndices, 8);
-
-    if (part->numStripIndices[0] != 0) {
-      didSync = false;
-      for(int s=0; s<4; ++s) {
-        bool isLastStrip = s == 3 || part->numStripIndices[s+1] == 0;
-        if (isLastStrip) {
-          t3d_tri_draw_strip_and_sync((int16_t*)idxPtrBase, part->numStripIndices[s]);
-          didSync = true;
-          break;
-        }
-
-        t3d_tri_draw_strip((int16_t*)idxPtrBase, part->numStripIndices[s]);
-        idxPtrBase = (uint8_t*)align_pointer(idxPtrBase + part->numStripIndices[s] * 2, 8);
-      }
-    }
+    bool didSync = draw_part_triangles(part, 0);
 
     // Sync, waits for any triangles in flight. This is necessary since the rdpq-api is not
     // aware of this and could corrupt the RDP buffer. 't3d_vert_load' may also overwrite the source buffer too.
@@ -360,6 +704,41 @@ void t3d_model_draw_object(const T3DObject *object, const T3DMat4FP *boneMatrice
   if(hadMatrixPush)t3d_matrix_pop(1);
 }
 
+// blend color is also the threshold for alpha compare
+static inline bool material_sets_blend_color(const T3DMaterial *mat) {
+  return (mat->setColorFlags & 0b100) || (mat->otherModeValue & SOM_ALPHACOMPARE_THRESHOLD);
+}
+
+void t3d_model_record_materials(T3DModel *model)
+{
+  T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_MATERIAL);
+  while(t3d_model_iter_next(&it)) {
+    T3DMaterial *mat = it.material;
+    if(mat->block)rspq_block_free(mat->block);
+    mat->block = NULL;
+    if(!mat->colorCombiner)continue;
+
+    rspq_block_begin();
+      rdpq_mode_combiner(mat->colorCombiner);
+      rdpq_mode_blender(mat->blendMode);
+      if(mat->setColorFlags & 0b001)rdpq_set_prim_color(mat->primColor);
+      if(mat->setColorFlags & 0b010)rdpq_set_env_color(mat->envColor);
+      if(material_sets_blend_color(mat))rdpq_set_blend_color(mat->blendColor);
+      __rdpq_mode_change_som(mat->otherModeMask, mat->otherModeValue);
+    mat->block = rspq_block_end();
+  }
+}
+
+void t3d_model_record_object(T3DObject *object)
+{
+  if(object->drawBlock)rspq_block_free(object->drawBlock);
+  object->drawBlock = NULL;
+
+  rspq_block_begin();
+    t3d_model_draw_object(object, NULL);
+  object->drawBlock = rspq_block_end();
+}
+
 void t3d_model_draw_material(T3DMaterial *mat, T3DModelState *state)
 {
   if(!state) {
@@ -385,54 +764,69 @@ void t3d_model_draw_material(T3DMaterial *mat, T3DModelState *state)
   // and only need to happen before a `t3d_tri_draw` call
   if(mat->colorCombiner)
   {
-    bool setBlendMode  = state->lastBlendMode != mat->blendMode;
-    bool setCC         = mat->colorCombiner != state->lastCC;
-    bool setTexture    = state->lastTextureHashA != mat->textureA.textureHash || state->lastTextureHashB != mat->textureB.textureHash;
-    bool setOtherMode  = state->lastOtherMode != mat->otherModeValue || setTexture;
-    bool setPrimColor  = (mat->setColorFlags & 0b001) && color_to_packed32(state->lastPrimColor) != color_to_packed32(mat->primColor);
-    bool setEnvColor   = (mat->setColorFlags & 0b010) && color_to_packed32(state->lastEnvColor) != color_to_packed32(mat->envColor);
-    bool setBlendColor = (mat->setColorFlags & 0b100) || (mat->otherModeValue & SOM_ALPHACOMPARE_THRESHOLD);
-    setBlendColor = setBlendColor && color_to_packed32(state->lastBlendColor) != color_to_packed32(mat->blendColor);
-
+    bool setTexture = state->lastTextureHashA != mat->textureA.textureHash || state->lastTextureHashB != mat->textureB.textureHash;
     if(setTexture)
     {
       state->lastTextureHashA = mat->textureA.textureHash;
       state->lastTextureHashB = mat->textureB.textureHash;
 
-      rdpq_tex_multi_begin();
-        set_texture(mat, TILE0, state->drawConf);
-        set_texture(mat, TILE1, state->drawConf);
-      rdpq_tex_multi_end();
+      if(!set_textures_tracked(mat, state)) {
+        state->tmem = (T3DTmemState){};
+        rdpq_tex_multi_begin();
+          set_texture(mat, TILE0, state->drawConf);
+          set_texture(mat, TILE1, state->drawConf);
+        rdpq_tex_multi_end();
+      }
     }
 
-    if(setCC) {
-      state->lastCC = mat->colorCombiner;
-      rdpq_mode_combiner(mat->colorCombiner);
-    }
+    // recorded state is applied as a whole, uploading textures may change the other-modes too
+    if(mat->block) {
+      if(setTexture || state->lastMaterial != mat) {
+        rspq_block_run(mat->block);
+        state->lastCC = mat->colorCombiner;
+        state->lastBlendMode = mat->blendMode;
+        state->lastOtherMode = mat->otherModeValue;
+        if(mat->setColorFlags & 0b001)state->lastPrimColor = mat->primColor;
+        if(mat->setColorFlags & 0b010)state->lastEnvColor = mat->envColor;
+        if(material_sets_blend_color(mat))state->lastBlendColor = mat->blendColor;
+      }
+    } else {
+      bool setBlendMode  = state->lastBlendMode != mat->blendMode;
+      bool setCC         = mat->colorCombiner != state->lastCC;
+      bool setOtherMode  = state->lastOtherMode != mat->otherModeValue || setTexture;
+      bool setPrimColor  = (mat->setColorFlags & 0b001) && color_to_packed32(state->lastPrimColor) != color_to_packed32(mat->primColor);
+      bool setEnvColor   = (mat->setColorFlags & 0b010) && color_to_packed32(state->lastEnvColor) != color_to_packed32(mat->envColor);
+      bool setBlendColor = material_sets_blend_color(mat) && color_to_packed32(state->lastBlendColor) != color_to_packed32(mat->blendColor);
+
+      if(setCC) {
+        state->lastCC = mat->colorCombiner;
+        rdpq_mode_combiner(mat->colorCombiner);
+      }
 
-    if(setBlendMode) {
-      rdpq_mode_blender(mat->blendMode);
-      state->lastBlendMode = mat->blendMode;
-    }
+      if(setBlendMode) {
+        rdpq_mode_blender(mat->blendMode);
+        state->lastBlendMode = mat->blendMode;
+      }
 
-    if(setPrimColor) {
-      state->lastPrimColor = mat->primColor;
-      rdpq_set_prim_color(mat->primColor);
-    }
+      if(setPrimColor) {
+        state->lastPrimColor = mat->primColor;
+        rdpq_set_prim_color(mat->primColor);
+      }
 
-    if(setBlendColor) {
-      state->lastBlendColor = mat->blendColor;
-      rdpq_set_blend_color(mat->blendColor);
-    }
+      if(setBlendColor) {
+        state->lastBlendColor = mat->blendColor;
+        rdpq_set_blend_color(mat->blendColor);
+      }
 
-    if(setEnvColor) {
-      state->lastEnvColor = mat->envColor;
-      rdpq_set_env_color(mat->envColor);
-    }
+      if(setEnvColor) {
+        state->lastEnvColor = mat->envColor;
+        rdpq_set_env_color(mat->envColor);
+      }
 
-    if(setOtherMode) {
-      __rdpq_mode_change_som(mat->otherModeMask, mat->otherModeValue);
-      state->lastOtherMode = mat->otherModeValue;
+      if(setOtherMode) {
+        __rdpq_mode_change_som(mat->otherModeMask, mat->otherModeValue);
+        state->lastOtherMode = mat->otherModeValue;
+      }
     }
   }
 
@@ -440,6 +834,7 @@ void t3d_model_draw_material(T3DMaterial *mat, T3DModelState *state)
     t3d_state_set_drawflags(mat->renderFlags);
     state->lastRenderFlags = mat->renderFlags;
   }
+  state->lastMaterial = mat;
 
 }
 
@@ -463,102 +858,947 @@ void t3d_model_free(T3DModel *model) {
         texture_cache_free(mat->textureB.textureHash);
         txtErased = true;
       }
+      if(mat->block)rspq_block_free(mat->block);
     }
     if(chunkType == T3D_CHUNK_TYPE_OBJECT) {
       T3DObject *obj = (T3DObject*)((char*)model + (model->chunkOffsets[c].offset & 0x00FFFFFF));
       if(obj->userBlock)rspq_block_free(obj->userBlock);
+      if(obj->drawBlock)rspq_block_free(obj->drawBlock);
     }
   }
   free(model);
   if(txtErased) texture_cache_free_mem();
 }
 
-T3DChunkAnim *t3d_model_get_animation(const T3DModel *model, const char *name) {
-  for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_ANIM) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      T3DChunkAnim *anim = (T3DChunkAnim*)((char*)model + offset);
-      if(strcmp(anim->name, name) == 0)return anim;
+// Metadata placed after the render data by the importer, in this order
+typedef struct {
+  uint32_t start;
+  uint32_t end;
+  int32_t shift; // by how much the section moves down
+  bool keep;
+} CompactSection;
+
+enum { COMPACT_ANIMS, COMPACT_BVH, COMPACT_NAMES, COMPACT_RELOCS, COMPACT_COUNT };
+
+// Maps an offset to its new location, returns 0 if it points into a dropped section
+static uint32_t compact_map_offset(const CompactSection *sections, uint32_t offset) {
+  if(offset < sections[0].start)return offset;
+  for(uint32_t i = 0; i < COMPACT_COUNT; i++) {
+    if(offset < sections[i].end || i == COMPACT_COUNT-1) {
+      return sections[i].keep ? (offset + sections[i].shift) : 0;
     }
   }
-  return NULL;
+  return 0;
 }
 
-T3DObject* t3d_model_get_object(const T3DModel *model, const char *name) {
+uint32_t t3d_model_compact(T3DModel *model, uint32_t flags) {
+  assertf(model->relocTableOffset, "Model was already compacted");
+  char *base = (char*)model;
+  const T3DModelRelocs *relocs = (const T3DModelRelocs*)(base + model->relocTableOffset);
+
+  uint32_t animCount;
+  const uint16_t *animIndices = t3d_model_get_chunk_indices(model, T3D_CHUNK_TYPE_ANIM, &animCount);
+  const T3DBvh *bvh = t3d_model_bvh_get(model);
+
+  CompactSection sections[COMPACT_COUNT] = {0};
+  sections[COMPACT_RELOCS].start = model->relocTableOffset;
+  sections[COMPACT_RELOCS].end = model->relocTableOffset + sizeof(T3DModelRelocs)
+    + (relocs->pointerCount + relocs->stripCount) * sizeof(uint32_t);
+  sections[COMPACT_NAMES].start = model->stringTablePtr - base;
+  sections[COMPACT_BVH].start = bvh ? (uint32_t)((char*)bvh - base) : sections[COMPACT_NAMES].start;
+  sections[COMPACT_ANIMS].start = animCount
+    ? (model->chunkOffsets[animIndices[0]].offset & 0x00FFFFFF)
+    : sections[COMPACT_BVH].start;
+
+  sections[COMPACT_ANIMS].keep = !(flags & T3D_MODEL_COMPACT_ANIMS);
+  sections[COMPACT_BVH].keep   = !(flags & T3D_MODEL_COMPACT_BVH);
+  sections[COMPACT_NAMES].keep = !(flags & T3D_MODEL_COMPACT_NAMES);
+
+  // kept sections move down, but stay at the same alignment (at most 8 bytes)
+  uint32_t cursor = sections[0].start;
+  for(uint32_t i = 0; i < COMPACT_COUNT; i++) {
+    if(i != COMPACT_COUNT-1)sections[i].end = sections[i+1].start;
+    if(!sections[i].keep)continue;
+    cursor += (sections[i].start - cursor) & 7;
+    sections[i].shift = (int32_t)cursor - (int32_t)sections[i].start;
+    cursor += sections[i].end - sections[i].start;
+  }
+  uint32_t oldSize = sections[COMPACT_RELOCS].end;
+
+  // patch all pointers that are kept, this needs the relocation table before anything moves
+  for(uint32_t i = 0; i < relocs->pointerCount; i++) {
+    uint32_t slot = relocs->data[i];
+    if(compact_map_offset(sections, slot) == 0)continue; // pointer itself is dropped
+
+    uint32_t *ptr = (uint32_t*)(base + slot);
+    uint32_t target = compact_map_offset(sections, *ptr - (uint32_t)base);
+    *ptr = target ? (target + (uint32_t)base) : 0;
+  }
+
   for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_OBJECT) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      T3DObject *obj = (T3DObject*)((char*)model + offset);
-      if(obj->name && strcmp(obj->name, name) == 0)return obj;
+    char type = model->chunkOffsets[i].type;
+    if(type != T3D_CHUNK_TYPE_ANIM && type != T3D_CHUNK_TYPE_BVH)continue;
+    uint32_t offset = compact_map_offset(sections, model->chunkOffsets[i].offset & 0x00FFFFFF);
+    model->chunkOffsets[i].offset = offset ? ((uint32_t)type << 24) | offset : 0;
+  }
+
+  // dropped chunks are no longer found through the lookup
+  T3DLookupType *types = (T3DLookupType*)&model->lookup->names[model->lookup->nameCount];
+  for(uint32_t i = 0; i < model->lookup->typeCount; i++) {
+    if((types[i].type == T3D_CHUNK_TYPE_ANIM && !sections[COMPACT_ANIMS].keep)
+      || (types[i].type == T3D_CHUNK_TYPE_BVH && !sections[COMPACT_BVH].keep)) {
+      types[i].count = 0;
+    }
+  }
+
+  for(uint32_t i = 0; i < COMPACT_COUNT; i++) {
+    if(!sections[i].keep || sections[i].shift == 0)continue;
+    memmove(base + sections[i].start + sections[i].shift, base + sections[i].start, sections[i].end - sections[i].start);
+  }
+  model->relocTableOffset = 0;
+
+  // the allocation itself is kept: 'realloc' may move it even when shrinking,
+  // which would break all pointers in the model and any recorded display list
+  data_cache_hit_writeback(model, cursor);
+  return oldSize - cursor;
+}
+
+static const char* lookup_chunk_name(const T3DModel *model, uint32_t chunkIdx) {
+  void *chunk = t3d_model_get_chunk(model, chunkIdx);
+  switch(model->chunkOffsets[chunkIdx].type) {
+    case T3D_CHUNK_TYPE_OBJECT:   return ((T3DObject*)chunk)->name;
+    case T3D_CHUNK_TYPE_MATERIAL: return ((T3DMaterial*)chunk)->name;
+    case T3D_CHUNK_TYPE_ANIM:     return ((T3DChunkAnim*)chunk)->name;
+    default: return NULL;
+  }
+}
+
+/**
+ * Binary search for the name hash, multiple chunks can share the same hash
+ * (e.g. an object and material with the same name), so the type and actual name is checked too.
+ */
+static void* lookup_find(const T3DModel *model, enum T3DModelChunkType chunkType, const char *name) {
+  const T3DChunkLookup *lookup = model->lookup;
+  uint32_t hash = t3d_model_name_hash(name);
+
+  uint32_t first = 0;
+  uint32_t last = lookup->nameCount;
+  while(first < last) {
+    uint32_t mid = (first + last) / 2;
+    if(lookup->names[mid].hash < hash) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+
+  for(; first < lookup->nameCount && lookup->names[first].hash == hash; ++first) {
+    uint32_t chunkIdx = lookup->names[first].chunkIdx;
+    if(model->chunkOffsets[chunkIdx].type != (char)chunkType)continue;
+    // without names (see 't3d_model_compact') only the hash can be checked
+    const char *chunkName = lookup_chunk_name(model, chunkIdx);
+    if(!chunkName || strcmp(chunkName, name) == 0) {
+      return t3d_model_get_chunk(model, chunkIdx);
     }
   }
   return NULL;
 }
 
-void t3d_model_get_animations(const T3DModel *model, T3DChunkAnim **anims) {
-  uint32_t count = 0;
-  for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_ANIM) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      anims[count++] = (T3DChunkAnim*)((char*)model + offset);
+T3DChunkAnim *t3d_model_get_animation(const T3DModel *model, const char *name) {
+  return (T3DChunkAnim*)lookup_find(model, T3D_CHUNK_TYPE_ANIM, name);
+}
+
+void t3d_model_draw_instances(const T3DChunkInstances *instances, const T3DFrustum *frustum)
+{
+  if(!frustum) {
+    t3d_model_draw_object_instanced(instances->object, instances->matrices, instances->count);
+    return;
+  }
+
+  // matrices are read by the RSP as an array, so draw each run of visible instances at once
+  const T3DInstanceAABB *aabbs = t3d_model_instances_get_aabbs(instances);
+  uint32_t runStart = 0;
+  for(uint32_t i = 0; i <= instances->count; i++)
+  {
+    if(i < instances->count && t3d_frustum_vs_aabb_s16(frustum, aabbs[i].aabbMin, aabbs[i].aabbMax)) {
+      continue;
     }
+    if(i > runStart) {
+      t3d_model_draw_object_instanced(instances->object, &instances->matrices[runStart], i - runStart);
+    }
+    runStart = i + 1;
   }
 }
 
-T3DMaterial *t3d_model_get_material(const T3DModel *model, const char *name) {
-  for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_MATERIAL) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      T3DMaterial *mat = (T3DMaterial*)((char*)model + offset);
-      if(mat->name && strcmp(mat->name, name) == 0)return mat;
+// instanced loads need parts that each load and draw on their own (no partial loads),
+// strips can't be used since they store fixed DMEM addresses
+static bool object_can_load_instanced(const T3DObject *object)
+{
+  for(uint32_t p = 0; p < object->numParts; p++) {
+    const T3DObjectPart *part = &object->parts[p];
+    if(t3d_vert_load_instanced_max(part->vertDestOffset, part->vertLoadCount) < 2)return false;
+    if(part->numStripIndices[0] != 0)return false;
+    if(part->numIndices == 0 && part->idxSeqCount == 0)return false;
+  }
+  return true;
+}
+
+void t3d_model_draw_object_instanced(const T3DObject *object, const T3DMat4FP *matrices, uint32_t count)
+{
+  if(count == 0)return;
+
+  if(!object_can_load_instanced(object)) {
+    // all instances share one stack level, 'set' replaces the matrix of the previous one
+    t3d_matrix_push_pos(1);
+    for(uint32_t i = 0; i < count; i++) {
+      t3d_matrix_set(&matrices[i], true);
+      t3d_model_draw_object(object, NULL);
     }
+    t3d_matrix_pop(1);
+    return;
+  }
+
+  for(uint32_t p = 0; p < object->numParts; p++)
+  {
+    const T3DObjectPart *part = &object->parts[p];
+    // the RSP loads vertices once and stores all instances of a batch next to each other
+    uint32_t vertCount = (part->vertLoadCount + 1) & ~1;
+    uint32_t batchSize = t3d_vert_load_instanced_max(part->vertDestOffset, part->vertLoadCount);
+
+    for(uint32_t i = 0; i < count; i += batchSize) {
+      uint32_t batchCount = count - i < batchSize ? count - i : batchSize;
+      t3d_vert_load_instanced(part->vert, part->vertDestOffset, part->vertLoadCount, &matrices[i], batchCount);
+
+      bool didSync = false;
+      for(uint32_t b = 0; b < batchCount; b++) {
+        didSync = draw_part_triangles(part, b * vertCount);
+      }
+      if(!didSync)t3d_tri_sync();
+    }
+  }
+}
+
+const T3DChunkInstances* t3d_model_get_instances(const T3DModel *model, const T3DObject *object) {
+  uint32_t count;
+  const uint16_t *indices = t3d_model_get_chunk_indices(model, T3D_CHUNK_TYPE_INSTANCES, &count);
+  for(uint32_t i = 0; i < count; i++) {
+    const T3DChunkInstances *inst = (const T3DChunkInstances*)t3d_model_get_chunk(model, indices[i]);
+    if(inst->object == object)return inst;
   }
   return NULL;
 }
 
+T3DObject* t3d_model_get_object(const T3DModel *model, const char *name) {
+  return (T3DObject*)lookup_find(model, T3D_CHUNK_TYPE_OBJECT, name);
+}
+
+void t3d_model_get_animations(const T3DModel *model, T3DChunkAnim **anims) {
+  uint32_t count;
+  const uint16_t *indices = t3d_model_get_chunk_indices(model, T3D_CHUNK_TYPE_ANIM, &count);
+  for(uint32_t i = 0; i < count; i++) {
+    anims[i] = (T3DChunkAnim*)t3d_model_get_chunk(model, indices[i]);
+  }
+}
+
+T3DMaterial *t3d_model_get_material(const T3DModel *model, const char *name) {
+  return (T3DMaterial*)lookup_find(model, T3D_CHUNK_TYPE_MATERIAL, name);
+}
+
 bool t3d_model_iter_next(T3DModelIter *iter) {
-  for(; iter->_idx < iter->_model->chunkCount; iter->_idx++) {
-    if(iter->_model->chunkOffsets[iter->_idx].type == iter->_chunkType) {
-      uint32_t offset = iter->_model->chunkOffsets[iter->_idx].offset & 0x00FFFFFF;
-      iter->chunk = (char*)iter->_model + offset;
-      iter->_idx++;
-      return true;
-    }
+  if(iter->_idx < iter->_count) {
+    iter->chunk = t3d_model_get_chunk(iter->_model, iter->_chunkIndices[iter->_idx++]);
+    return true;
   }
   iter->chunk = NULL;
   return false;
 }
 
-// context for functions below, this avoids blowing up the stack-sie
-static const T3DFrustum *ctxFrustum;
-static const T3DBvhData *ctxData;
-static uint32_t ctxBasePtr;
+/**
+ * Tests an AABB against all planes set in 'planeMask'.
+ * Planes the AABB is fully inside of are removed from the mask, so children don't need to check them again.
+ */
+static inline bool bvh_frustum_vs_aabb(const T3DFrustum *frustum, const float aabbMin[3], const float aabbMax[3], uint8_t *planeMask) {
+  for(int i=0; i<6; ++i) {
+    if(!(*planeMask & (1 << i)))continue;
+    const T3DVec4 *plane = &frustum->planes[i];
+
+    // distance of the corners furthest in front of / behind the plane
+    float distFront = plane->v[3];
+    float distBack = plane->v[3];
+    for(int a=0; a<3; ++a) {
+      float valMin = plane->v[a] * aabbMin[a];
+      float valMax = plane->v[a] * aabbMax[a];
+      distFront += fmaxf(valMin, valMax);
+      distBack += fminf(valMin, valMax);
+    }
 
-static void bvh_query_node(const T3DBvhNode *node) {
-  int dataCount = node->value & 0b1111;
-  int offset = (int16_t)node->value >> 4;
+    if(distFront <= 0.0f)return false;
+    if(distBack > 0.0f)*planeMask &= ~(1 << i);
+  }
+  return true;
+}
 
-  if(dataCount == 0) {
-    if(t3d_frustum_vs_aabb_s16(ctxFrustum, node->aabbMin, node->aabbMax)) {
-      bvh_query_node(&node[offset]);
-      bvh_query_node(&node[offset + 1]);
+void t3d_model_bvh_query_frustum(const T3DBvh *bvh, const T3DFrustum *frustum) {
+  T3DObject * const *objects = (T3DObject* const*)&bvh->nodes[bvh->nodeCount]; // data starts right after nodes
+
+  uint16_t stack[BVH_STACK_SIZE];
+  uint8_t stackMask[BVH_STACK_SIZE];
+  int sp = 0;
+  stack[sp] = 0;
+  stackMask[sp++] = 0b111111;
+
+  while(sp > 0) {
+    --sp;
+    const T3DBvhNode *node = &bvh->nodes[stack[sp]];
+    uint8_t planeMask = stackMask[sp];
+
+    float origin[3], scale[3];
+    for(int i=0; i<3; ++i) {
+      origin[i] = node->origin[i];
+      scale[i] = (float)(1 << node->shift[i]);
     }
+
+    for(int c=0; c<node->childCount; ++c) {
+      float aabbMin[3], aabbMax[3];
+      for(int i=0; i<3; ++i) {
+        aabbMin[i] = origin[i] + node->childMin[i][c] * scale[i];
+        aabbMax[i] = origin[i] + node->childMax[i][c] * scale[i];
+      }
+
+      uint8_t childMask = planeMask;
+      if(!bvh_frustum_vs_aabb(frustum, aabbMin, aabbMax, &childMask))continue;
+
+      if(node->dataCount[c] == 0) {
+        assertf(sp < BVH_STACK_SIZE, "BVH too deep");
+        stack[sp] = node->childIdx[c];
+        stackMask[sp++] = childMask;
+        continue;
+      }
+
+      // leaf, if it's fully inside the frustum there is no need to check the objects
+      uint32_t dataEnd = node->childIdx[c] + node->dataCount[c];
+      for(uint32_t d = node->childIdx[c]; d < dataEnd; ++d) {
+        T3DObject *obj = objects[d];
+        if(childMask == 0 || t3d_frustum_vs_aabb_s16(frustum, obj->aabbMin, obj->aabbMax)) {
+          obj->isVisible = true;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Returns the min. distance of an AABB to all planes of a frustum, positive if fully inside.
+ */
+static float bvh_frustum_margin(const T3DFrustum *frustum, const float aabbMin[3], const float aabbMax[3]) {
+  float margin = INFINITY;
+  for(int i=0; i<6; ++i) {
+    const T3DVec4 *plane = &frustum->planes[i];
+    float distBack = plane->v[3];
+    for(int a=0; a<3; ++a) {
+      distBack += fminf(plane->v[a] * aabbMin[a], plane->v[a] * aabbMax[a]);
+    }
+    margin = fminf(margin, distBack);
+  }
+  return margin;
+}
+
+/**
+ * Returns how far any point inside the root of the BVH can have moved relative to the planes,
+ * between the last and the current frustum. (Upper bound, per plane the max. is taken)
+ */
+static float bvh_frustum_delta(const T3DBvhCoherence *coherence, const T3DFrustum *frustum) {
+  float delta = 0.0f;
+  for(int i=0; i<6; ++i) {
+    const T3DVec4 *plane = &frustum->planes[i];
+    const T3DVec4 *planeLast = &coherence->lastFrustum.planes[i];
+    float distCenter = plane->v[3] - planeLast->v[3];
+    float distExtent = 0.0f;
+    for(int a=0; a<3; ++a) {
+      float normDiff = plane->v[a] - planeLast->v[a];
+      distCenter += normDiff * coherence->rootCenter[a];
+      distExtent += fabsf(normDiff) * coherence->rootHalfSize[a];
+    }
+    delta = fmaxf(delta, fabsf(distCenter) + distExtent);
+  }
+  return delta;
+}
+
+T3DBvhCoherence t3d_model_bvh_coherence_create(const T3DBvh *bvh) {
+  T3DBvhCoherence coherence = (T3DBvhCoherence){
+    .bvh = bvh,
+    .nodeMargin = malloc(sizeof(float) * bvh->nodeCount),
+    .nodeFrame = malloc(sizeof(uint32_t) * bvh->nodeCount),
+    .nodeDataRange = malloc(sizeof(uint16_t) * 2 * bvh->nodeCount),
+    .frame = 1,
+  };
+
+  float rootMin[3] = {INFINITY, INFINITY, INFINITY};
+  float rootMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+  const T3DBvhNode *root = &bvh->nodes[0];
+  for(int c=0; c<root->childCount; ++c) {
+    int16_t aabbMin[3], aabbMax[3];
+    t3d_model_bvh_get_child_aabb(root, c, aabbMin, aabbMax);
+    for(int i=0; i<3; ++i) {
+      rootMin[i] = fminf(rootMin[i], aabbMin[i]);
+      rootMax[i] = fmaxf(rootMax[i], aabbMax[i]);
+    }
+  }
+  for(int i=0; i<3; ++i) {
+    coherence.rootCenter[i] = (rootMin[i] + rootMax[i]) * 0.5f;
+    coherence.rootHalfSize[i] = (rootMax[i] - rootMin[i]) * 0.5f;
+  }
+
+  // children always come after their parent, so we can collect the object ranges bottom-up
+  for(int n=bvh->nodeCount-1; n>=0; --n) {
+    const T3DBvhNode *node = &bvh->nodes[n];
+    uint32_t start = 0xFFFF, end = 0, count = 0;
+    for(int c=0; c<node->childCount; ++c) {
+      uint32_t childStart = node->childIdx[c];
+      uint32_t childEnd = childStart + node->dataCount[c];
+      if(node->dataCount[c] == 0) {
+        childStart = coherence.nodeDataRange[node->childIdx[c]*2];
+        childEnd = coherence.nodeDataRange[node->childIdx[c]*2 + 1];
+      }
+      start = childStart < start ? childStart : start;
+      end = childEnd > end ? childEnd : end;
+      count += childEnd - childStart;
+    }
+    assertf(end - start == count, "BVH objects of a node are not continuous");
+    coherence.nodeDataRange[n*2] = start;
+    coherence.nodeDataRange[n*2 + 1] = end;
+    coherence.nodeFrame[n] = 0;
+  }
+  return coherence;
+}
+
+void t3d_model_bvh_coherence_destroy(T3DBvhCoherence *coherence) {
+  free(coherence->nodeMargin);
+  free(coherence->nodeFrame);
+  free(coherence->nodeDataRange);
+  coherence->nodeMargin = NULL;
+  coherence->nodeFrame = NULL;
+  coherence->nodeDataRange = NULL;
+  coherence->bvh = NULL;
+}
+
+uint32_t t3d_model_bvh_query_frustum_list(
+  const T3DBvh *bvh, const T3DFrustum *frustum, T3DBvhCoherence *coherence,
+  T3DObject **objects, uint32_t maxCount
+) {
+  T3DObject * const *bvhObjects = (T3DObject* const*)&bvh->nodes[bvh->nodeCount]; // data starts right after nodes
+  uint32_t count = 0;
+
+  float frustumDelta = INFINITY;
+  if(coherence) {
+    assertf(coherence->bvh == bvh, "BVH coherence state was created for a different BVH");
+    frustumDelta = bvh_frustum_delta(coherence, frustum);
+    ++coherence->frame;
+  }
+
+  // entries are either a node (count = 0), or a range of objects to check against 'mask'
+  uint16_t stackIdx[BVH_STACK_SIZE];
+  uint16_t stackCount[BVH_STACK_SIZE];
+  uint8_t stackMask[BVH_STACK_SIZE];
+  int sp = 0;
+  stackIdx[sp] = 0;
+  stackCount[sp] = 0;
+  stackMask[sp++] = 0b111111;
+
+  while(sp > 0) {
+    --sp;
+    uint8_t planeMask = stackMask[sp];
+
+    if(stackCount[sp] != 0) {
+      uint32_t dataEnd = stackIdx[sp] + stackCount[sp];
+      for(uint32_t d = stackIdx[sp]; d < dataEnd && count < maxCount; ++d) {
+        T3DObject *obj = bvhObjects[d];
+        if(planeMask == 0 || t3d_frustum_vs_aabb_s16(frustum, obj->aabbMin, obj->aabbMax)) {
+          objects[count++] = obj;
+        }
+      }
+      continue;
+    }
+
+    const T3DBvhNode *node = &bvh->nodes[stackIdx[sp]];
+    float origin[3], scale[3];
+    for(int i=0; i<3; ++i) {
+      origin[i] = node->origin[i];
+      scale[i] = (float)(1 << node->shift[i]);
+    }
+
+    // children are pushed in reverse, so that the objects are written in BVH order
+    for(int c=node->childCount-1; c>=0; --c) {
+      bool isLeaf = node->dataCount[c] != 0;
+      uint32_t childIdx = node->childIdx[c];
+      uint8_t childMask = planeMask;
+
+      // inner node that was fully visible last time, and the frustum didn't move enough to leave it
+      bool isCached = coherence && !isLeaf
+        && coherence->nodeFrame[childIdx] == coherence->frame-1
+        && coherence->nodeMargin[childIdx] > frustumDelta;
+
+      if(isCached) {
+        coherence->nodeMargin[childIdx] -= frustumDelta;
+        coherence->nodeFrame[childIdx] = coherence->frame;
+        childMask = 0;
+      } else {
+        float aabbMin[3], aabbMax[3];
+        for(int i=0; i<3; ++i) {
+          aabbMin[i] = origin[i] + node->childMin[i][c] * scale[i];
+          aabbMax[i] = origin[i] + node->childMax[i][c] * scale[i];
+        }
+
+        if(!bvh_frustum_vs_aabb(frustum, aabbMin, aabbMax, &childMask))continue;
+
+        // fully inside, remember how far it is away from the planes for the next query
+        if(coherence && !isLeaf && childMask == 0) {
+          coherence->nodeMargin[childIdx] = bvh_frustum_margin(frustum, aabbMin, aabbMax);
+          coherence->nodeFrame[childIdx] = coherence->frame;
+        }
+      }
+
+      assertf(sp < BVH_STACK_SIZE, "BVH too deep");
+      if(isLeaf) {
+        stackIdx[sp] = childIdx;
+        stackCount[sp] = node->dataCount[c];
+      } else if(coherence && childMask == 0) {
+        // no need to traverse a sub-tree that is fully inside, take all objects at once
+        stackIdx[sp] = coherence->nodeDataRange[childIdx*2];
+        stackCount[sp] = coherence->nodeDataRange[childIdx*2 + 1] - stackIdx[sp];
+      } else {
+        stackIdx[sp] = childIdx;
+        stackCount[sp] = 0;
+      }
+      stackMask[sp++] = childMask;
+    }
+  }
+
+  if(coherence)coherence->lastFrustum = *frustum;
+  return count;
+}
+
+const uint8_t* t3d_model_pvs_get_cell(const T3DChunkPVS *pvs, const T3DVec3 *pos) {
+  uint32_t cellIdx = 0;
+  uint32_t cellStride = 1;
+  for(int i=0; i<3; ++i) {
+    int32_t cellPos = (int32_t)floorf((pos->v[i] - pvs->origin[i]) / pvs->cellSize);
+    if(cellPos < 0 || cellPos >= pvs->cellCount[i])return NULL;
+    cellIdx += cellPos * cellStride;
+    cellStride *= pvs->cellCount[i];
+  }
+
+  const uint8_t *rows = (const uint8_t*)align_pointer((void*)&pvs->cellRows[cellStride], 4); // 'cellStride' is now the cell count
+  return rows + pvs->cellRows[cellIdx] * pvs->rowSize;
+}
+
+void t3d_model_pvs_query(const T3DModel *model, const T3DVec3 *pos) {
+  const T3DChunkPVS *pvs = t3d_model_pvs_get(model);
+  const uint8_t *bits = pvs ? t3d_model_pvs_get_cell(pvs, pos) : NULL;
+
+  T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_OBJECT);
+  for(uint32_t i=0; t3d_model_iter_next(&it); ++i) {
+    it.object->isVisible = bits == NULL || (i < pvs->objectCount && (bits[i / 8] & (1 << (i % 8))));
+  }
+}
+
+uint32_t t3d_model_pvs_filter_list(const T3DModel *model, const T3DVec3 *pos, T3DObject **objects, uint32_t count) {
+  t3d_model_pvs_query(model, pos);
+  uint32_t visibleCount = 0;
+  for(uint32_t i=0; i<count; ++i) {
+    if(objects[i]->isVisible)objects[visibleCount++] = objects[i];
+  }
+  return visibleCount;
+}
+
+#define COLL_STACK_SIZE 64
+
+static inline void coll_get_vert(T3DVec3 *res, const int16_t verts[][3], uint16_t idx) {
+  res->v[0] = verts[idx][0];
+  res->v[1] = verts[idx][1];
+  res->v[2] = verts[idx][2];
+}
+
+static inline void coll_get_tri(T3DVec3 pos[3], const T3DChunkCollision *coll, uint32_t triIdx) {
+  const T3DCollTri *tri = &t3d_model_collision_get_tris(coll)[triIdx];
+  const int16_t (*verts)[3] = t3d_model_collision_get_verts(coll);
+  coll_get_vert(&pos[0], verts, tri->idx[0]);
+  coll_get_vert(&pos[1], verts, tri->idx[1]);
+  coll_get_vert(&pos[2], verts, tri->idx[2]);
+}
+
+static inline void coll_inv_dir(T3DVec3 *res, const T3DVec3 *dir) {
+  // avoid divisions by zero, the large value still works for the slab test
+  for(int i=0; i<3; ++i) {
+    float d = dir->v[i];
+    if(fabsf(d) < 1e-6f)d = d < 0.0f ? -1e-6f : 1e-6f;
+    res->v[i] = 1.0f / d;
+  }
+}
+
+/**
+ * Slab test of a ray against a node (expanded by 'expand'), returns the entry distance.
+ * If the node is missed or further away than 'maxDist', INFINITY is returned.
+ */
+static float coll_ray_vs_node(const T3DCollNode *node, const T3DVec3 *origin, const T3DVec3 *invDir, float expand, float maxDist) {
+  float tMin = 0.0f;
+  float tMax = maxDist;
+  for(int i=0; i<3; ++i) {
+    float t0 = ((float)node->aabbMin[i] - expand - origin->v[i]) * invDir->v[i];
+    float t1 = ((float)node->aabbMax[i] + expand - origin->v[i]) * invDir->v[i];
+    tMin = fmaxf(tMin, fminf(t0, t1));
+    tMax = fminf(tMax, fmaxf(t0, t1));
+  }
+  return tMin <= tMax ? tMin : INFINITY;
+}
+
+// Möller–Trumbore, two-sided
+static bool coll_ray_vs_tri(const T3DVec3 tri[3], const T3DVec3 *origin, const T3DVec3 *dir, float *dist) {
+  T3DVec3 e1, e2, p, s, q;
+  t3d_vec3_diff(&e1, &tri[1], &tri[0]);
+  t3d_vec3_diff(&e2, &tri[2], &tri[0]);
+  t3d_vec3_cross(&p, dir, &e2);
+  float det = t3d_vec3_dot(&e1, &p);
+  if(det == 0.0f)return false;
+
+  float invDet = 1.0f / det;
+  t3d_vec3_diff(&s, origin, &tri[0]);
+  float u = t3d_vec3_dot(&s, &p) * invDet;
+  if(u < 0.0f || u > 1.0f)return false;
+
+  t3d_vec3_cross(&q, &s, &e1);
+  float v = t3d_vec3_dot(dir, &q) * invDet;
+  if(v < 0.0f || u + v > 1.0f)return false;
+
+  float t = t3d_vec3_dot(&e2, &q) * invDet;
+  if(t < 0.0f || t >= *dist)return false;
+  *dist = t;
+  return true;
+}
+
+static void coll_tri_normal(T3DVec3 *res, const T3DVec3 tri[3]) {
+  T3DVec3 e1, e2;
+  t3d_vec3_diff(&e1, &tri[1], &tri[0]);
+  t3d_vec3_diff(&e2, &tri[2], &tri[0]);
+  t3d_vec3_cross(res, &e1, &e2);
+  t3d_vec3_norm(res);
+}
+
+// closest point on a triangle to 'p', see "Real-Time Collision Detection" (Ericson), 5.1.5
+static void coll_closest_point_tri(T3DVec3 *res, const T3DVec3 tri[3], const T3DVec3 *p) {
+  const T3DVec3 *a = &tri[0], *b = &tri[1], *c = &tri[2];
+  T3DVec3 ab, ac, ap, bp, cp;
+  t3d_vec3_diff(&ab, b, a);
+  t3d_vec3_diff(&ac, c, a);
+  t3d_vec3_diff(&ap, p, a);
+
+  float d1 = t3d_vec3_dot(&ab, &ap);
+  float d2 = t3d_vec3_dot(&ac, &ap);
+  if(d1 <= 0.0f && d2 <= 0.0f) { *res = *a; return; }
+
+  t3d_vec3_diff(&bp, p, b);
+  float d3 = t3d_vec3_dot(&ab, &bp);
+  float d4 = t3d_vec3_dot(&ac, &bp);
+  if(d3 >= 0.0f && d4 <= d3) { *res = *b; return; }
+
+  float vc = d1*d4 - d3*d2;
+  if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+    t3d_vec3_scale(res, &ab, d1 / (d1 - d3));
+    t3d_vec3_add(res, res, a);
+    return;
+  }
+
+  t3d_vec3_diff(&cp, p, c);
+  float d5 = t3d_vec3_dot(&ab, &cp);
+  float d6 = t3d_vec3_dot(&ac, &cp);
+  if(d6 >= 0.0f && d5 <= d6) { *res = *c; return; }
+
+  float vb = d5*d2 - d1*d6;
+  if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+    t3d_vec3_scale(res, &ac, d2 / (d2 - d6));
+    t3d_vec3_add(res, res, a);
+    return;
+  }
+
+  float va = d3*d6 - d5*d4;
+  if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+    T3DVec3 bc;
+    t3d_vec3_diff(&bc, c, b);
+    t3d_vec3_scale(res, &bc, (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    t3d_vec3_add(res, res, b);
     return;
   }
 
-  int offsetEnd = offset + dataCount;
-  while(offset < offsetEnd) {
-    T3DObject* obj = (T3DObject*)(ctxBasePtr - (ctxData[offset++].objectPtr << 2));
-    if(t3d_frustum_vs_aabb_s16(ctxFrustum, obj->aabbMin, obj->aabbMax)) {
-      obj->isVisible = true;
+  float denom = 1.0f / (va + vb + vc);
+  T3DVec3 tmp;
+  t3d_vec3_scale(res, &ab, vb * denom);
+  t3d_vec3_scale(&tmp, &ac, vc * denom);
+  t3d_vec3_add(res, res, &tmp);
+  t3d_vec3_add(res, res, a);
+}
+
+// lowest root of 'a*t^2 + b*t + c = 0' in [0, maxT], used for the sweep tests below
+static bool coll_lowest_root(float a, float b, float c, float maxT, float *root) {
+  float det = b*b - 4.0f*a*c;
+  if(det < 0.0f || a == 0.0f)return false;
+  float sqrtD = sqrtf(det);
+  float r1 = (-b - sqrtD) / (2.0f*a);
+  float r2 = (-b + sqrtD) / (2.0f*a);
+  if(r1 > r2) { float tmp = r1; r1 = r2; r2 = tmp; }
+  if(r1 > 0.0f && r1 < maxT) { *root = r1; return true; }
+  if(r2 > 0.0f && r2 < maxT) { *root = r2; return true; }
+  return false;
+}
+
+/**
+ * Sweeps a sphere against a triangle, see "Improved Collision detection and Response" (Fauerby).
+ * 't' is the fraction of 'vel' until the first contact, only updated if a closer contact was found.
+ * Initial overlaps must be handled before calling this.
+ */
+static bool coll_sweep_vs_tri(const T3DVec3 tri[3], const T3DVec3 *start, const T3DVec3 *vel, float radius, float *t, T3DVec3 *contact) {
+  T3DVec3 normal;
+  coll_tri_normal(&normal, tri);
+  float distStart = t3d_vec3_dot(&normal, start) - t3d_vec3_dot(&normal, &tri[0]);
+  float normDotVel = t3d_vec3_dot(&normal, vel);
+  float r2 = radius * radius;
+  bool found = false;
+
+  // first check the inside of the triangle, this is the only contact possible with the plane
+  if(normDotVel != 0.0f) {
+    float side = distStart < 0.0f ? -1.0f : 1.0f;
+    float t0 = (side * radius - distStart) / normDotVel;
+    if(t0 >= 0.0f && t0 < *t) {
+      T3DVec3 planePos, tmp;
+      t3d_vec3_scale(&planePos, vel, t0);
+      t3d_vec3_add(&planePos, &planePos, start);
+      t3d_vec3_scale(&tmp, &normal, side * radius);
+      t3d_vec3_diff(&planePos, &planePos, &tmp);
+
+      T3DVec3 closest;
+      coll_closest_point_tri(&closest, tri, &planePos);
+      if(t3d_vec3_distance2(&closest, &planePos) < 0.0001f) {
+        *t = t0;
+        *contact = closest;
+        return true; // nothing can be hit before touching the inside
+      }
+    }
+  }
+
+  float velLen2 = t3d_vec3_len2(vel);
+  float root;
+
+  // vertices
+  for(int i=0; i<3; ++i) {
+    T3DVec3 diff;
+    t3d_vec3_diff(&diff, start, &tri[i]);
+    float b = 2.0f * t3d_vec3_dot(vel, &diff);
+    float c = t3d_vec3_len2(&diff) - r2;
+    if(coll_lowest_root(velLen2, b, c, *t, &root)) {
+      *t = root;
+      *contact = tri[i];
+      found = true;
+    }
+  }
+
+  // edges
+  for(int i=0; i<3; ++i) {
+    const T3DVec3 *p0 = &tri[i];
+    const T3DVec3 *p1 = &tri[(i+1) % 3];
+    T3DVec3 edge, baseToVert;
+    t3d_vec3_diff(&edge, p1, p0);
+    t3d_vec3_diff(&baseToVert, p0, start);
+
+    float edgeLen2 = t3d_vec3_len2(&edge);
+    float edgeDotVel = t3d_vec3_dot(&edge, vel);
+    float edgeDotBase = t3d_vec3_dot(&edge, &baseToVert);
+
+    float a = edgeLen2 * -velLen2 + edgeDotVel * edgeDotVel;
+    float b = edgeLen2 * (2.0f * t3d_vec3_dot(vel, &baseToVert)) - 2.0f * edgeDotVel * edgeDotBase;
+    float c = edgeLen2 * (r2 - t3d_vec3_len2(&baseToVert)) + edgeDotBase * edgeDotBase;
+
+    if(coll_lowest_root(a, b, c, *t, &root)) {
+      float f = (edgeDotVel * root - edgeDotBase) / edgeLen2;
+      if(f >= 0.0f && f <= 1.0f) {
+        *t = root;
+        t3d_vec3_scale(contact, &edge, f);
+        t3d_vec3_add(contact, contact, p0);
+        found = true;
+      }
     }
   }
+  return found;
 }
 
-void t3d_model_bvh_query_frustum(const T3DBvh *bvh, const T3DFrustum *frustum) {
-  const T3DBvhData *data = (T3DBvhData*)&bvh->nodes[bvh->nodeCount]; // data starts right after nodes
-  ctxFrustum = frustum;
-  ctxData = data;
-  ctxBasePtr = (uint32_t)(char*)bvh;
-  bvh_query_node(bvh->nodes);
+bool t3d_model_raycast(const T3DChunkCollision *coll, const T3DVec3 *origin, const T3DVec3 *dir, float maxDist, T3DCollHit *hit) {
+  uint16_t stack[COLL_STACK_SIZE];
+  float stackDist[COLL_STACK_SIZE];
+  int sp = 0;
+
+  T3DVec3 invDir;
+  coll_inv_dir(&invDir, dir);
+
+  float bestDist = maxDist;
+  int bestTri = -1;
+  T3DVec3 bestTriPos[3];
+
+  float rootDist = coll_ray_vs_node(&coll->nodes[0], origin, &invDir, 0.0f, bestDist);
+  if(rootDist != INFINITY) {
+    stack[sp] = 0;
+    stackDist[sp++] = rootDist;
+  }
+
+  while(sp > 0) {
+    --sp;
+    if(stackDist[sp] > bestDist)continue;
+    const T3DCollNode *node = &coll->nodes[stack[sp]];
+
+    if(node->triCount != 0) {
+      for(uint32_t t = node->index; t < (uint32_t)(node->index + node->triCount); ++t) {
+        T3DVec3 pos[3];
+        coll_get_tri(pos, coll, t);
+        if(coll_ray_vs_tri(pos, origin, dir, &bestDist)) {
+          bestTri = t;
+          bestTriPos[0] = pos[0]; bestTriPos[1] = pos[1]; bestTriPos[2] = pos[2];
+        }
+      }
+      continue;
+    }
+
+    // visit the closer child first, the other one may then be skipped
+    uint16_t idxA = node->index;
+    uint16_t idxB = node->index + 1;
+    float distA = coll_ray_vs_node(&coll->nodes[idxA], origin, &invDir, 0.0f, bestDist);
+    float distB = coll_ray_vs_node(&coll->nodes[idxB], origin, &invDir, 0.0f, bestDist);
+    if(distA > distB) {
+      uint16_t tmpIdx = idxA; idxA = idxB; idxB = tmpIdx;
+      float tmpDist = distA; distA = distB; distB = tmpDist;
+    }
+    assertf(sp + 2 <= COLL_STACK_SIZE, "Collision BVH too deep");
+    if(distB != INFINITY) { stack[sp] = idxB; stackDist[sp++] = distB; }
+    if(distA != INFINITY) { stack[sp] = idxA; stackDist[sp++] = distA; }
+  }
+
+  if(bestTri < 0)return false;
+  hit->dist = bestDist;
+  t3d_vec3_scale(&hit->pos, dir, bestDist);
+  t3d_vec3_add(&hit->pos, &hit->pos, origin);
+  coll_tri_normal(&hit->normal, bestTriPos);
+  hit->triIdx = bestTri;
+  hit->objectIdx = t3d_model_collision_get_tris(coll)[bestTri].objectIdx;
+  return true;
+}
+
+bool t3d_model_sphere_sweep(const T3DChunkCollision *coll, const T3DVec3 *start, const T3DVec3 *end, float radius, T3DCollHit *hit) {
+  uint16_t stack[COLL_STACK_SIZE];
+  int sp = 0;
+
+  T3DVec3 vel, invVel;
+  t3d_vec3_diff(&vel, end, start);
+  coll_inv_dir(&invVel, &vel);
+
+  // time is tracked as a fraction of 'vel' here, 1.0 being the end position
+  float bestT = 1.0f;
+  int bestTri = -1;
+  T3DVec3 bestContact;
+
+  stack[sp++] = 0;
+  while(sp > 0) {
+    const T3DCollNode *node = &coll->nodes[stack[--sp]];
+    if(coll_ray_vs_node(node, start, &invVel, radius, bestT) == INFINITY)continue;
+
+    if(node->triCount != 0) {
+      for(uint32_t t = node->index; t < (uint32_t)(node->index + node->triCount); ++t) {
+        T3DVec3 pos[3], closest;
+        coll_get_tri(pos, coll, t);
+
+        // already intersecting, nothing can be closer than that
+        coll_closest_point_tri(&closest, pos, start);
+        if(t3d_vec3_distance2(&closest, start) < radius * radius) {
+          bestT = 0.0f;
+          bestTri = t;
+          bestContact = closest;
+          sp = 0;
+          break;
+        }
+
+        if(coll_sweep_vs_tri(pos, start, &vel, radius, &bestT, &bestContact)) {
+          bestTri = t;
+        }
+      }
+      continue;
+    }
+
+    assertf(sp + 2 <= COLL_STACK_SIZE, "Collision BVH too deep");
+    stack[sp++] = node->index + 1;
+    stack[sp++] = node->index;
+  }
+
+  if(bestTri < 0)return false;
+
+  T3DVec3 center;
+  t3d_vec3_scale(&center, &vel, bestT);
+  t3d_vec3_add(&center, &center, start);
+  t3d_vec3_diff(&hit->normal, &center, &bestContact);
+  if(t3d_vec3_len2(&hit->normal) > 0.0001f) {
+    t3d_vec3_norm(&hit->normal);
+  } else {
+    T3DVec3 pos[3];
+    coll_get_tri(pos, coll, bestTri);
+    coll_tri_normal(&hit->normal, pos);
+  }
+
+  hit->dist = bestT * t3d_vec3_len(&vel);
+  hit->pos = bestContact;
+  hit->triIdx = bestTri;
+  hit->objectIdx = t3d_model_collision_get_tris(coll)[bestTri].objectIdx;
+  return true;
+}
+
+static inline bool coll_aabb_overlap(const int16_t minA[3], const int16_t maxA[3], const int16_t minB[3], const int16_t maxB[3]) {
+  return minA[0] <= maxB[0] && maxA[0] >= minB[0]
+      && minA[1] <= maxB[1] && maxA[1] >= minB[1]
+      && minA[2] <= maxB[2] && maxA[2] >= minB[2];
+}
+
+uint32_t t3d_model_query_aabb(const T3DChunkCollision *coll, const T3DVec3 *aabbMin, const T3DVec3 *aabbMax, uint16_t *triIndices, uint32_t maxTris) {
+  uint16_t stack[COLL_STACK_SIZE];
+  int sp = 0;
+  uint32_t count = 0;
+
+  int16_t queryMin[3], queryMax[3];
+  for(int i=0; i<3; ++i) {
+    queryMin[i] = (int16_t)fmaxf(floorf(aabbMin->v[i]), -32768.0f);
+    queryMax[i] = (int16_t)fminf(ceilf(aabbMax->v[i]), 32767.0f);
+  }
+
+  const T3DCollTri *tris = t3d_model_collision_get_tris(coll);
+  const int16_t (*verts)[3] = t3d_model_collision_get_verts(coll);
+
+  stack[sp++] = 0;
+  while(sp > 0) {
+    const T3DCollNode *node = &coll->nodes[stack[--sp]];
+    if(!coll_aabb_overlap(node->aabbMin, node->aabbMax, queryMin, queryMax))continue;
+
+    if(node->triCount != 0) {
+      for(uint32_t t = node->index; t < (uint32_t)(node->index + node->triCount); ++t) {
+        const int16_t *v0 = verts[tris[t].idx[0]];
+        const int16_t *v1 = verts[tris[t].idx[1]];
+        const int16_t *v2 = verts[tris[t].idx[2]];
+        int16_t triMin[3], triMax[3];
+        for(int i=0; i<3; ++i) {
+          triMin[i] = v0[i] < v1[i] ? (v0[i] < v2[i] ? v0[i] : v2[i]) : (v1[i] < v2[i] ? v1[i] : v2[i]);
+          triMax[i] = v0[i] > v1[i] ? (v0[i] > v2[i] ? v0[i] : v2[i]) : (v1[i] > v2[i] ? v1[i] : v2[i]);
+        }
+        if(!coll_aabb_overlap(triMin, triMax, queryMin, queryMax))continue;
+        if(count >= maxTris)return count;
+        triIndices[count++] = t;
+      }
+      continue;
+    }
+
+    assertf(sp + 2 <= COLL_STACK_SIZE, "Collision BVH too deep");
+    stack[sp++] = node->index + 1;
+    stack[sp++] = node->index;
+  }
+  return count;
 }
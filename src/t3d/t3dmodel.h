@@ -24,7 +24,7 @@ extern "C"
 
 typedef struct {
   float low;
-  float height;
+  float repeats; // precomputed by the importer, see 'rdpq_texparms_t'
   int8_t mask;
   int8_t shift;
   uint8_t mirror;
@@ -62,6 +62,7 @@ typedef struct {
   char* name;
   T3DMaterialTexture textureA;
   T3DMaterialTexture textureB;
+  rspq_block_t *block; // fixed rdpq state, set by 't3d_model_record_materials'
 } T3DMaterial;
 
 typedef struct {
@@ -77,6 +78,12 @@ typedef struct {
   uint8_t idxSeqCount;
   uint8_t _padding[2];
 
+  // bounding sphere and normal cone, used to skip parts facing away (see 'T3DModelDrawConf.camPos')
+  int16_t coneCenter[3];
+  int16_t coneRadius;
+  int8_t coneAxis[3]; // normalized to 127
+  int8_t coneCutoff; // cos(angle) * 127, 127 if the part can't be culled
+
 } T3DObjectPart;
 
 typedef struct {
@@ -87,28 +94,124 @@ typedef struct {
   // can be used freely by the user for recording, will be freed automatically by t3d
   rspq_block_t *userBlock;
   uint8_t isVisible; // set by culling checks, otherwise no effect on rendering
-  uint8_t _padding;
+  uint8_t isInstanced; // mesh is in local space, transforms are stored in a 'T3DChunkInstances'
   uint8_t userValue0; // free values usable by users
   uint8_t userValue1; // free values usable by users
   int16_t aabbMin[3];
   int16_t aabbMax[3];
+  rspq_block_t *drawBlock; // set by 't3d_model_record_object', replaces the parts when drawing
 
   T3DObjectPart parts[]; // real array
 } T3DObject;
 
+#define T3D_BVH_CHILD_COUNT 4
+
+// 4-wide BVH node, child bounds are stored quantized relative to the node
 typedef struct {
-  int16_t aabbMin[3];
-  int16_t aabbMax[3];
-  uint16_t value;
+  int16_t origin[3]; // child bounds are relative to this
+  uint8_t shift[3]; // scale of the child bounds (per axis), as a power of two
+  uint8_t childCount;
+  uint8_t childMin[3][T3D_BVH_CHILD_COUNT]; // per axis, the actual value is: origin + (childMin << shift)
+  uint8_t childMax[3][T3D_BVH_CHILD_COUNT]; // per axis, the actual value is: origin + (childMax << shift)
+  uint16_t childIdx[T3D_BVH_CHILD_COUNT]; // inner node: node index, leaf: first index into the object list
+  uint8_t dataCount[T3D_BVH_CHILD_COUNT]; // object count for leafs, 0 for inner nodes
+  uint16_t _padding;
 } T3DBvhNode;
 
 typedef struct {
   uint16_t nodeCount;
   uint16_t dataCount;
-  T3DBvhNode nodes[];
-  // uint16_t data[]; // T3DObject pointer, shifted by 3, relative to 'objectBasePtr'
+  T3DBvhNode nodes[]; // root is the first node
+  // T3DObject* objects[]; // referenced by leafs, directly after the nodes
 } T3DBvh;
 
+// Optional state for 't3d_model_bvh_query_frustum_list', to re-use results across frames
+typedef struct {
+  const T3DBvh *bvh;
+  T3DFrustum lastFrustum;
+  float rootCenter[3];
+  float rootHalfSize[3];
+  float *nodeMargin; // per node, min. distance to all planes of the last frustum (if fully inside)
+  uint32_t *nodeFrame; // per node, frame in which 'nodeMargin' was set
+  uint16_t *nodeDataRange; // per node, range of objects in the sub-tree (start, end)
+  uint32_t frame;
+} T3DBvhCoherence;
+
+typedef struct {
+  int16_t aabbMin[3];
+  int16_t aabbMax[3];
+  uint16_t index; // inner node: first child (second one follows), leaf: first triangle
+  uint16_t triCount; // 0 for inner nodes
+} T3DCollNode;
+
+// 'objectIdx' of triangles from objects moved into a region ('--regions')
+#define T3D_COLL_OBJECT_REGION 0xFFFF
+
+typedef struct {
+  uint16_t idx[3]; // vertex indices
+  uint16_t objectIdx; // object the triangle was created from, see 't3d_model_get_object_by_index'
+} T3DCollTri;
+
+typedef struct {
+  uint16_t nodeCount;
+  uint16_t triCount;
+  uint16_t vertCount;
+  uint16_t _reserved;
+  T3DCollNode nodes[]; // real array, root is the first node
+  // T3DCollTri tris[]; // directly after the nodes
+  // int16_t verts[][3]; // directly after the triangles
+} T3DChunkCollision;
+
+// Potentially-visible-set, grid of cells referencing a bitset of visible objects
+typedef struct {
+  int16_t origin[3]; // min. corner of the grid (model space)
+  uint16_t cellSize;
+  uint16_t cellCount[3];
+  uint16_t objectCount;
+  uint16_t rowSize; // bytes per bitset
+  uint16_t rowCount;
+  uint16_t cellRows[]; // bitset index per cell, index is: x + (y * countX) + (z * countX * countY)
+  // uint8_t rows[rowCount][rowSize]; // bitsets (bit per object), after 'cellRows' (4-byte aligned)
+} T3DChunkPVS;
+
+// Part of a level in the region file, each one is a complete model loaded on demand
+typedef struct {
+  int16_t aabbMin[3];
+  int16_t aabbMax[3];
+  uint32_t offset; // offset in the region file
+  uint32_t size; // size in the region file (16-byte aligned)
+  uint32_t memSize; // size once loaded, larger than 'size' for compressed meshes (decoding needs both at once)
+} T3DRegion;
+
+typedef struct {
+  char* filePath; // region file (.t3dr)
+  uint32_t romAddr; // ROM address of 'filePath', set at runtime
+  uint16_t count;
+  uint16_t _reserved;
+  T3DRegion regions[];
+} T3DChunkRegions;
+
+typedef struct {
+  float dist; // distance along the ray / sweep direction until the hit
+  T3DVec3 pos; // hit position on the triangle
+  T3DVec3 normal; // raycast: triangle normal, sweep: contact normal pointing towards the sphere
+  uint16_t triIdx; // index into the triangles of the collision chunk
+  uint16_t objectIdx; // object the triangle was created from, or 'T3D_COLL_OBJECT_REGION'
+} T3DCollHit;
+
+typedef struct {
+  int16_t aabbMin[3];
+  int16_t aabbMax[3];
+} T3DInstanceAABB;
+
+typedef struct {
+  T3DObject *object;
+  uint16_t count;
+  uint16_t _reserved[5];
+  T3DMat4FP matrices[]; // real array
+  // T3DInstanceAABB aabbs[]; // directly after the matrices, see 't3d_model_instances_get_aabbs'
+} T3DChunkInstances;
+
 typedef struct {
   char* name;
   uint16_t parentIdx;
@@ -128,10 +231,21 @@ typedef struct {
   uint16_t targetIdx;
   uint8_t targetType;
   uint8_t attributeIdx;
+  uint8_t dataSize; // bytes per value in the keyframe stream
+  uint8_t flags; // see 'T3D_ANIM_CHANNEL_FLAG_*'
+  uint8_t _reserved[2];
   float quantScale;
   float quantOffset;
 } T3DAnimChannelMapping;
 
+// Channel with a constant value for the whole animation, not part of the stream
+typedef struct {
+  uint16_t targetIdx;
+  uint8_t targetType;
+  uint8_t attributeIdx;
+  float value[4]; // quaternion, or a scalar in the first value
+} T3DAnimChannelConst;
+
 typedef struct {
   char* name;
   float duration;
@@ -139,7 +253,12 @@ typedef struct {
   uint16_t channelsQuat;
   uint16_t channelsScalar;
   char* filePath;
-  T3DAnimChannelMapping channelMappings[];
+  uint16_t channelsConst;
+  uint16_t _reserved;
+  uint32_t streamOffset; // offset of the stream in the file, non-zero if multiple streams share one file
+  uint32_t streamSize;
+  uint32_t streamAddr; // ROM address of the file, resolved on first use (0xFFFFFFFF: read via 'asset_fopen')
+  T3DAnimChannelMapping channelMappings[]; // followed by 'channelsConst' x 'T3DAnimChannelConst'
 } T3DChunkAnim;
 
 typedef union {
@@ -147,6 +266,28 @@ typedef union {
   uint32_t offset;
 } T3DChunkOffset;
 
+typedef struct {
+  uint32_t hash; // FNV-1a of the name
+  uint16_t chunkIdx;
+  uint16_t _reserved;
+} T3DLookupName;
+
+typedef struct {
+  char type;
+  uint8_t _reserved;
+  uint16_t count; // number of chunks of this type
+  uint16_t start; // first entry in the chunk indices
+} T3DLookupType;
+
+// Chunk indices grouped by type and a sorted name table, used to find chunks without a full scan
+typedef struct {
+  uint16_t typeCount;
+  uint16_t nameCount;
+  T3DLookupName names[]; // sorted by hash, only for named chunks (objects, materials, animations)
+  // T3DLookupType types[typeCount]; // directly after the names
+  // uint16_t chunkIndices[]; // directly after the types, referenced by 'T3DLookupType.start'
+} T3DChunkLookup;
+
 typedef struct {
   char magic[4];
   uint32_t chunkCount;
@@ -165,6 +306,9 @@ typedef struct {
   int16_t aabbMin[3];
   int16_t aabbMax[3];
 
+  T3DChunkLookup *lookup;
+  uint32_t relocTableOffset; // relative to the model, kept until 't3d_model_compact' (0 after)
+
   T3DChunkOffset chunkOffsets[];
 } T3DModel;
 
@@ -175,11 +319,13 @@ typedef struct {
     T3DMaterial *material;
     T3DChunkSkeleton *skeleton;
     T3DChunkAnim *anim;
+    T3DChunkInstances *instances;
   };
 
   const T3DModel *_model;
+  const uint16_t *_chunkIndices;
   uint16_t _idx;
-  char _chunkType;
+  uint16_t _count;
 } T3DModelIter;
 
 // Types of chunks contained in T3DModel.
@@ -190,18 +336,81 @@ enum T3DModelChunkType {
   T3D_CHUNK_TYPE_OBJECT   = 'O',
   T3D_CHUNK_TYPE_SKELETON = 'S',
   T3D_CHUNK_TYPE_ANIM     = 'A',
-  T3D_CHUNK_TYPE_BVH      = 'B'
+  T3D_CHUNK_TYPE_BVH      = 'B',
+  T3D_CHUNK_TYPE_INSTANCES = 'N',
+  T3D_CHUNK_TYPE_COLLISION = 'C',
+  T3D_CHUNK_TYPE_PVS      = 'P',
+  T3D_CHUNK_TYPE_REGIONS  = 'R',
+  T3D_CHUNK_TYPE_LOOKUP   = 'L',
+  T3D_CHUNK_TYPE_MESH_CODEC = 'Z'
 };
 
 /**
  * Loads a model from a file.
  * If you no longer need the model, call 't3d_model_free'
+ * Models converted with '--compress-mesh' get their vertices and indices decoded here once.
  *
  * @param path FS path
  * @return pointer to the model (that you now own)
  */
 T3DModel* t3d_model_load(const char *path);
 
+/**
+ * Loads a model from a buffer already in memory, e.g. a region streamed in via DMA.
+ * This takes ownership of the buffer, which must be allocated with malloc/memalign:\n
+ * - if the mesh is compressed ('--compress-mesh'), it is decoded into a new buffer and 'data' is freed here\n
+ * - otherwise the model is 'data' itself, and freed by 't3d_model_free'\n
+ * In both cases, only use the returned pointer and never access or free 'data' afterwards.
+ *
+ * @param data file data (16-byte aligned), owned by the model afterwards
+ * @param size size of the data in bytes
+ * @return pointer to the model (that you now own), may differ from 'data'
+ */
+T3DModel* t3d_model_load_buffer(void *data, int size);
+
+/**
+ * Returns the indices of all chunks of a given type, in the order they appear in the file.
+ * This does not scan the chunk table, so it can be used for frequent lookups.
+ *
+ * @param model model
+ * @param chunkType type of chunk (e.g. T3D_CHUNK_TYPE_OBJECT)
+ * @param count number of chunks found
+ * @return array of 'count' chunk indices, NULL if none were found
+ */
+static inline const uint16_t* t3d_model_get_chunk_indices(const T3DModel *model, enum T3DModelChunkType chunkType, uint32_t *count) {
+  const T3DLookupType *types = (const T3DLookupType*)&model->lookup->names[model->lookup->nameCount];
+  for(uint32_t i = 0; i < model->lookup->typeCount; i++) {
+    if(types[i].type == (char)chunkType) {
+      *count = types[i].count;
+      return (const uint16_t*)&types[model->lookup->typeCount] + types[i].start;
+    }
+  }
+  *count = 0;
+  return NULL;
+}
+
+/**
+ * Returns a chunk by its index in the chunk table.
+ * @param model model
+ * @param chunkIdx chunk index
+ * @return pointer to the chunk data
+ */
+static inline void* t3d_model_get_chunk(const T3DModel *model, uint32_t chunkIdx) {
+  return (char*)model + (model->chunkOffsets[chunkIdx].offset & 0x00FFFFFF);
+}
+
+/**
+ * Returns the first chunk of a given type.
+ * @param model model
+ * @param chunkType type of chunk (e.g. T3D_CHUNK_TYPE_SKELETON)
+ * @return pointer to the chunk data or NULL if not found
+ */
+static inline void* t3d_model_get_first_chunk(const T3DModel *model, enum T3DModelChunkType chunkType) {
+  uint32_t count;
+  const uint16_t *indices = t3d_model_get_chunk_indices(model, chunkType, &count);
+  return count ? t3d_model_get_chunk(model, indices[0]) : NULL;
+}
+
 // callback for custom drawing, this hooks into the tile-setting section
 typedef void (*T3DModelTileCb)(void* userData, rdpq_texparms_t *tileParams, rdpq_tile_t tile);
 typedef bool (*T3DModelFilterCb)(void* userData, const T3DObject *obj);
@@ -216,8 +425,25 @@ typedef struct {
   T3DModelFilterCb filterCb; // callback to filter parts
   T3DModelDynTextureCb dynTextureCb; // callback to set dynamic textures, aka "Texture Reference" in fast64
   const T3DMat4FP *matrices;
+  const T3DVec3 *camPos; // camera position in model space, skips parts facing away from it. NULL to draw all
+  const T3DFrustum *frustum; // frustum in model space, culls each instance of instanced objects. NULL to draw all
 } T3DModelDrawConf;
 
+#define T3D_TMEM_MAX_ENTRIES 8
+
+typedef struct {
+  uint32_t hash; // texture hash, 0 if unused
+  uint16_t addr;
+  uint16_t size;
+  uint32_t lastUse;
+} T3DTmemEntry;
+
+// Textures currently in TMEM, so they can be used again without another upload
+typedef struct {
+  T3DTmemEntry entries[T3D_TMEM_MAX_ENTRIES];
+  uint32_t useCounter;
+} T3DTmemState;
+
 /**
  * State for model and material settings during a draw.
  * This is used to minimize state changes across materials.
@@ -235,6 +461,8 @@ typedef struct {
   uint16_t lastUvGenParams[2];
   uint64_t lastOtherMode;
   uint32_t lastBlendMode;
+  const T3DMaterial *lastMaterial;
+  T3DTmemState tmem; // clear this if TMEM is used outside of t3d in between draws
   T3DModelDrawConf* drawConf; // @TODO: legacy, remove at some point
 } T3DModelState;
 
@@ -258,6 +486,72 @@ static inline T3DModelState t3d_model_state_create() {
  */
 void t3d_model_free(T3DModel* model);
 
+// Metadata that can be dropped by 't3d_model_compact'
+enum T3DModelCompactFlags {
+  T3D_MODEL_COMPACT_NAMES = 1 << 0, // object, material and animation names
+  T3D_MODEL_COMPACT_BVH   = 1 << 1, // BVH chunk
+  T3D_MODEL_COMPACT_ANIMS = 1 << 2, // animation chunks, existing 'T3DAnim' keep their own copy
+};
+
+/**
+ * Drops metadata that is no longer needed after setup, kept metadata is moved down to the render data.
+ * Render data (objects, materials, vertices, ...) is never moved, so display lists stay valid.
+ * The allocation of the model keeps its size, since 'realloc' is allowed to move it even when shrinking.
+ * The relocation table is always dropped, so this can only be called once per model.
+ *
+ * Call this after creating all animations and display lists that need the dropped data.
+ * Animations created before ('t3d_anim_create') keep working, since they copy their definition,
+ * but no new ones can be created from this model after dropping animations.
+ * Without names, 't3d_model_get_object' and similar functions only compare the name hash,
+ * and 'name' of objects, materials and animations (incl. copies in 'T3DAnim') is NULL.
+ * Pointers to a kept BVH or name are moved, so query them again afterwards.
+ *
+ * @param model model to compact
+ * @param flags combination of 'T3DModelCompactFlags' to drop, 0 to only free the relocation table
+ * @return number of bytes at the end of the model that are no longer used
+ */
+uint32_t t3d_model_compact(T3DModel *model, uint32_t flags);
+
+/**
+ * Records the fixed rdpq state of each material (combiner, blender, other-modes and colors) into a block.
+ * Switching to such a material then costs a single block call instead of comparing and setting each value.
+ * Textures are not part of the block, so they are still only uploaded if they differ from the last material.
+ *
+ * Call this after any changes to materials (e.g. the combiner), and again if they change later.
+ * Old blocks are freed here, so they must no longer be in use by the RSP.
+ * This must not be called while recording a display list.
+ * @param model
+ */
+void t3d_model_record_materials(T3DModel *model);
+
+/**
+ * Records the vertex loads and triangle draws of a non-skinned object into a block.
+ * 't3d_model_draw_object' then runs this block instead of generating the commands again,
+ * which makes drawing the same object many times (e.g. instances) a lot cheaper on the CPU.
+ * Only the mesh is recorded, the matrix and material are still set per draw.
+ *
+ * Call this again if the object is changed (e.g. its vertices are moved to a segment).
+ * An old block is freed here, so it must no longer be in use by the RSP.
+ * This must not be called while recording a display list.
+ * @param object object to record
+ */
+void t3d_model_record_object(T3DObject *object);
+
+/**
+ * Loads all textures of a model up front, instead of on the first draw of each material.
+ * Textures are shared with other models through a global cache.
+ * @param model
+ */
+void t3d_model_preload_textures(const T3DModel *model);
+
+/**
+ * Sets the max. amount of RDRAM (in bytes) textures no longer used by any model can occupy.
+ * These are kept in the cache and freed least-recently-used first once the budget is exceeded.
+ * With the default of 0, textures are freed as soon as the last model using them is freed.
+ * @param bytes budget in bytes
+ */
+void t3d_texture_cache_set_budget(uint32_t bytes);
+
 /**
  * Draws a model with a custom configuration.
  * This call can be recorded into a display list.
@@ -266,6 +560,19 @@ void t3d_model_free(T3DModel* model);
  */
 void t3d_model_draw_custom(const T3DModel* model, T3DModelDrawConf conf);
 
+/**
+ * Draws a list of objects of a model, e.g. from 't3d_model_bvh_query_frustum_list'.
+ * Only the objects in the list are touched.
+ * Objects are drawn in the given order, since they are stored sorted by material,
+ * sorting the list by address will minimize material changes.
+ * This call can be recorded into a display list.
+ * @param model model the objects belong to
+ * @param objects objects to draw
+ * @param count number of objects
+ * @param conf custom configuration
+ */
+void t3d_model_draw_objects(const T3DModel* model, T3DObject * const *objects, uint32_t count, T3DModelDrawConf conf);
+
 /**
  * Draws a model with default settings.
  * This call can be recorded into a display list.
@@ -291,6 +598,45 @@ static inline void t3d_model_draw(const T3DModel* model) {
  */
 void t3d_model_draw_object(const T3DObject *object, const T3DMat4FP *boneMatrices);
 
+/**
+ * Same as 't3d_model_draw_object', but skips parts where all triangles face away from the camera.\n
+ * This saves loading and transforming their vertices, which the RSP would otherwise do before culling each triangle.\n
+ * The importer only stores a normal cone for parts of non-skinned objects with back-face culling,\n
+ * so this must only be used if back-face culling is active, and with a matrix that doesn't mirror the model.\n
+ * The result depends on the camera, so a recorded draw block of the object is not used here.\n
+ *
+ * @param object object to draw
+ * @param boneMatrices matrices in the case of skinned meshes, set to NULL for non-skinned
+ * @param camPos camera position in model space (e.g. for a translated and uniformly scaled model: '(cam - pos) / scale')
+ */
+void t3d_model_draw_object_culled(const T3DObject *object, const T3DMat4FP *boneMatrices, const T3DVec3 *camPos);
+
+/**
+ * Draws an instanced object once per instance, each with its own matrix.\n
+ * Like 't3d_model_draw_object', this will not apply any material.\n
+ * Visible instances are drawn with 't3d_model_draw_object_instanced'.\n
+ * Instanced objects are created by the gltf importer with '--instancing',\n
+ * 't3d_model_draw' and 't3d_model_draw_custom' already call this for them (with 'T3DModelDrawConf.frustum').\n
+ *
+ * @param instances instances of an object, see 't3d_model_get_instances'
+ * @param frustum optional frustum (in model space) to cull instances with, NULL to draw all
+ */
+void t3d_model_draw_instances(const T3DChunkInstances *instances, const T3DFrustum *frustum);
+
+/**
+ * Draws a non-skinned object once per matrix, e.g. for objects placed at runtime.\n
+ * Like 't3d_model_draw_object', this will not apply any material.\n
+ * Each part is loaded only once for a batch of instances with 't3d_vert_load_instanced'.\n
+ * This needs parts where 't3d_vert_load_instanced_max' fits at least 2 instances, and without strips,\n
+ * other objects fall back to a matrix load and a full draw per instance.\n
+ * Matrices are multiplied with the current one.\n
+ *
+ * @param object object to draw
+ * @param matrices model matrices, one per instance
+ * @param count number of instances
+ */
+void t3d_model_draw_object_instanced(const T3DObject *object, const T3DMat4FP *matrices, uint32_t count);
+
 /**
  * Draws/Applies a material of an object. This can be called before 't3d_model_draw_object'.\n
  * This will set up the texture, CC, and other RDP and t3d settings of the material.\n
@@ -337,6 +683,19 @@ static inline T3DVertPacked* t3d_model_get_vertices(const T3DModel *model) {
  */
 void t3d_model_make_object_vert_placeholder(const T3DModel *model, T3DObject *object, uint8_t segmentId);
 
+/**
+ * Hash of a name, as stored in the lookup chunk (FNV-1a, must match 'nameHash' in the importer).
+ * @param name
+ * @return hash
+ */
+static inline uint32_t t3d_model_name_hash(const char *name) {
+  uint32_t hash = 0x811C9DC5;
+  while(*name) {
+    hash = (hash ^ (uint8_t)*name++) * 0x01000193;
+  }
+  return hash;
+}
+
 /**
  * Returns the first/main skeleton of a model.
  * If the model contains multiple skeletons, data must be manually traversed instead.
@@ -345,13 +704,7 @@ void t3d_model_make_object_vert_placeholder(const T3DModel *model, T3DObject *ob
  * @return pointer to the skeleton or NULL if not found
  */
 static inline const T3DChunkSkeleton* t3d_model_get_skeleton(const T3DModel *model) {
-  for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_SKELETON) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      return (T3DChunkSkeleton*)((char*)model + offset);
-    }
-  }
-  return NULL;
+  return (const T3DChunkSkeleton*)t3d_model_get_first_chunk(model, T3D_CHUNK_TYPE_SKELETON);
 }
 
 /**
@@ -360,10 +713,8 @@ static inline const T3DChunkSkeleton* t3d_model_get_skeleton(const T3DModel *mod
  * @return
  */
 static inline uint32_t t3d_model_get_animation_count(const T3DModel *model) {
-  uint32_t count = 0;
-  for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_ANIM)count++;
-  }
+  uint32_t count;
+  t3d_model_get_chunk_indices(model, T3D_CHUNK_TYPE_ANIM, &count);
   return count;
 }
 
@@ -405,6 +756,23 @@ static inline T3DObject* t3d_model_get_object_by_index(const T3DModel *model, ui
   return (T3DObject*)((char*)model + offset);
 }
 
+/**
+ * Returns the instances of an object, only set if 'object->isInstanced' is true.
+ * @param model model containing the object
+ * @param object object to get the instances for
+ * @return instances or NULL if not found
+ */
+const T3DChunkInstances* t3d_model_get_instances(const T3DModel *model, const T3DObject *object);
+
+/**
+ * Returns the per-instance AABBs (in model space) of an instanced object.
+ * @param instances instances
+ * @return array of 'instances->count' AABBs
+ */
+static inline const T3DInstanceAABB* t3d_model_instances_get_aabbs(const T3DChunkInstances *instances) {
+  return (const T3DInstanceAABB*)&instances->matrices[instances->count];
+}
+
 /**
  * Returns a material by name.
  * @param model model
@@ -436,11 +804,14 @@ T3DMaterial* t3d_model_get_material(const T3DModel *model, const char *name);
  * @return iterator
  */
 static inline T3DModelIter t3d_model_iter_create(const T3DModel *model, enum T3DModelChunkType chunkType) {
+  uint32_t count;
+  const uint16_t *indices = t3d_model_get_chunk_indices(model, chunkType, &count);
   return (T3DModelIter){
     .chunk = NULL,
     ._model = model,
+    ._chunkIndices = indices,
     ._idx = 0,
-    ._chunkType = chunkType,
+    ._count = count,
   };
 }
 
@@ -465,13 +836,7 @@ bool t3d_model_iter_next(T3DModelIter *iter);
  * @return pointer to the BVH or NULL if not found
  */
 static inline const T3DBvh* t3d_model_bvh_get(const T3DModel *model) {
-  for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_BVH) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      return (T3DBvh*)((char*)model + offset);
-    }
-  }
-  return NULL;
+  return (const T3DBvh*)t3d_model_get_first_chunk(model, T3D_CHUNK_TYPE_BVH);
 }
 
 /**
@@ -479,6 +844,8 @@ static inline const T3DBvh* t3d_model_bvh_get(const T3DModel *model) {
  * Note that the BVH is in model space, so the frustum may need to be transformed before.
  * This will mark all objects in the BVH as visible via the 'isVisible' flag.
  * Note that you need to first set all to false before calling this.
+ * Since it never clears the flag, it can't be combined with 't3d_model_pvs_query',
+ * use 't3d_model_bvh_query_frustum_list' and 't3d_model_pvs_filter_list' instead.
  *
  * @param bvh BVH to check
  * @param frustum frustum to check against
@@ -486,6 +853,170 @@ static inline const T3DBvh* t3d_model_bvh_get(const T3DModel *model) {
  */
 void t3d_model_bvh_query_frustum(const T3DBvh *bvh, const T3DFrustum *frustum);
 
+/**
+ * Queries the BVH of a model with a frustum, and writes all visible objects into a list.
+ * Objects are written in BVH order, the 'isVisible' flag is not used.
+ * If the buffer is too small, the remaining objects are skipped.
+ *
+ * If a coherence state is passed in, nodes that were fully inside the frustum of the last query
+ * are accepted without any checks as long as the frustum only moved by a small amount.
+ * This is exact, so the result is the same as without the state.
+ *
+ * @param bvh BVH to check
+ * @param frustum frustum to check against (in model space)
+ * @param coherence optional state, created via 't3d_model_bvh_coherence_create', can be NULL
+ * @param objects output buffer for visible objects
+ * @param maxCount size of 'objects'
+ * @return number of visible objects written to 'objects'
+ */
+uint32_t t3d_model_bvh_query_frustum_list(
+  const T3DBvh *bvh, const T3DFrustum *frustum, T3DBvhCoherence *coherence,
+  T3DObject **objects, uint32_t maxCount
+);
+
+/**
+ * Creates a state to re-use BVH query results across frames.
+ * Note that one state should only be used with a single camera.
+ * Once done, free it via 't3d_model_bvh_coherence_destroy'.
+ * @param bvh BVH to use the state with
+ */
+T3DBvhCoherence t3d_model_bvh_coherence_create(const T3DBvh *bvh);
+
+/**
+ * Frees a state created by 't3d_model_bvh_coherence_create'.
+ * @param coherence state to free
+ */
+void t3d_model_bvh_coherence_destroy(T3DBvhCoherence *coherence);
+
+/**
+ * Returns the (de-quantized) AABB of a child in a BVH node.
+ * @param node BVH node
+ * @param child child index, must be less than 'node->childCount'
+ * @param aabbMin output, min. corner
+ * @param aabbMax output, max. corner
+ */
+static inline void t3d_model_bvh_get_child_aabb(const T3DBvhNode *node, uint32_t child, int16_t aabbMin[3], int16_t aabbMax[3]) {
+  for(int i=0; i<3; ++i) {
+    int32_t valMin = node->origin[i] + (node->childMin[i][child] << node->shift[i]);
+    int32_t valMax = node->origin[i] + (node->childMax[i][child] << node->shift[i]);
+    aabbMin[i] = (int16_t)valMin;
+    aabbMax[i] = (int16_t)(valMax > 32767 ? 32767 : valMax);
+  }
+}
+
+/**
+ * Returns the collision data (triangle BVH) of a model.
+ * Note that this is optional and may return NULL.
+ * To create one, pass '--collision' to the gltf importer.
+ * @param model model
+ * @return pointer to the collision data or NULL if not found
+ */
+static inline const T3DChunkCollision* t3d_model_collision_get(const T3DModel *model) {
+  return (const T3DChunkCollision*)t3d_model_get_first_chunk(model, T3D_CHUNK_TYPE_COLLISION);
+}
+
+/**
+ * Returns the triangles of the collision data, the array has 'coll->triCount' entries.
+ * @param coll collision data
+ */
+static inline const T3DCollTri* t3d_model_collision_get_tris(const T3DChunkCollision *coll) {
+  return (const T3DCollTri*)&coll->nodes[coll->nodeCount];
+}
+
+/**
+ * Returns the vertex positions of the collision data (model space), the array has 'coll->vertCount' entries.
+ * @param coll collision data
+ */
+static inline const int16_t (*t3d_model_collision_get_verts(const T3DChunkCollision *coll))[3] {
+  return (const int16_t (*)[3])&t3d_model_collision_get_tris(coll)[coll->triCount];
+}
+
+/**
+ * Casts a ray against the collision data of a model and returns the closest hit.
+ * Everything is in model space, so positions are in the same units as vertices.
+ * Triangles are hit from both sides.
+ *
+ * @param coll collision data, see 't3d_model_collision_get'
+ * @param origin ray origin
+ * @param dir ray direction, should be normalized
+ * @param maxDist max. distance to check
+ * @param hit closest hit, only written if the ray hit anything
+ * @return true if any triangle was hit
+ */
+bool t3d_model_raycast(const T3DChunkCollision *coll, const T3DVec3 *origin, const T3DVec3 *dir, float maxDist, T3DCollHit *hit);
+
+/**
+ * Moves a sphere from 'start' to 'end' and returns the first contact with the collision data.
+ * If the sphere already intersects a triangle at 'start', this returns a hit with a distance of 0.
+ * Everything is in model space, see 't3d_model_raycast'.
+ *
+ * @param coll collision data, see 't3d_model_collision_get'
+ * @param start sphere center at the start
+ * @param end sphere center at the end
+ * @param radius sphere radius
+ * @param hit first contact, 'hit->dist' is the distance the sphere can move before touching it
+ * @return true if any triangle was hit
+ */
+bool t3d_model_sphere_sweep(const T3DChunkCollision *coll, const T3DVec3 *start, const T3DVec3 *end, float radius, T3DCollHit *hit);
+
+/**
+ * Collects all triangles whose bounding box overlaps the given AABB (model space).
+ * This is meant as a broad-phase, for exact results test the returned triangles individually.
+ *
+ * @param coll collision data, see 't3d_model_collision_get'
+ * @param aabbMin min. corner of the AABB
+ * @param aabbMax max. corner of the AABB
+ * @param triIndices output, indices into 't3d_model_collision_get_tris'
+ * @param maxTris size of 'triIndices', any further triangles are ignored
+ * @return number of triangles written to 'triIndices'
+ */
+uint32_t t3d_model_query_aabb(const T3DChunkCollision *coll, const T3DVec3 *aabbMin, const T3DVec3 *aabbMax, uint16_t *triIndices, uint32_t maxTris);
+
+/**
+ * Returns the potentially-visible-set (PVS) of a model.
+ * Note that this is optional and may return NULL.
+ * To create one, pass '--pvs' to the gltf importer.
+ * @param model model
+ * @return pointer to the PVS or NULL if not found
+ */
+static inline const T3DChunkPVS* t3d_model_pvs_get(const T3DModel *model) {
+  return (const T3DChunkPVS*)t3d_model_get_first_chunk(model, T3D_CHUNK_TYPE_PVS);
+}
+
+/**
+ * Returns the bitset of visible objects for a position, one bit per object (LSB first).
+ * The bit index is the same as in 't3d_model_get_object_by_index'.
+ * @param pvs PVS, see 't3d_model_pvs_get'
+ * @param pos position in model space
+ * @return bitset, or NULL if the position is outside the grid
+ */
+const uint8_t* t3d_model_pvs_get_cell(const T3DChunkPVS *pvs, const T3DVec3 *pos);
+
+/**
+ * Marks all objects that are potentially visible from a position via the 'isVisible' flag.
+ * All other objects are set to not visible.
+ * If the model has no PVS, or the position is outside of it, all objects are marked as visible.
+ * Note that 't3d_model_bvh_query_frustum' only ever sets the flag, so it would show objects hidden here again,
+ * to combine both use 't3d_model_pvs_filter_list'.
+ *
+ * @param model model to check
+ * @param pos position in model space, e.g. the camera
+ */
+void t3d_model_pvs_query(const T3DModel *model, const T3DVec3 *pos);
+
+/**
+ * Removes all objects from a list that are not potentially visible from a position.
+ * This is meant to be used on the result of 't3d_model_bvh_query_frustum_list', the order is kept.
+ * Internally this uses 't3d_model_pvs_query', so the 'isVisible' flag of all objects is overwritten.
+ *
+ * @param model model the objects belong to
+ * @param pos position in model space, e.g. the camera
+ * @param objects list of objects, filtered in place
+ * @param count number of objects in the list
+ * @return number of objects left in the list
+ */
+uint32_t t3d_model_pvs_filter_list(const T3DModel *model, const T3DVec3 *pos, T3DObject **objects, uint32_t count);
+
 #ifdef __cplusplus
 }
 #endif
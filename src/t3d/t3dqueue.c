@@ -0,0 +1,177 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+*/
+#include "t3dqueue.h"
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUEUE_MIN_CAPACITY 64
+
+enum {
+  QUEUE_CLASS_OPAQUE = 0,
+  QUEUE_CLASS_DECAL = 1,
+  QUEUE_CLASS_TRANSPARENT = 2,
+};
+
+// folds a value into 16 bits, only used to group equal values next to each other
+static inline uint32_t queue_hash16(uint64_t value) {
+  uint32_t hash = (uint32_t)value ^ (uint32_t)(value >> 32);
+  return (hash * 0x9E3779B1) >> 16;
+}
+
+// blending with the framebuffer (alpha, additive, ...) or depth-testing without writing depth needs back-to-front order
+static uint32_t queue_class(const T3DMaterial *mat) {
+  if(!mat)return QUEUE_CLASS_OPAQUE;
+  if(mat->blendMode & SOM_READ_ENABLE)return QUEUE_CLASS_TRANSPARENT;
+  if((mat->otherModeMask & SOM_Z_WRITE) && !(mat->otherModeValue & SOM_Z_WRITE)
+    && (mat->otherModeValue & SOM_Z_COMPARE))return QUEUE_CLASS_TRANSPARENT;
+  if(mat->otherModeValue & SOM_ZMODE_DECAL)return QUEUE_CLASS_DECAL;
+  return QUEUE_CLASS_OPAQUE;
+}
+
+// squared distance from the camera to the center of the object, in world space
+static float queue_depth(const T3DRenderQueue *queue, const T3DObject *object, const T3DMat4FP *matrix) {
+  float center[3];
+  for(int i = 0; i < 3; i++) {
+    center[i] = (object->aabbMin[i] + object->aabbMax[i]) * 0.5f;
+  }
+
+  float pos[3];
+  for(int i = 0; i < 3; i++) {
+    pos[i] = center[i];
+    if(matrix) {
+      pos[i] = t3d_mat4fp_get_float(matrix, 0, i) * center[0]
+             + t3d_mat4fp_get_float(matrix, 1, i) * center[1]
+             + t3d_mat4fp_get_float(matrix, 2, i) * center[2]
+             + t3d_mat4fp_get_float(matrix, 3, i);
+    }
+  }
+
+  float distSq = 0.0f;
+  for(int i = 0; i < 3; i++) {
+    float d = pos[i] - queue->camPos.v[i];
+    distSq += d * d;
+  }
+  return distSq;
+}
+
+/**
+ * Sort key, from most to least significant bits:
+ * [63:56] layer, [55:54] transparency class, then:
+ * - opaque/decal:  [53:38] textures, [37:22] combiner & modes, [21:0] depth (front to back)
+ * - transparent:   [53:32] depth (back to front), [31:16] textures, [15:0] combiner & modes
+ */
+static uint64_t queue_sort_key(const T3DRenderQueue *queue, const T3DObject *object, const T3DMat4FP *matrix, uint8_t layer) {
+  const T3DMaterial *mat = object->material;
+  uint64_t texKey = 0;
+  uint64_t modeKey = 0;
+  if(mat) {
+    texKey = queue_hash16(((uint64_t)mat->textureA.textureHash << 32) | mat->textureB.textureHash);
+    modeKey = queue_hash16(mat->colorCombiner ^ mat->otherModeValue ^ ((uint64_t)mat->blendMode << 32));
+  }
+
+  // positive floats keep their order when compared as integers, the upper 22 bits are enough here
+  float distSq = queue_depth(queue, object, matrix);
+  uint32_t distBits;
+  memcpy(&distBits, &distSq, sizeof(distBits));
+  uint64_t depthKey = distBits >> 9;
+
+  uint64_t classKey = queue_class(mat);
+  uint64_t key = ((uint64_t)layer << 56) | (classKey << 54);
+  if(classKey == QUEUE_CLASS_TRANSPARENT) {
+    return key | ((0x3FFFFF - depthKey) << 32) | (texKey << 16) | modeKey;
+  }
+  return key | (texKey << 38) | (modeKey << 22) | depthKey;
+}
+
+static int queue_compare(const void *a, const void *b) {
+  uint64_t keyA = ((const T3DRenderItem*)a)->sortKey;
+  uint64_t keyB = ((const T3DRenderItem*)b)->sortKey;
+  return (keyA > keyB) - (keyA < keyB);
+}
+
+T3DRenderQueue t3d_render_queue_create(uint32_t capacity) {
+  if(capacity < QUEUE_MIN_CAPACITY)capacity = QUEUE_MIN_CAPACITY;
+  return (T3DRenderQueue){
+    .items = malloc(capacity * sizeof(T3DRenderItem)),
+    .count = 0,
+    .capacity = capacity,
+  };
+}
+
+void t3d_render_queue_begin(T3DRenderQueue *queue, const T3DVec3 *camPos) {
+  queue->count = 0;
+  queue->camPos = *camPos;
+}
+
+void t3d_render_queue_push(T3DRenderQueue *queue,
+  const T3DModel *model, const T3DObject *object,
+  const T3DMat4FP *matrix, const T3DMat4FP *boneMatrices, uint8_t layer
+) {
+  if(queue->count == queue->capacity) {
+    queue->capacity *= 2;
+    queue->items = realloc(queue->items, queue->capacity * sizeof(T3DRenderItem));
+  }
+
+  queue->items[queue->count++] = (T3DRenderItem){
+    .sortKey = queue_sort_key(queue, object, matrix, layer),
+    .model = model,
+    .object = object,
+    .matrix = matrix,
+    .boneMatrices = boneMatrices,
+  };
+}
+
+void t3d_render_queue_push_model(T3DRenderQueue *queue,
+  const T3DModel *model, const T3DMat4FP *matrix, const T3DMat4FP *boneMatrices, uint8_t layer
+) {
+  T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_OBJECT);
+  while(t3d_model_iter_next(&it)) {
+    t3d_render_queue_push(queue, model, it.object, matrix, boneMatrices, layer);
+  }
+}
+
+void t3d_render_queue_draw(T3DRenderQueue *queue, T3DModelDrawConf conf) {
+  qsort(queue->items, queue->count, sizeof(T3DRenderItem), queue_compare);
+
+  T3DModelState state = t3d_model_state_create();
+  state.drawConf = &conf;
+
+  // the matrix stack only grows by one, each new matrix replaces the previous one
+  const T3DMat4FP *lastMatrix = NULL;
+  for(uint32_t i = 0; i < queue->count; i++) {
+    const T3DRenderItem *item = &queue->items[i];
+    const T3DObject *object = item->object;
+    if(conf.filterCb && !conf.filterCb(conf.userData, object))continue;
+
+    if(item->matrix != lastMatrix) {
+      if(!item->matrix) {
+        t3d_matrix_pop(1);
+      } else {
+        if(!lastMatrix)t3d_matrix_push_pos(1);
+        t3d_matrix_set(item->matrix, true);
+      }
+      lastMatrix = item->matrix;
+    }
+
+    if(object->material) {
+      t3d_model_draw_material(object->material, &state);
+    }
+
+    if(object->isInstanced) {
+      t3d_model_draw_instances(t3d_model_get_instances(item->model, object), NULL);
+    } else {
+      t3d_model_draw_object(object, item->boneMatrices);
+    }
+  }
+
+  if(lastMatrix)t3d_matrix_pop(1);
+  if(state.lastVertFXFunc != T3D_VERTEX_FX_NONE)t3d_state_set_vertex_fx(T3D_VERTEX_FX_NONE, 0, 0);
+}
+
+void t3d_render_queue_destroy(T3DRenderQueue *queue) {
+  free(queue->items);
+  *queue = (T3DRenderQueue){0};
+}
@@ -0,0 +1,102 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+* @file t3dqueue.h
+*/
+#ifndef TINY3D_T3DQUEUE_H
+#define TINY3D_T3DQUEUE_H
+
+#include "t3dmodel.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct {
+  uint64_t sortKey; // layer, transparency, material and depth (see 't3d_render_queue_push')
+  const T3DModel *model;
+  const T3DObject *object;
+  const T3DMat4FP *matrix; // NULL to draw with the current matrix
+  const T3DMat4FP *boneMatrices; // for skinned objects, NULL otherwise
+} T3DRenderItem;
+
+/**
+ * Collects objects of any number of models for a frame, and draws them sorted.
+ * Sorting is done by layer, then transparency (opaque -> decal -> transparent),
+ * then material for opaque objects and depth for transparent ones.
+ * Materials are transparent if their blender reads the framebuffer, or they depth-test without writing depth.
+ * All items share a single 'T3DModelState', so textures and modes are only set when they change.
+ */
+typedef struct {
+  T3DRenderItem *items;
+  uint32_t count;
+  uint32_t capacity;
+  T3DVec3 camPos;
+} T3DRenderQueue;
+
+/**
+ * Creates an empty render queue, it grows as needed.
+ * @param capacity initial number of items
+ * @return queue, free it with 't3d_render_queue_destroy'
+ */
+T3DRenderQueue t3d_render_queue_create(uint32_t capacity);
+
+/**
+ * Removes all items, call this at the start of a frame before pushing new ones.
+ * @param queue queue
+ * @param camPos camera position (world space), used to sort by depth
+ */
+void t3d_render_queue_begin(T3DRenderQueue *queue, const T3DVec3 *camPos);
+
+/**
+ * Adds a single object to the queue.
+ * Depth is measured from the camera to the center of the object bounds, transformed by 'matrix'.
+ * Only the pointers are stored, so all of them must stay valid until the queue is drawn.
+ *
+ * @param queue queue
+ * @param model model the object belongs to
+ * @param object object to draw
+ * @param matrix model matrix, NULL to use the current matrix
+ * @param boneMatrices bone matrices for skinned objects, NULL otherwise
+ * @param layer draw layer, lower layers are drawn first regardless of material or depth
+ */
+void t3d_render_queue_push(T3DRenderQueue *queue,
+  const T3DModel *model, const T3DObject *object,
+  const T3DMat4FP *matrix, const T3DMat4FP *boneMatrices, uint8_t layer
+);
+
+/**
+ * Adds all objects of a model to the queue, see 't3d_render_queue_push'.
+ * @param queue queue
+ * @param model model to draw
+ * @param matrix model matrix, NULL to use the current matrix
+ * @param boneMatrices bone matrices for skinned models, NULL otherwise
+ * @param layer draw layer
+ */
+void t3d_render_queue_push_model(T3DRenderQueue *queue,
+  const T3DModel *model, const T3DMat4FP *matrix, const T3DMat4FP *boneMatrices, uint8_t layer
+);
+
+/**
+ * Sorts and draws all items in the queue, the queue itself is not cleared.
+ * Consecutive items with the same matrix only load it once.
+ * The callbacks in 'conf' are used for all items, 'conf.matrices', 'conf.camPos' and 'conf.frustum' are ignored.
+ * This call can be recorded into a display list, which then keeps the order of this frame.
+ *
+ * @param queue queue
+ * @param conf draw configuration
+ */
+void t3d_render_queue_draw(T3DRenderQueue *queue, T3DModelDrawConf conf);
+
+/**
+ * Frees the items of a queue.
+ * @param queue queue
+ */
+void t3d_render_queue_destroy(T3DRenderQueue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TINY3D_T3DQUEUE_H
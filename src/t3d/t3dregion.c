@@ -0,0 +1,151 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+*/
+#include "t3dregion.h"
+#include <malloc.h>
+#include <string.h>
+
+// squared distance from a point to the bounds of a region, 0 if inside
+static float region_dist_sq(const T3DRegion *region, const T3DVec3 *pos) {
+  float distSq = 0.0f;
+  for(int i = 0; i < 3; i++) {
+    float d = 0.0f;
+    if(pos->v[i] < region->aabbMin[i])d = region->aabbMin[i] - pos->v[i];
+    if(pos->v[i] > region->aabbMax[i])d = pos->v[i] - region->aabbMax[i];
+    distSq += d * d;
+  }
+  return distSq;
+}
+
+// frees the least-recently used region that is out of range and no longer used by the RSP
+static bool region_evict(T3DRegionStreamer *streamer) {
+  int32_t evictIdx = -1;
+  for(uint32_t i = 0; i < streamer->regions->count; i++) {
+    const T3DRegionSlot *slot = &streamer->slots[i];
+    if(!slot->model || slot->lastUse == streamer->frame)continue;
+    if(!rspq_syncpoint_check(slot->lastDraw))continue;
+    if(evictIdx < 0 || slot->lastUse < streamer->slots[evictIdx].lastUse)evictIdx = i;
+  }
+  if(evictIdx < 0)return false;
+
+  T3DRegionSlot *slot = &streamer->slots[evictIdx];
+  t3d_model_free(slot->model);
+  slot->model = NULL;
+  streamer->memUsed -= streamer->regions->regions[evictIdx].memSize;
+  return true;
+}
+
+// requests the next part of the region being loaded, the transfer runs until the next update
+static void region_request_chunk(T3DRegionStreamer *streamer, const T3DRegion *region) {
+  uint32_t size = region->size - streamer->loadPos;
+  if(size > T3D_REGION_DMA_CHUNK_SIZE)size = T3D_REGION_DMA_CHUNK_SIZE;
+
+  dma_read_async(
+    (char*)streamer->loadBuffer + streamer->loadPos,
+    streamer->regions->romAddr + region->offset + streamer->loadPos,
+    size
+  );
+  streamer->loadPos += size;
+}
+
+T3DRegionStreamer t3d_region_streamer_create(const T3DModel *model, uint32_t memBudget) {
+  T3DChunkRegions *regions = (T3DChunkRegions*)t3d_model_get_first_chunk(model, T3D_CHUNK_TYPE_REGIONS);
+  assertf(regions, "Model has no regions, convert it with '--regions'");
+
+  if(!regions->romAddr) {
+    const char *path = regions->filePath;
+    if(strncmp(path, "rom:/", 5) == 0)path += 4; // DFS paths start at the root
+    regions->romAddr = dfs_rom_addr(path);
+    assertf(regions->romAddr, "Region file '%s' not found", regions->filePath);
+  }
+
+  return (T3DRegionStreamer){
+    .model = model,
+    .regions = regions,
+    .slots = calloc(regions->count, sizeof(T3DRegionSlot)),
+    .loadBuffer = NULL,
+    .loadIdx = -1,
+    .memBudget = memBudget,
+  };
+}
+
+void t3d_region_streamer_update(T3DRegionStreamer *streamer, const T3DVec3 *pos, float radius) {
+  ++streamer->frame;
+
+  // continue the pending load first, only one region is in flight at a time
+  if(streamer->loadIdx >= 0) {
+    const T3DRegion *region = &streamer->regions->regions[streamer->loadIdx];
+    dma_wait(); // chunk of the last update, waits at most for one chunk
+    if(streamer->loadPos < region->size) {
+      region_request_chunk(streamer, region);
+      return;
+    }
+
+    T3DRegionSlot *slot = &streamer->slots[streamer->loadIdx];
+    slot->model = t3d_model_load_buffer(streamer->loadBuffer, region->size);
+    slot->lastUse = streamer->frame;
+    streamer->loadBuffer = NULL;
+    streamer->loadIdx = -1;
+  }
+
+  // mark regions in range as used, the closest one not loaded yet is requested next
+  float radiusSq = radius * radius;
+  float nextDistSq = radiusSq;
+  int32_t nextIdx = -1;
+  for(uint32_t i = 0; i < streamer->regions->count; i++) {
+    float distSq = region_dist_sq(&streamer->regions->regions[i], pos);
+    if(distSq > radiusSq)continue;
+
+    T3DRegionSlot *slot = &streamer->slots[i];
+    if(slot->model) {
+      slot->lastUse = streamer->frame;
+    } else if(distSq <= nextDistSq) {
+      nextDistSq = distSq;
+      nextIdx = i;
+    }
+  }
+  if(nextIdx < 0)return;
+
+  const T3DRegion *region = &streamer->regions->regions[nextIdx];
+  while(streamer->memUsed + region->memSize > streamer->memBudget) {
+    if(!region_evict(streamer))return; // nothing to free yet, try again next frame
+  }
+
+  streamer->loadBuffer = memalign(16, region->size);
+  data_cache_hit_writeback_invalidate(streamer->loadBuffer, region->size);
+  streamer->loadIdx = nextIdx;
+  streamer->loadPos = 0;
+  streamer->memUsed += region->memSize;
+  region_request_chunk(streamer, region);
+}
+
+void t3d_region_streamer_draw(T3DRegionStreamer *streamer, const T3DFrustum *frustum, T3DModelDrawConf conf) {
+  for(uint32_t i = 0; i < streamer->regions->count; i++) {
+    T3DRegionSlot *slot = &streamer->slots[i];
+    if(!slot->model)continue;
+
+    const T3DRegion *region = &streamer->regions->regions[i];
+    if(frustum && !t3d_frustum_vs_aabb_s16(frustum, region->aabbMin, region->aabbMax))continue;
+
+    t3d_model_draw_custom(slot->model, conf);
+    slot->lastDraw = rspq_syncpoint_new();
+  }
+}
+
+void t3d_region_streamer_destroy(T3DRegionStreamer *streamer) {
+  if(streamer->loadIdx >= 0) {
+    dma_wait();
+    free(streamer->loadBuffer);
+  }
+
+  for(uint32_t i = 0; i < streamer->regions->count; i++) {
+    T3DRegionSlot *slot = &streamer->slots[i];
+    if(!slot->model)continue;
+    rspq_syncpoint_wait(slot->lastDraw);
+    t3d_model_free(slot->model);
+  }
+
+  free(streamer->slots);
+  *streamer = (T3DRegionStreamer){0};
+}
@@ -0,0 +1,87 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+* @file t3dregion.h
+*/
+#ifndef TINY3D_T3DREGION_H
+#define TINY3D_T3DREGION_H
+
+#include "t3dmodel.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// max. bytes transferred per update, keeps the PI free for other users (audio, animations) in between
+#define T3D_REGION_DMA_CHUNK_SIZE (16 * 1024)
+
+typedef struct {
+  T3DModel *model; // NULL if not loaded
+  uint32_t lastUse; // last update in which the region was in range
+  rspq_syncpoint_t lastDraw; // region can only be freed once the RSP is past this point
+} T3DRegionSlot;
+
+/**
+ * Streams in the regions of a level converted with '--regions'.
+ * Regions close to a given position are loaded via DMA, one at a time and in chunks across frames,
+ * and the least-recently used ones are freed once the memory budget is exceeded.
+ *
+ * Note that regions with a compressed mesh are decoded into a new allocation on load,
+ * so for a moment both the file data ('size') and the loaded model ('memSize') are in memory.
+ */
+typedef struct {
+  const T3DModel *model; // model containing the region chunk (and any resident objects)
+  T3DChunkRegions *regions;
+  T3DRegionSlot *slots;
+  void *loadBuffer; // target of the pending DMA
+  int32_t loadIdx; // region being loaded, -1 if none
+  uint32_t loadPos; // bytes of the region requested so far
+  uint32_t memBudget;
+  uint32_t memUsed;
+  uint32_t frame;
+} T3DRegionStreamer;
+
+/**
+ * Creates a streamer for the regions of a model, no region is loaded yet.
+ * The model itself stays owned by the caller and is not drawn by the streamer.
+ *
+ * @param model model converted with '--regions'
+ * @param memBudget max. memory used by loaded regions in bytes
+ * @return streamer, free it with 't3d_region_streamer_destroy'
+ */
+T3DRegionStreamer t3d_region_streamer_create(const T3DModel *model, uint32_t memBudget);
+
+/**
+ * Loads regions within 'radius' of 'pos', call this once per frame.
+ * Each call requests the next chunk of the current load (see 'T3D_REGION_DMA_CHUNK_SIZE'),
+ * after waiting for the one of the previous call, which is usually done by then.
+ * Regions out of range are freed as needed to stay within the memory budget.
+ *
+ * @param streamer streamer
+ * @param pos position in model space
+ * @param radius load distance in model space
+ */
+void t3d_region_streamer_update(T3DRegionStreamer *streamer, const T3DVec3 *pos, float radius);
+
+/**
+ * Draws all loaded regions inside the frustum.
+ * Since loaded regions change over time, this must not be recorded into a display list.
+ *
+ * @param streamer streamer
+ * @param frustum frustum in model space, NULL to draw all loaded regions
+ * @param conf draw configuration passed to each region
+ */
+void t3d_region_streamer_draw(T3DRegionStreamer *streamer, const T3DFrustum *frustum, T3DModelDrawConf conf);
+
+/**
+ * Frees all loaded regions, waits for any pending load and draw to finish.
+ * @param streamer streamer
+ */
+void t3d_region_streamer_destroy(T3DRegionStreamer *streamer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TINY3D_T3DREGION_H
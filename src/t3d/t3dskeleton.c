@@ -43,6 +43,7 @@ void t3d_skeleton_reset(T3DSkeleton *skeleton) {
       sizeof(T3DVec3) + sizeof(T3DQuat) + sizeof(T3DVec3) // copy all 3 vectors (SRT) at once
     );
     skeleton->bones[i].hasChanged = true;
+    skeleton->bones[i].lastAnim = NULL; // constant channels of attached animations must be set again
   }
 }
 
@@ -53,6 +54,7 @@ void t3d_skeleton_blend(const T3DSkeleton *skelRes, const T3DSkeleton *skelA, co
     T3DBone *boneB = &skelB->bones[i];
 
     boneRes->hasChanged = true;
+    boneRes->lastAnim = NULL;
     t3d_quat_nlerp(&boneRes->rotation, &boneA->rotation, &boneB->rotation, factor);
     t3d_vec3_lerp(&boneRes->position, &boneA->position, &boneB->position, factor);
     t3d_vec3_lerp(&boneRes->scale, &boneA->scale, &boneB->scale, factor);
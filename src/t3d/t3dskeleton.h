@@ -24,6 +24,7 @@ typedef struct {
   T3DQuat rotation;
   T3DVec3 position;
   int32_t hasChanged;
+  const void* lastAnim; // last animation ('T3DAnim') that wrote to this bone
 } T3DBone;
 
 /**
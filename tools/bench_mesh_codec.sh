@@ -0,0 +1,68 @@
+#!/usr/bin/env bash
+# Compares model sizes with and without '--compress-mesh' for all example models.
+# If libdragon is installed, each variant is also compressed with 'mkasset' (level 1 + 2)
+# to compare against (and combined with) the generic asset compression.
+# Decode times are measured on the host and only meant as a relative number.
+# Load times on the console (against the asset compression) are measured by the ROM in 'tools/bench_mesh_codec'.
+
+set -e
+
+T3D_DIR=$(realpath "$(dirname "$0")/..")
+GLTF_TO_T3D="$T3D_DIR/tools/gltf_importer/gltf_to_t3d"
+MKASSET="$N64_INST/bin/mkasset"
+OUT_DIR=$(mktemp -d)
+
+if [ ! -x "$GLTF_TO_T3D" ]; then
+  echo "Importer not found, build it first: make -C tools/gltf_importer"
+  exit 1
+fi
+
+file_size() {
+  stat -c %s "$1"
+}
+
+# converts all models with the given args into a directory, returns the total size
+convert_all() {
+  local dir="$OUT_DIR/$1"; shift
+  mkdir -p "$dir"
+  for asset_dir in "$T3D_DIR"/examples/*/assets; do
+    (cd "$asset_dir/.."
+    for f in assets/*.glb; do
+      [ -f "$f" ] || continue
+      name=$(basename "$(dirname "$asset_dir")")_$(basename "$f" .glb)
+      "$GLTF_TO_T3D" "$f" "$dir/$name.t3dm" --verbose "$@" > "$dir/$name.log"
+    done)
+  done
+  cat "$dir"/*.t3dm | wc -c
+}
+
+asset_size() {
+  local dir="$OUT_DIR/$1"
+  local level=$2
+  mkdir -p "$dir/c$level"
+  for f in "$dir"/*.t3dm; do
+    "$MKASSET" -c "$level" -o "$dir/c$level" "$f"
+  done
+  cat "$dir/c$level"/*.t3dm | wc -c
+}
+
+size_raw=$(convert_all raw)
+size_codec=$(convert_all codec --compress-mesh)
+decode_us=$(cat "$OUT_DIR"/codec/*.log | grep "\[Codec\]" | sed -E 's/.*decode: ([0-9.]+)us.*/\1/' | awk '{s+=$1} END {print s}')
+
+printf "%-24s %12s\n" "Variant" "Size (bytes)"
+printf "%-24s %12d\n" "raw" "$size_raw"
+printf "%-24s %12d\n" "mesh-codec" "$size_codec"
+
+if [ -x "$MKASSET" ]; then
+  for level in 1 2; do
+    printf "%-24s %12d\n" "raw + mkasset -c $level" "$(asset_size raw $level)"
+    printf "%-24s %12d\n" "mesh-codec + mkasset -c $level" "$(asset_size codec $level)"
+  done
+else
+  echo "(mkasset not found, set N64_INST to compare against libdragon's asset compression)"
+fi
+
+echo "Mesh-codec decode time (host, all models): ${decode_us}us"
+echo "(for load times on the console, build and run the ROM in tools/bench_mesh_codec)"
+rm -rf "$OUT_DIR"
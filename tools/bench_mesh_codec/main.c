@@ -0,0 +1,107 @@
+#include <libdragon.h>
+
+#include <t3d/t3d.h>
+#include <t3d/t3dmodel.h>
+
+/**
+ * Measures the load time of one model on the console, stored with/without '--compress-mesh'
+ * and with/without libdragon's asset compression ('mkasset -c 1/2').
+ *
+ * Reading the file ('asset_load', incl. asset decompression) and 't3d_model_load_buffer'
+ * (mesh decoding + relocation) are timed separately, averaged over multiple runs.
+ * Results are shown on screen and written to the log.
+ * Run this on hardware or in an emulator with accurate timings (e.g. ares).
+ * The model can be changed with 'make BENCH_MODEL=path/to/model.glb'.
+ */
+
+#define RUN_COUNT 8
+
+typedef struct {
+  const char *path;
+  const char *name;
+  int fileSize;
+  int loadedSize;
+  uint64_t ticksRead;
+  uint64_t ticksDecode;
+} BenchVariant;
+
+static int get_file_size(const char *path) {
+  FILE *f = fopen(path, "rb");
+  assertf(f, "File not found: %s", path);
+  fseek(f, 0, SEEK_END);
+  int size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+static void bench_variant(BenchVariant *var) {
+  var->fileSize = get_file_size(var->path);
+  var->ticksRead = 0;
+  var->ticksDecode = 0;
+
+  for(int i=0; i<RUN_COUNT; ++i) {
+    uint64_t ticksStart = get_ticks();
+    int size = 0;
+    void *data = asset_load(var->path, &size);
+    uint64_t ticksRead = get_ticks();
+
+    T3DModel *model = t3d_model_load_buffer(data, size);
+    var->ticksDecode += get_ticks() - ticksRead;
+    var->ticksRead += ticksRead - ticksStart;
+
+    var->loadedSize = size;
+    t3d_model_free(model);
+  }
+  var->ticksRead /= RUN_COUNT;
+  var->ticksDecode /= RUN_COUNT;
+
+  debugf("%-12s file: %7d bytes, model: %7d bytes, read: %6lluus, t3d-load: %6lluus, total: %6lluus\n",
+    var->name, var->fileSize, var->loadedSize,
+    TICKS_TO_US(var->ticksRead), TICKS_TO_US(var->ticksDecode), TICKS_TO_US(var->ticksRead + var->ticksDecode)
+  );
+}
+
+[[noreturn]]
+int main()
+{
+	debug_init_isviewer();
+	debug_init_usblog();
+  asset_init_compression(2);
+
+  dfs_init(DFS_DEFAULT_LOCATION);
+  display_init(RESOLUTION_320x240, DEPTH_16_BPP, 2, GAMMA_NONE, FILTERS_RESAMPLE);
+
+  rdpq_init();
+  rdpq_text_register_font(FONT_BUILTIN_DEBUG_MONO, rdpq_font_load_builtin(FONT_BUILTIN_DEBUG_MONO));
+  t3d_init((T3DInitParams){});
+
+  BenchVariant variants[] = {
+    {.path = "rom:/raw_c0.t3dm",   .name = "raw"},
+    {.path = "rom:/raw_c1.t3dm",   .name = "raw+c1"},
+    {.path = "rom:/raw_c2.t3dm",   .name = "raw+c2"},
+    {.path = "rom:/codec_c0.t3dm", .name = "codec"},
+    {.path = "rom:/codec_c1.t3dm", .name = "codec+c1"},
+    {.path = "rom:/codec_c2.t3dm", .name = "codec+c2"},
+  };
+  const int variantCount = sizeof(variants) / sizeof(variants[0]);
+
+  for(int v=0; v<variantCount; ++v) {
+    bench_variant(&variants[v]);
+  }
+
+  for(;;)
+  {
+    rdpq_attach_clear(display_get(), NULL);
+    rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, 16, 20, "Load times (us), %d runs", RUN_COUNT);
+    rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, 16, 40, "Variant    File     Read  Load Total");
+
+    for(int v=0; v<variantCount; ++v) {
+      const BenchVariant *var = &variants[v];
+      rdpq_text_printf(NULL, FONT_BUILTIN_DEBUG_MONO, 16, 52 + v*12, "%-9s %7d %6llu %5llu %5llu",
+        var->name, var->fileSize,
+        TICKS_TO_US(var->ticksRead), TICKS_TO_US(var->ticksDecode), TICKS_TO_US(var->ticksRead + var->ticksDecode)
+      );
+    }
+    rdpq_detach_show();
+  }
+}
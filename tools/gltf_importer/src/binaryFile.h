@@ -5,6 +5,7 @@
 #pragma once
 
 #include <cstdio>
+#include <cstring>
 #include <unordered_map>
 #include "types.h"
 #include "bit.h"
@@ -47,6 +48,13 @@ class BinaryFile
       }
     }
 
+    template<typename T>
+    T read(u32 pos) const {
+      T value;
+      memcpy(&value, data.data() + pos, sizeof(T));
+      return Bit::byteswap(value);
+    }
+
     void write(const std::string &str) {
       writeChars(str.c_str(), str.size());
     }
@@ -108,6 +116,10 @@ class BinaryFile
       return dataSize;
     }
 
+    const uint8_t* getData() const {
+      return data.data();
+    }
+
     void writeToFile(const char* filename) {
       FILE* file = fopen(filename, "wb");
       fwrite(data.data(), 1, dataSize, file);
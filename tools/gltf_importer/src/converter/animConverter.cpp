@@ -56,6 +56,20 @@ namespace {
    */
   void optimizeChannel(T3DM::AnimChannelMapping &channel, float time) {
     if(channel.keyframes.size() < 2)return;
+
+    // the MSE below assumes linear interpolation, in STEP channels only repeated values can be removed
+    if(channel.isStep) {
+      std::vector<T3DM::Keyframe> keyframes{channel.keyframes[0]};
+      for(uint32_t i=1; i<channel.keyframes.size(); ++i) {
+        const auto &kf = channel.keyframes[i];
+        const auto &kfLast = keyframes.back();
+        bool isSame = channel.isRotation() ? (kf.valQuat == kfLast.valQuat) : (fabsf(kf.valScalar - kfLast.valScalar) < MIN_VALUE_DELTA);
+        if(!isSame)keyframes.push_back(kf);
+      }
+      channel.keyframes = keyframes;
+      return;
+    }
+
     auto channelOrg = channel;
     float mse = calcMSE(channel.keyframes, channelOrg.keyframes, 0, time, channel.isRotation());
     assert(mse < 0.00001f); //  initial MSE must be zero
@@ -82,19 +96,78 @@ namespace {
     }
   }
 
-  void quantizeRotation(T3DM::Keyframe &kf)
+  constexpr uint8_t SCALAR_SIZES[] = {1, 2, 3};
+  constexpr uint8_t QUAT_SIZES[] = {3, 4, 6};
+
+  // bits per value, for quaternions this is per component (2 bits are used for the largest index)
+  constexpr uint32_t dataSizeToBits(uint8_t dataSize, bool isRotation) {
+    return isRotation ? (dataSize * 8 - 2) / 3 : dataSize * 8;
+  }
+
+  float getScalarQuantScale(const T3DM::AnimChannelMapping &ch) {
+    float maxVal = (float)((1u << dataSizeToBits(ch.dataSize, false)) - 1);
+    return (ch.valueMax - ch.valueMin) / maxVal;
+  }
+
+  uint64_t quantizeScalar(const T3DM::AnimChannelMapping &ch, float value) {
+    float scale = getScalarQuantScale(ch);
+    if(scale <= 0.0f)return 0;
+    return (uint64_t)round((double)(value - ch.valueMin) / scale);
+  }
+
+  float quatAngleError(const Quat &a, const Quat &b) {
+    float dot = fabsf(a.toVec4().dot(b.toVec4()));
+    return acosf(std::min(dot, 1.0f)) * 2.0f * (180.0f / (float)M_PI);
+  }
+
+  /**
+   * Picks the smallest size for the values of a channel, that keeps the error within the budget.
+   * If none does, the largest size is used.
+   */
+  uint8_t pickChannelDataSize(T3DM::AnimChannelMapping &ch, const T3DM::AnimErrorBudget &budget)
   {
-    uint32_t quatQuant = Quantizer::quatTo32Bit(kf.valQuat);
-    if(quatQuant == 0) {
-      throw std::runtime_error(std::string{"Quantized rotation is zero: "} + std::to_string(kf.chanelIdx) + " Quat: " + kf.valQuat.toString());
+    if(ch.isRotation()) {
+      for(auto size : QUAT_SIZES) {
+        uint32_t bits = dataSizeToBits(size, true);
+        float maxError = 0.0f;
+        for(auto &kf : ch.keyframes) {
+          Quat q = Quantizer::bitsToQuat(Quantizer::quatToBits(kf.valQuat, bits), bits);
+          maxError = std::max(maxError, quatAngleError(q, kf.valQuat));
+        }
+        if(maxError <= budget.rotation)return size;
+      }
+      return QUAT_SIZES[std::size(QUAT_SIZES)-1];
+    }
+
+    float maxAllowed = (ch.targetType == T3DM::AnimChannelTarget::TRANSLATION ? budget.translation : budget.scale);
+    for(auto size : SCALAR_SIZES) {
+      ch.dataSize = size;
+      float scale = getScalarQuantScale(ch);
+      float maxError = 0.0f;
+      for(auto &kf : ch.keyframes) {
+        float val = (float)quantizeScalar(ch, kf.valScalar) * scale + ch.valueMin;
+        maxError = std::max(maxError, fabsf(val - kf.valScalar));
+      }
+      if(maxError <= maxAllowed)return size;
+    }
+    return SCALAR_SIZES[std::size(SCALAR_SIZES)-1];
+  }
+
+  void quantizeKeyframe(const T3DM::AnimChannelMapping &ch, T3DM::Keyframe &kf)
+  {
+    uint64_t value = ch.isRotation()
+      ? Quantizer::quatToBits(kf.valQuat, dataSizeToBits(ch.dataSize, true))
+      : quantizeScalar(ch, kf.valScalar);
+
+    // stored as big-endian bytes
+    kf.valQuantSize = ch.dataSize;
+    for(uint32_t i=0; i<ch.dataSize; ++i) {
+      kf.valQuant[i] = (value >> ((ch.dataSize - 1 - i) * 8)) & 0xFF;
     }
-    kf.valQuantSize = 2;
-    kf.valQuant[1] = quatQuant & 0xFFFF;
-    kf.valQuant[0] = quatQuant >> 16;
   }
 }
 
-void convertAnimation(T3DM::Anim &anim, const std::unordered_map<std::string, const T3DM::Bone*> &nodeMap)
+void convertAnimation(const T3DM::Config &config, T3DM::Anim &anim, const std::unordered_map<std::string, const T3DM::Bone*> &nodeMap)
 {
   // remove all empty channels
   anim.channelMap.erase(
@@ -102,22 +175,43 @@ void convertAnimation(T3DM::Anim &anim, const std::unordered_map<std::string, co
     anim.channelMap.end()
   );
 
+  // channels that never change are stored once instead of being streamed
+  std::vector<T3DM::AnimChannelMapping> channelsStreamed{};
+  for(auto &ch : anim.channelMap) {
+    if(hasConstValue(ch.keyframes, ch.isRotation())) {
+      ch.keyframes.resize(1);
+      anim.channelMapConst.push_back(ch);
+    } else {
+      channelsStreamed.push_back(ch);
+    }
+  }
+  anim.channelMap = channelsStreamed;
+
   // resample keyframes
   for(auto &ch : anim.channelMap) {
     optimizeChannel(ch, anim.duration);
   }
 
-  // Map the channel target by name to the node index
+  // pick the size of each channel
   for(auto &ch : anim.channelMap) {
-    auto it = nodeMap.find(ch.targetName);
-    if(it == nodeMap.end()) {
-      std::string error = "Animation channel mapper: Node '" + ch.targetName + "' not found";
-      throw std::runtime_error(error);
-    }
-    ch.targetIdx = it->second->index;
-    //printf("  - ChannelMapping %s %d.%d\n", ch.targetName.c_str(), ch.targetType, ch.targetIdx);
+    ch.dataSize = pickChannelDataSize(ch, config.animErrorBudget);
   }
 
+  // Map the channel target by name to the node index
+  auto mapTargets = [&nodeMap](std::vector<T3DM::AnimChannelMapping> &channels) {
+    for(auto &ch : channels) {
+      auto it = nodeMap.find(ch.targetName);
+      if(it == nodeMap.end()) {
+        std::string error = "Animation channel mapper: Node '" + ch.targetName + "' not found";
+        throw std::runtime_error(error);
+      }
+      ch.targetIdx = it->second->index;
+      //printf("  - ChannelMapping %s %d.%d\n", ch.targetName.c_str(), ch.targetType, ch.targetIdx);
+    }
+  };
+  mapTargets(anim.channelMap);
+  mapTargets(anim.channelMapConst);
+
   // combine channel keyframes into the global timeline
   for(uint32_t c=0; c<anim.channelMap.size(); ++c) {
     auto &keyframes = anim.channelMap[c].keyframes;
@@ -159,15 +253,8 @@ void convertAnimation(T3DM::Anim &anim, const std::unordered_map<std::string, co
   });
 
   // Now quantize/compress the values
-  for(auto &kf : anim.keyframes)
-  {
-    auto &ch = anim.channelMap[kf.chanelIdx];
-    if(ch.targetType == T3DM::AnimChannelTarget::ROTATION) {
-      quantizeRotation(kf);
-    } else {
-      kf.valQuantSize = 1;
-      kf.valQuant[0] = Quantizer::floatToU16(kf.valScalar, ch.valueMin, ch.valueMax - ch.valueMin);
-    }
+  for(auto &kf : anim.keyframes) {
+    quantizeKeyframe(anim.channelMap[kf.chanelIdx], kf);
   }
 
   // re-count channels
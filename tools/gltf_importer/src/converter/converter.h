@@ -12,6 +12,9 @@ void convertVertex(
   float modelScale, float texSizeX, float texSizeY, const T3DM::VertexNorm &v, T3DM::VertexT3D &vT3D,
   const Mat4 &mat, const std::vector<Mat4> &matrices, bool uvAdjust
 );
-T3DM::ModelChunked chunkUpModel(const T3DM::Model& model);
+T3DM::ModelChunked chunkUpModel(const T3DM::Model& model, bool groupByNormal = false);
+void computeChunkCones(T3DM::ModelChunked &model);
+// chunks up a model with normal cones, grouping triangles by normal if that skips more vertex loads
+T3DM::ModelChunked chunkUpModelCulled(const T3DM::Model& model);
 
-void convertAnimation(T3DM::Anim &anim, const std::unordered_map<std::string, const T3DM::Bone*> &nodeMap);
\ No newline at end of file
+void convertAnimation(const T3DM::Config &config, T3DM::Anim &anim, const std::unordered_map<std::string, const T3DM::Bone*> &nodeMap);
\ No newline at end of file
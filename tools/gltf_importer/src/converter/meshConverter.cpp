@@ -4,12 +4,14 @@
 */
 
 #include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cassert>
 #include <random>
 #include <stdexcept>
 #include <unordered_map>
 #include "converter.h"
+#include "../lib/meshopt/meshoptimizer.h"
 
 namespace
 {
@@ -44,6 +46,65 @@ namespace
     }
     return connCount;
   }
+
+  /**
+   * Sorts triangles by the direction they face, returns the group of each (sorted) triangle.
+   * Directions point to the faces, edges and corners of a cube,
+   * so all normals in a group are less than 28deg away from it.
+   */
+  std::vector<uint32_t> groupTrianglesByNormal(std::vector<T3DM::TriangleT3D> &triangles)
+  {
+    std::vector<Vec3> dirs{};
+    for(int x=-1; x<=1; ++x) {
+      for(int y=-1; y<=1; ++y) {
+        for(int z=-1; z<=1; ++z) {
+          if(x != 0 || y != 0 || z != 0)dirs.push_back(Vec3{(float)x, (float)y, (float)z}.normalize());
+        }
+      }
+    }
+
+    std::vector<uint32_t> groups{};
+    groups.reserve(triangles.size());
+    for(const auto &tri : triangles) {
+      Vec3 pos[3];
+      for(int i=0; i<3; ++i) {
+        pos[i] = Vec3{(float)tri.vert[i].pos[0], (float)tri.vert[i].pos[1], (float)tri.vert[i].pos[2]};
+      }
+      Vec3 normal = (pos[1] - pos[0]).cross(pos[2] - pos[0]);
+
+      uint32_t bestDir = 0;
+      for(uint32_t d=1; d<dirs.size(); ++d) {
+        if(normal.dot(dirs[d]) > normal.dot(dirs[bestDir]))bestDir = d;
+      }
+      groups.push_back(bestDir);
+    }
+
+    std::vector<uint32_t> order(triangles.size());
+    for(uint32_t t=0; t<order.size(); ++t)order[t] = t;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return groups[a] < groups[b]; });
+
+    std::vector<T3DM::TriangleT3D> sortedTris{};
+    std::vector<uint32_t> sortedGroups{};
+    sortedTris.reserve(triangles.size());
+    sortedGroups.reserve(triangles.size());
+    for(auto t : order) {
+      sortedTris.push_back(triangles[t]);
+      sortedGroups.push_back(groups[t]);
+    }
+    triangles = std::move(sortedTris);
+    return sortedGroups;
+  }
+
+  // vertices loaded on average, assuming the camera is far away and looks from a random direction
+  float expectedVertexLoads(const T3DM::ModelChunked &model)
+  {
+    float loads = 0.0f;
+    for(const auto &chunk : model.chunks) {
+      float skipChance = chunk.coneCutoff == 127 ? 0.0f : (1.0f - chunk.coneCutoff / 127.0f) * 0.5f;
+      loads += chunk.vertexCount * (1.0f - skipChance);
+    }
+    return loads;
+  }
 }
 
 uint64_t hashVertex(const T3DM::VertexT3D &vT3D, uint32_t boneIndex)
@@ -129,13 +190,19 @@ void convertVertex(
   vT3D.boneIndex = v.boneIndex;
 }
 
-T3DM::ModelChunked chunkUpModel(const T3DM::Model &model)
+T3DM::ModelChunked chunkUpModel(const T3DM::Model &model, bool groupByNormal)
 {
+  // with 'groupByNormal', a part only contains triangles of one group to keep its normal cone tight
+  std::vector<T3DM::TriangleT3D> triangles = model.triangles;
+  std::vector<uint32_t> triGroup = groupByNormal
+    ? groupTrianglesByNormal(triangles)
+    : std::vector<uint32_t>(triangles.size(), 0);
+
   T3DM::ModelChunked res{
     .aabbMin = { 32767, 32767, 32767 },
     .aabbMax = { -32768, -32768, -32768 }
   };
-  res.chunks.reserve(model.triangles.size() * 3 / T3DM::MAX_VERTEX_COUNT);
+  res.chunks.reserve(triangles.size() * 3 / T3DM::MAX_VERTEX_COUNT);
   res.chunks.push_back(T3DM::MeshChunk{});
   res.chunks.back().materialName = model.materialName;
   res.chunks.back().name = model.name;
@@ -280,29 +347,38 @@ T3DM::ModelChunked chunkUpModel(const T3DM::Model &model)
   };
 
   std::vector<bool> triangleIsEmitted{};
-  triangleIsEmitted.resize(model.triangles.size(), false);
+  triangleIsEmitted.resize(triangles.size(), false);
 
   // Now we want to emit vertices and indices by iterating over the triangles.
   // We start with the most connected triangles and emit any other triangle
   // that is constructable with the current vertices.
   // This should lead to less duplicated vertices / loads.
-  for(int t=0; t<model.triangles.size(); ++t)
+  // Triangles are sorted by group, a new group always starts a new chunk.
+  uint32_t currGroup = triGroup.empty() ? 0 : triGroup[0];
+  int groupEnd = 0;
+  for(int t=0; t<triangles.size(); ++t)
   {
     if(triangleIsEmitted[t])continue;
 
+    if(triGroup[t] != currGroup) {
+      checkAndEmitChunk(true);
+      currGroup = triGroup[t];
+    }
+    while(groupEnd < triangles.size() && (groupEnd <= t || triGroup[groupEnd] == currGroup))++groupEnd;
+
     checkAndEmitChunk(false);
-    if(!emitTriangle(model.triangles[t], false)) {
+    if(!emitTriangle(triangles[t], false)) {
 
       if(emittedVerts % 2 != 0) {
         //printf("Tri doesn't fit, buffer % 2 != 0, emit 1 random vertex\n");
-        auto &nextTri = model.triangles[(t+1) < model.triangles.size() ? (t+1) : t];
+        auto &nextTri = triangles[(t+1) < triangles.size() ? (t+1) : t];
         emitVertex(res, nextTri.vert[0]);
         ++emittedVerts;
 
         // since we had to emit a random vertex, try again to find a fitting triangle
-        for(int s=t+1; s<model.triangles.size(); ++s) {
+        for(int s=t+1; s<groupEnd; ++s) {
           if(triangleIsEmitted[s])continue;
-          if(emitTriangle(model.triangles[s], true)) {
+          if(emitTriangle(triangles[s], true)) {
             triangleIsEmitted[s] = true;
           }
         }
@@ -316,16 +392,16 @@ T3DM::ModelChunked chunkUpModel(const T3DM::Model &model)
     triangleIsEmitted[t] = true;
 
     // Check all other triangles that don't need new vertices
-    for(int s=t+1; s<model.triangles.size(); ++s) {
+    for(int s=t+1; s<groupEnd; ++s) {
       if(triangleIsEmitted[s])continue;
-      if(emitTriangle(model.triangles[s], true)) {
+      if(emitTriangle(triangles[s], true)) {
         //log_debug("Emitting (no new): %d/%d | %d\n", s, t, triangles.size());
         triangleIsEmitted[s] = true;
       }
     }
 
     std::vector<int> connCounts{};
-    connCounts.resize(model.triangles.size(), -1);
+    connCounts.resize(triangles.size(), -1);
 
     // Now check the ones that have vertices in common.
     // First check 3 (no new vertex needed), then the ones with 2, then 1
@@ -334,10 +410,10 @@ T3DM::ModelChunked chunkUpModel(const T3DM::Model &model)
       auto freeVertLeft = T3DM::MAX_VERTEX_COUNT - emittedVerts;
       if(freeVertLeft < maxCount)break;
 
-      for(int triIdx= t + 1; triIdx < model.triangles.size(); ++triIdx)
+      for(int triIdx= t + 1; triIdx < groupEnd; ++triIdx)
       {
         if(triangleIsEmitted[triIdx])continue;
-        const auto &triCheck = model.triangles[triIdx];
+        const auto &triCheck = triangles[triIdx];
 
         int connCount = connCounts[triIdx];
         if(connCount < 0) {
@@ -347,7 +423,7 @@ T3DM::ModelChunked chunkUpModel(const T3DM::Model &model)
         if(connCount < maxCount)continue;
 
         //log_debug("Emitting (common %d): %d/%d | %d\n", connCount, s, t, triangles.size());
-        if(emitTriangle(model.triangles[triIdx], false)) {
+        if(emitTriangle(triangles[triIdx], false)) {
           std::fill(connCounts.begin(), connCounts.end(), -1);
 
           checkAndEmitChunk(false);
@@ -389,3 +465,52 @@ T3DM::ModelChunked chunkUpModel(const T3DM::Model &model)
 
   return res;
 }
+
+void computeChunkCones(T3DM::ModelChunked &model)
+{
+  // skinned meshes are deformed at runtime, and their partial loads couldn't be skipped on their own
+  for(const auto &v : model.vertices) {
+    if(v.boneIndex >= 0)return;
+  }
+
+  for(auto &chunk : model.chunks)
+  {
+    if(chunk.indices.empty())continue;
+
+    std::vector<float> positions{};
+    positions.reserve(chunk.vertexCount * 3);
+    for(uint32_t v=0; v<chunk.vertexCount; ++v) {
+      const auto &vert = model.vertices[chunk.vertexOffset + v];
+      positions.insert(positions.end(), {(float)vert.pos[0], (float)vert.pos[1], (float)vert.pos[2]});
+    }
+
+    std::vector<uint32_t> indices{chunk.indices.begin(), chunk.indices.end()};
+    auto bounds = meshopt_computeClusterBounds(
+      indices.data(), indices.size(), positions.data(), chunk.vertexCount, sizeof(float) * 3
+    );
+
+    // rounding the center moves it by up to half a unit per axis, grow the radius to stay conservative
+    float radius = ceilf(bounds.radius + 0.87f);
+    if(radius > 32767.0f)continue;
+
+    for(int i=0; i<3; ++i) {
+      chunk.coneCenter[i] = (int16_t)std::clamp(roundf(bounds.center[i]), -32768.0f, 32767.0f);
+      chunk.coneAxis[i] = bounds.cone_axis_s8[i];
+    }
+    chunk.coneRadius = (int16_t)radius;
+    chunk.coneCutoff = bounds.cone_cutoff_s8;
+  }
+}
+
+T3DM::ModelChunked chunkUpModelCulled(const T3DM::Model &model)
+{
+  auto chunks = chunkUpModel(model);
+  computeChunkCones(chunks);
+
+  // parts formed by vertex reuse alone are often too wide to ever cull,
+  // grouping by normal keeps them tight but splits the mesh into more parts and duplicates vertices
+  auto chunksGrouped = chunkUpModel(model, true);
+  computeChunkCones(chunksGrouped);
+
+  return expectedVertexLoads(chunksGrouped) < expectedVertexLoads(chunks) ? chunksGrouped : chunks;
+}
@@ -13,4 +13,14 @@ inline uint32_t stringHash(const std::string &str)
     hash = (hash >> 8) ^ (hash << 24) ^ c;
   }
   return hash;
-}
\ No newline at end of file
+}
+
+// FNV-1a, used for name lookups at runtime (see 'lookup_hash' in t3dmodel.c)
+inline uint32_t nameHash(const std::string &str)
+{
+  uint32_t hash = 0x811C9DC5;
+  for(char c : str) {
+    hash = (hash ^ (uint8_t)c) * 0x01000193;
+  }
+  return hash;
+}
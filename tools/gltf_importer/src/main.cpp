@@ -9,6 +9,7 @@
 #include "structs.h"
 #include "parser.h"
 #include "args.h"
+#include "optimizer/optimizer.h"
 
 namespace fs = std::filesystem;
 
@@ -17,13 +18,25 @@ int main(int argc, char* argv[])
   T3DM::Config config{};
   EnvArgs args{argc, argv};
   if(args.checkArg("--help")) {
-    printf("Usage: %s <gltf-file> <t3dm-file> [--bvh] [--base-scale=64] [--ignore-materials] [--ignore-transforms] [--asset-path=assets] [--verbose]\n", argv[0]);
+    printf("Usage: %s <gltf-file> <t3dm-file> [--bvh] [--collision] [--base-scale=64] [--ignore-materials] [--ignore-transforms] [--ignore-anims] [--anim-lib] [--anim-archive] [--asset-path=assets] [--cost-model=<file>] [--compress-mesh] [--instancing] [--merge-static=4] [--pvs=2] [--regions=32] [--anim-error=1] [--anim-rate=60] [--verbose]\n", argv[0]);
     printf("Params:\n");
     printf("  --bvh: Create a BVH for the model, this is used for culling and visibility checks\n");
+    printf("  --collision: Create a triangle BVH of all static meshes, used for collision queries (raycasts, sphere-sweeps)\n");
     printf("  --base-scale=<scale>: Scale applied to blender units before conversion to integers, default is 64\n");
     printf("  --ignore-materials: Ignore F3D materials and write dummy data, useful for custom material systems\n");
     printf("  --ignore-transforms: Ignore all object transforms, can be used to force objects to be at (0,0,0)\n");
+    printf("  --ignore-anims: Ignore all animations, e.g. if they are shared through an animation library\n");
+    printf("  --anim-lib: Only write the skeleton and animations, which can then be used with any model of the same skeleton\n");
+    printf("  --anim-archive: Write the streamed data of all animations into a single file, instead of one per animation\n");
     printf("  --asset-path=<path>: Base asset path, default is 'assets/'\n");
+    printf("  --cost-model=<file>: JSON file overriding the cost-model used to pick index encodings\n");
+    printf("  --compress-mesh: Compress vertices and indices, decoded once when loading the model\n");
+    printf("  --instancing: Store meshes used by multiple objects only once, together with a list of transforms\n");
+    printf("  --merge-static=<size>: Merge small objects with the same material, merged objects stay within <size> (blender units, default 4)\n");
+    printf("  --pvs=<size>: Precompute which objects are visible from each cell of a grid, cells are <size> (blender units, default 2)\n");
+    printf("  --regions=<size>: Split static objects into a grid of regions streamed in at runtime, cells are <size> (blender units, default 32), can't be combined with '--pvs'\n");
+    printf("  --anim-error=<factor>: Scales the max. error allowed when picking the size of animation values, default is 1\n");
+    printf("  --anim-rate=<rate>: Sample rate used to resample animations (except STEP channels), default is 60\n");
     printf("  --verbose: Enable verbose output\n");
     return 1;
   }
@@ -35,9 +48,43 @@ int main(int argc, char* argv[])
   config.globalScale = (float)args.getU32Arg("--base-scale", 64);
   config.ignoreMaterials = args.checkArg("--ignore-materials");
   config.ignoreTransforms = args.checkArg("--ignore-transforms");
+  config.ignoreAnimations = args.checkArg("--ignore-anims");
+  config.animLibrary = args.checkArg("--anim-lib");
+  config.animArchive = args.checkArg("--anim-archive");
   config.createBVH = args.checkArg("--bvh");
+  config.createCollision = args.checkArg("--collision");
+  config.compressMesh = args.checkArg("--compress-mesh");
+  config.instancing = args.checkArg("--instancing");
+
+  if(args.checkArg("--merge-static")) {
+    auto mergeSize = args.getStringArg("--merge-static");
+    config.mergeStaticSize = mergeSize.empty() ? 4.0f : std::stof(mergeSize);
+  }
+  if(args.checkArg("--pvs")) {
+    auto cellSize = args.getStringArg("--pvs");
+    config.pvsCellSize = cellSize.empty() ? 2.0f : std::stof(cellSize);
+  }
+  if(args.checkArg("--regions")) {
+    auto regionSize = args.getStringArg("--regions");
+    config.regionSize = regionSize.empty() ? 32.0f : std::stof(regionSize);
+  }
+  if(config.pvsCellSize > 0.0f && config.regionSize > 0.0f) {
+    // the PVS references objects of a single model, objects in regions are separate models
+    fprintf(stderr, "Error: '--pvs' can't be combined with '--regions'\n");
+    return 1;
+  }
+  if(args.checkArg("--anim-error")) {
+    float errorFactor = std::stof(args.getStringArg("--anim-error"));
+    config.animErrorBudget.translation *= errorFactor;
+    config.animErrorBudget.scale *= errorFactor;
+    config.animErrorBudget.rotation *= errorFactor;
+  }
   config.verbose = args.checkArg("--verbose");
 
+  if(args.checkArg("--cost-model")) {
+    T3DM::loadCostModel(args.getStringArg("--cost-model"), config.costModel);
+  }
+
   config.assetPath = args.getStringArg("--asset-path");
   if(config.assetPath.empty()) {
     config.assetPath = "assets/";
@@ -51,7 +98,7 @@ int main(int argc, char* argv[])
     printf("Asset path: %s (%s)\n", config.assetPath.c_str(), config.assetPathFull.c_str());
   }
 
-  config.animSampleRate = 60;
+  config.animSampleRate = args.getU32Arg("--anim-rate", 60);
 
   auto t3dm = T3DM::parseGLTF(gltfPath.c_str(), config);
   writeT3DM(config, t3dm, t3dmPath);
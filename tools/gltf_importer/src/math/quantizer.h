@@ -45,27 +45,45 @@ namespace Quantizer
   }
 
   /**
-   * Quantizes a quaternion into a 32bit integer.
-   * The smallest 3 components are stored and given 10 bits,
+   * Quantizes a quaternion with the "smallest three" method.
+   * The smallest 3 components are stored with 'bits' each,
    * with the 2 MSB being the index of the largest omitted component.
    */
-  inline uint32_t quatTo32Bit(const Quat &q)
+  inline uint64_t quatToBits(const Quat &q, uint32_t bits)
   {
     constexpr float rangeMin = -SQRT_2_INV;
     constexpr float rangeScale = SQRT_2_INV + SQRT_2_INV;
+    const double maxVal = (double)((1u << bits) - 1);
 
     auto qSq = q.toVec4() * q.toVec4();
     int largestIdx = qSq.getLargestIdx();
     float valNeg = q[largestIdx] >= 0 ? 1.0f : -1.0f;
 
-    int idx0 = (largestIdx + 1) % 4;
-    int idx1 = (largestIdx + 2) % 4;
-    int idx2 = (largestIdx + 3) % 4;
+    uint64_t res = largestIdx;
+    for(int i=1; i<4; ++i) {
+      float val = valNeg * q[(largestIdx + i) % 4];
+      uint64_t valQuant = (uint64_t)round(std::clamp((double)(val - rangeMin) / rangeScale, 0.0, 1.0) * maxVal);
+      res = (res << bits) | valQuant;
+    }
+    return res;
+  }
 
-    uint32_t q0 = floatToU10(valNeg * q[idx0], rangeMin, rangeScale);
-    uint32_t q1 = floatToU10(valNeg * q[idx1], rangeMin, rangeScale);
-    uint32_t q2 = floatToU10(valNeg * q[idx2], rangeMin, rangeScale);
+  // Inverse of 'quatToBits', matches the decoding done at runtime
+  inline Quat bitsToQuat(uint64_t value, uint32_t bits)
+  {
+    constexpr float rangeMin = -SQRT_2_INV;
+    constexpr float rangeScale = SQRT_2_INV + SQRT_2_INV;
+    const uint64_t mask = (1u << bits) - 1;
 
-    return (largestIdx << 30) | (q0 << 20) | (q1 << 10) | q2;
+    int largestIdx = (int)(value >> (bits * 3));
+    float res[4]{};
+    float sum = 0.0f;
+    for(int i=1; i<4; ++i) {
+      float val = (float)((value >> (bits * (3-i))) & mask) / (float)mask * rangeScale + rangeMin;
+      res[(largestIdx + i) % 4] = val;
+      sum += val * val;
+    }
+    res[largestIdx] = sqrtf(std::max(1.0f - sum, 0.0f));
+    return Quat{res[0], res[1], res[2], res[3]};
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,30 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+
+#include <fstream>
+#include "../lib/json.hpp"
+using json = nlohmann::json;
+
+void T3DM::loadCostModel(const std::string &path, CostModel &costModel)
+{
+  std::ifstream file{path};
+  if(!file.is_open()) {
+    fprintf(stderr, "Error: Cost-model file not found! (%s)\n", path.c_str());
+    throw std::runtime_error("Cost-model file not found!");
+  }
+
+  auto data = json::parse(file);
+  costModel.cmdBase       = data.value("cmdBase", costModel.cmdBase);
+  costModel.triDraw       = data.value("triDraw", costModel.triDraw);
+  costModel.seqBase       = data.value("seqBase", costModel.seqBase);
+  costModel.seqPerTri     = data.value("seqPerTri", costModel.seqPerTri);
+  costModel.stripBase     = data.value("stripBase", costModel.stripBase);
+  costModel.stripPerIndex = data.value("stripPerIndex", costModel.stripPerIndex);
+  costModel.stripPerByte  = data.value("stripPerByte", costModel.stripPerByte);
+  costModel.stripRestart  = data.value("stripRestart", costModel.stripRestart);
+  costModel.sync          = data.value("sync", costModel.sync);
+  costModel.dataByte      = data.value("dataByte", costModel.dataByte);
+}
@@ -3,6 +3,8 @@
 * @license MIT
 */
 #include "optimizer.h"
+#include <algorithm>
+#include <map>
 
 #include "bvh/v2/bvh.h"
 #include "bvh/v2/vec.h"
@@ -18,48 +20,160 @@ using Bvh     = bvh::v2::Bvh<Node>;
 
 namespace
 {
-  void writeBVHNode(std::vector<int16_t> &out, Node &node, int nodeIndex) {
-    // 'bounds' layout is [min_x, max_x, min_y, max_y, min_z, max_z]
-    // we need min/max as separate vectors
-    out.push_back((int16_t)node.bounds[0]);
-    out.push_back((int16_t)node.bounds[2]);
-    out.push_back((int16_t)node.bounds[4]);
-    out.push_back((int16_t)node.bounds[1]);
-    out.push_back((int16_t)node.bounds[3]);
-    out.push_back((int16_t)node.bounds[5]);
-
-    int dataCount = node.index.value & 0b1111;
-    int dataOffset = node.index.value >> 4;
-
-    if(dataCount == 0) {
-      int indexDiff = dataOffset - nodeIndex;
-      int16_t packedVal = (int16_t)(indexDiff << 4);
-      assert((packedVal >> 4) == indexDiff);
-      out.push_back(packedVal);
-    } else {
-      out.push_back(node.index.value);
+  constexpr uint32_t WIDE_CHILD_COUNT = 4;
+
+  /**
+   * Collects the children of a 4-wide node from a binary one.
+   * This is done by repeatedly replacing the largest inner child with its two children.
+   */
+  std::vector<size_t> collapseNode(const Bvh &bvh, size_t nodeIdx) {
+    const auto &node = bvh.nodes[nodeIdx];
+    if(node.is_leaf())return {nodeIdx}; // only possible for the root
+
+    std::vector<size_t> res{node.index.first_id(), node.index.first_id() + 1};
+    while(res.size() < WIDE_CHILD_COUNT) {
+      int bestChild = -1;
+      Scalar bestArea = -1;
+      for(int c=0; c<res.size(); ++c) {
+        const auto &child = bvh.nodes[res[c]];
+        if(child.is_leaf())continue;
+        Scalar area = child.get_bbox().get_half_area();
+        if(area > bestArea) {
+          bestArea = area;
+          bestChild = c;
+        }
+      }
+      if(bestChild < 0)break;
+
+      // keep the order of children, so objects in leafs stay in the same order as in the tree
+      size_t firstId = bvh.nodes[res[bestChild]].index.first_id();
+      res[bestChild] = firstId;
+      res.insert(res.begin() + bestChild + 1, firstId + 1);
     }
+    return res;
   }
 
-  void writeBVH(std::vector<int16_t> &out, Bvh &bvh) {
-    out.push_back(bvh.nodes.size());
-    out.push_back(bvh.prim_ids.size());
-    int nodeIndex = 0;
-    for(auto& node : bvh.nodes) {
-      writeBVHNode(out, node, nodeIndex++);
+  /**
+   * Collects all objects in the order they are reached when traversing the 4-wide tree depth-first.
+   * This way all objects of a sub-tree are in one continuous range.
+   */
+  void collectLeafData(
+    const Bvh &bvh, const std::vector<std::vector<size_t>> &wideNodes,
+    const std::unordered_map<size_t, size_t> &wideNodeIdx, size_t nodeIdx,
+    std::unordered_map<size_t, uint32_t> &leafDataStart, std::vector<size_t> &data
+  ) {
+    for(auto c : wideNodes[nodeIdx]) {
+      const auto &child = bvh.nodes[c];
+      if(child.is_leaf()) {
+        leafDataStart[c] = data.size();
+        for(size_t i=0; i<child.index.prim_count(); ++i) {
+          data.push_back(bvh.prim_ids[child.index.first_id() + i]);
+        }
+      } else {
+        collectLeafData(bvh, wideNodes, wideNodeIdx, wideNodeIdx.at(c), leafDataStart, data);
+      }
+    }
+  }
+
+  void writeWideNode(
+    BinaryFile &out, const Bvh &bvh, const std::vector<size_t> &children,
+    const std::unordered_map<size_t, uint32_t> &leafDataStart, uint32_t &nextNodeIdx
+  ) {
+    BBox bounds = BBox::make_empty();
+    for(auto c : children)bounds.extend(bvh.nodes[c].get_bbox());
+
+    // child bounds are stored as 8-bit values relative to the node, scaled by a power of two
+    int32_t origin[3];
+    uint8_t shift[3];
+    for(int i=0; i<3; ++i) {
+      origin[i] = (int32_t)floor(bounds.min[i]);
+      int32_t extent = (int32_t)ceil(bounds.max[i]) - origin[i];
+      shift[i] = 0;
+      while(((extent + (1 << shift[i]) - 1) >> shift[i]) > 0xFF)++shift[i];
     }
-    for(auto&& prim_id : bvh.prim_ids) {
-      out.push_back(prim_id);
+
+    uint8_t qMin[3][WIDE_CHILD_COUNT];
+    uint8_t qMax[3][WIDE_CHILD_COUNT];
+    uint16_t childIdx[WIDE_CHILD_COUNT]{};
+    uint8_t dataCount[WIDE_CHILD_COUNT]{};
+
+    for(uint32_t c=0; c<WIDE_CHILD_COUNT; ++c) {
+      if(c >= children.size()) {
+        for(int i=0; i<3; ++i) {
+          qMin[i][c] = 0xFF; // empty slot, inverted bounds
+          qMax[i][c] = 0;
+        }
+        continue;
+      }
+
+      const auto &child = bvh.nodes[children[c]];
+      auto bbox = child.get_bbox();
+      for(int i=0; i<3; ++i) {
+        int32_t relMin = (int32_t)floor(bbox.min[i]) - origin[i];
+        int32_t relMax = (int32_t)ceil(bbox.max[i]) - origin[i];
+        qMin[i][c] = (uint8_t)(relMin >> shift[i]);
+        qMax[i][c] = (uint8_t)((relMax + (1 << shift[i]) - 1) >> shift[i]);
+      }
+
+      if(child.is_leaf()) {
+        childIdx[c] = leafDataStart.at(children[c]);
+        dataCount[c] = child.index.prim_count();
+      } else {
+        childIdx[c] = nextNodeIdx++;
+      }
+    }
+
+    for(int i=0; i<3; ++i)out.write<int16_t>(origin[i]);
+    out.writeArray(shift, 3);
+    out.write<uint8_t>(children.size());
+    for(auto &axis : qMin)out.writeArray(axis, WIDE_CHILD_COUNT);
+    for(auto &axis : qMax)out.writeArray(axis, WIDE_CHILD_COUNT);
+    out.writeArray(childIdx, WIDE_CHILD_COUNT);
+    out.writeArray(dataCount, WIDE_CHILD_COUNT);
+    out.write<uint16_t>(0); // padding
+  }
+
+  void writeBVH(BinaryFile &out, const Bvh &bvh) {
+    // nodes are stored breadth-first, with the order of children matching the order of nodes
+    std::vector<std::vector<size_t>> wideNodes{};
+    std::vector<size_t> queue{0};
+    std::unordered_map<size_t, size_t> wideNodeIdx{}; // binary node -> wide node
+    for(size_t i=0; i<queue.size(); ++i) {
+      wideNodeIdx[queue[i]] = i;
+      wideNodes.push_back(collapseNode(bvh, queue[i]));
+      for(auto c : wideNodes.back()) {
+        if(!bvh.nodes[c].is_leaf())queue.push_back(c);
+      }
+    }
+
+    if(wideNodes.size() > 0xFFFF || bvh.prim_ids.size() > 0xFFFF) {
+      throw std::runtime_error("BVH too large (max. 65535 nodes/objects)!");
+    }
+
+    out.write<uint16_t>(wideNodes.size());
+    out.write<uint16_t>(bvh.prim_ids.size());
+
+    std::unordered_map<size_t, uint32_t> leafDataStart{};
+    std::vector<size_t> data{};
+    collectLeafData(bvh, wideNodes, wideNodeIdx, 0, leafDataStart, data);
+
+    uint32_t nextNodeIdx = 1;
+    for(auto &children : wideNodes) {
+      writeWideNode(out, bvh, children, leafDataStart, nextNodeIdx);
+    }
+    // object (chunk) indices, turned into pointers at runtime
+    for(auto primId : data) {
+      out.write<uint32_t>(primId);
     }
   }
 }
 
 /**
- * Creates a BVH of all object AABBs
- * The result is a list of 16bit ints encoding both nodes, indices and AABB extends
+ * Creates a 4-wide BVH of all object AABBs
+ * Child bounds are quantized to 8-bit relative to their parent node
  * @param modelChunks
  */
-std::vector<int16_t> T3DM::createMeshBVH(const std::vector<ModelChunked> &modelChunks)
+BinaryFile T3DM::createMeshBVH(const std::vector<ModelChunked> &modelChunks)
 {
   std::vector<BBox> aabbs;
   std::vector<BVec3> centers;
@@ -77,7 +191,130 @@ std::vector<int16_t> T3DM::createMeshBVH(const std::vector<ModelChunked> &modelC
   config.quality = bvh::v2::DefaultBuilder<Node>::Quality::High;
   auto bvh = bvh::v2::DefaultBuilder<Node>::build(thread_pool, aabbs, centers, config);
 
-  std::vector<int16_t> treeData;
-  writeBVH(treeData, bvh);
-  return treeData;
-}
\ No newline at end of file
+  BinaryFile res{};
+  writeBVH(res, bvh);
+  return res;
+}
+/**
+ * Creates a BVH over all (non-skinned) triangles used for collision queries at runtime.
+ * Triangles are reordered to match the leaves, so leaves directly reference a range of triangles.
+ * Vertices are de-duplicated and stored as s16 positions in model space.
+ * Objects moved into regions ('--regions') are included too, their triangles reference no object.
+ */
+BinaryFile T3DM::createCollisionBVH(
+  const Config &config, const std::vector<Model> &models, const std::vector<Model> &regionModels
+)
+{
+  struct CollTri {
+    uint16_t idx[3];
+    uint16_t objectIdx;
+  };
+
+  std::vector<std::array<int16_t, 3>> verts{};
+  std::map<std::array<int16_t, 3>, uint16_t> vertMap{};
+  std::vector<CollTri> tris{};
+  std::vector<BBox> aabbs;
+  std::vector<BVec3> centers;
+
+  auto getVertIdx = [&](const std::array<int16_t, 3> &pos) -> uint16_t {
+    auto it = vertMap.find(pos);
+    if(it != vertMap.end())return it->second;
+    if(verts.size() >= 0xFFFF) {
+      throw std::runtime_error("Too many collision vertices (max. 65535)!");
+    }
+    vertMap[pos] = verts.size();
+    verts.push_back(pos);
+    return verts.size() - 1;
+  };
+
+  auto addTriangle = [&](const std::array<int16_t, 3> (&pos)[3], uint16_t objectIdx) {
+    CollTri tri{{getVertIdx(pos[0]), getVertIdx(pos[1]), getVertIdx(pos[2])}, objectIdx};
+    if(tri.idx[0] == tri.idx[1] || tri.idx[1] == tri.idx[2] || tri.idx[0] == tri.idx[2])return;
+
+    BBox bbox = BBox::make_empty();
+    for(auto &p : pos)bbox.extend(BVec3(p[0], p[1], p[2]));
+    tris.push_back(tri);
+    aabbs.push_back(bbox);
+    centers.push_back(bbox.get_center());
+  };
+
+  auto addModel = [&](const Model &model, uint16_t objectIdx) {
+    std::vector<Mat4> instances = model.instances;
+    if(instances.empty())instances.push_back(Mat4{});
+
+    for(auto &tri : model.triangles)
+    {
+      if(tri.vert[0].boneIndex >= 0 || tri.vert[1].boneIndex >= 0 || tri.vert[2].boneIndex >= 0) {
+        continue; // skinned, not static
+      }
+
+      for(auto &mat : instances) {
+        std::array<int16_t, 3> pos[3];
+        for(int v=0; v<3; ++v) {
+          Vec3 p{(float)tri.vert[v].pos[0], (float)tri.vert[v].pos[1], (float)tri.vert[v].pos[2]};
+          if(!model.instances.empty()) {
+            p = (mat * (p / config.globalScale) * config.globalScale).round();
+          }
+          for(int i=0; i<3; ++i) {
+            pos[v][i] = (int16_t)std::clamp(p[i], -32768.0f, 32767.0f);
+          }
+        }
+        addTriangle(pos, objectIdx);
+      }
+    }
+  };
+
+  for(uint32_t m=0; m<models.size(); ++m) {
+    addModel(models[m], m);
+  }
+  for(auto &model : regionModels) {
+    addModel(model, COLL_OBJECT_REGION);
+  }
+
+  BinaryFile res{};
+  if(tris.empty())return res;
+
+  typename bvh::v2::DefaultBuilder<Node>::Config bvhConfig;
+  bvhConfig.quality = bvh::v2::DefaultBuilder<Node>::Quality::High;
+  // SAH on clusters of 4 triangles, a triangle test is cheap compared to fetching another node
+  bvhConfig.sah = bvh::v2::SplitHeuristic<Scalar>(2, 1.0);
+  bvhConfig.max_leaf_size = 8;
+  auto bvh = bvh::v2::DefaultBuilder<Node>::build(aabbs, centers, bvhConfig);
+
+  if(bvh.nodes.size() > 0xFFFF || tris.size() > 0xFFFF) {
+    throw std::runtime_error("Collision mesh too large (max. 65535 nodes/triangles)!");
+  }
+
+  res.write<uint16_t>(bvh.nodes.size());
+  res.write<uint16_t>(tris.size());
+  res.write<uint16_t>(verts.size());
+  res.write<uint16_t>(0);
+
+  for(auto &node : bvh.nodes) {
+    res.write<int16_t>((int16_t)node.bounds[0]);
+    res.write<int16_t>((int16_t)node.bounds[2]);
+    res.write<int16_t>((int16_t)node.bounds[4]);
+    res.write<int16_t>((int16_t)node.bounds[1]);
+    res.write<int16_t>((int16_t)node.bounds[3]);
+    res.write<int16_t>((int16_t)node.bounds[5]);
+    // inner nodes: index of the first child (second one follows), leaves: first triangle + count
+    res.write<uint16_t>(node.index.first_id());
+    res.write<uint16_t>(node.index.prim_count());
+  }
+
+  for(auto primId : bvh.prim_ids) {
+    auto &tri = tris[primId];
+    res.writeArray(tri.idx, 3);
+    res.write(tri.objectIdx);
+  }
+
+  for(auto &v : verts) {
+    res.writeArray(v.data(), 3);
+  }
+
+  if(config.verbose) {
+    printf("[Collision] Triangles: %ld, Vertices: %ld, Nodes: %ld, Size: %d bytes\n",
+      tris.size(), verts.size(), bvh.nodes.size(), res.getSize());
+  }
+  return res;
+}
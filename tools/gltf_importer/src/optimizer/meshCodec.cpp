@@ -0,0 +1,90 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+#include <chrono>
+#include <cstring>
+
+#include "../lib/meshopt/meshoptimizer.h"
+
+namespace {
+  constexpr uint32_t VERT_STRIDE = 16; // single vertex, see 'deinterleaveVertices'
+  constexpr uint32_t INDEX_STRIDE = 8;
+
+  // Vertices are stored in pairs (posA, normA, posB, normB, rgbaA, rgbaB, uvA, uvB),
+  // for better compression they are split up into single vertices first.
+  // The runtime decoder writes them back interleaved directly.
+  std::vector<uint8_t> deinterleaveVertices(const uint8_t* data, uint32_t size)
+  {
+    std::vector<uint8_t> res(size);
+    for(uint32_t p=0; p<size/32; ++p) {
+      const uint8_t* src = data + p*32;
+      for(int v=0; v<2; ++v) {
+        uint8_t* dst = res.data() + (p*2 + v) * VERT_STRIDE;
+        memcpy(dst,     src + v*8,      8); // pos + normal
+        memcpy(dst + 8, src + 16 + v*4, 4); // color
+        memcpy(dst + 12, src + 24 + v*4, 4); // UV
+      }
+    }
+    return res;
+  }
+
+  std::vector<uint8_t> encode(const std::vector<uint8_t> &data, uint32_t stride)
+  {
+    uint32_t count = data.size() / stride;
+    std::vector<uint8_t> res(meshopt_encodeVertexBufferBound(count, stride));
+    res.resize(meshopt_encodeVertexBuffer(res.data(), res.size(), data.data(), count, stride));
+    if(res.empty()) {
+      throw std::runtime_error("Failed to encode mesh data!");
+    }
+
+    // sanity check, the runtime uses a port of the same decoder
+    std::vector<uint8_t> check(data.size());
+    if(meshopt_decodeVertexBuffer(check.data(), count, stride, res.data(), res.size()) != 0 || check != data) {
+      throw std::runtime_error("Mesh data does not survive encoding!");
+    }
+    return res;
+  }
+}
+
+BinaryFile T3DM::encodeMeshChunk(const BinaryFile &chunkVerts, const BinaryFile &chunkIndices, bool verbose)
+{
+  if(chunkVerts.getSize() % 32 != 0) {
+    throw std::runtime_error("Vertex chunk must contain vertex pairs!");
+  }
+
+  auto vertData = deinterleaveVertices(chunkVerts.getData(), chunkVerts.getSize());
+
+  std::vector<uint8_t> indexData(chunkIndices.getData(), chunkIndices.getData() + chunkIndices.getSize());
+  indexData.resize((indexData.size() + INDEX_STRIDE - 1) & ~(INDEX_STRIDE - 1), 0);
+
+  auto vertEnc = encode(vertData, VERT_STRIDE);
+  auto indexEnc = indexData.empty() ? std::vector<uint8_t>{} : encode(indexData, INDEX_STRIDE);
+
+  BinaryFile res{};
+  res.write<uint32_t>(vertData.size() / VERT_STRIDE);
+  res.write<uint32_t>(chunkIndices.getSize());
+  res.write<uint32_t>(vertEnc.size());
+  res.write<uint32_t>(indexEnc.size());
+  res.writeArray(vertEnc.data(), vertEnc.size());
+  res.writeArray(indexEnc.data(), indexEnc.size());
+
+  if(verbose) {
+    // decode time on the host, only useful as a relative number
+    auto timeStart = std::chrono::high_resolution_clock::now();
+    meshopt_decodeVertexBuffer(vertData.data(), vertData.size() / VERT_STRIDE, VERT_STRIDE, vertEnc.data(), vertEnc.size());
+    if(!indexEnc.empty()) {
+      meshopt_decodeVertexBuffer(indexData.data(), indexData.size() / INDEX_STRIDE, INDEX_STRIDE, indexEnc.data(), indexEnc.size());
+    }
+    auto timeEnd = std::chrono::high_resolution_clock::now();
+    double timeUs = std::chrono::duration<double, std::micro>(timeEnd - timeStart).count();
+
+    printf("[Codec] Vertices: %d -> %ld bytes, Indices: %d -> %ld bytes (decode: %.2fus)\n",
+      chunkVerts.getSize(), vertEnc.size(),
+      chunkIndices.getSize(), indexEnc.size(),
+      timeUs
+    );
+  }
+  return res;
+}
@@ -5,14 +5,13 @@
 #include "optimizer.h"
 #include <algorithm>
 #include <array>
-
-#include "../lib/tristrip/tri_stripper.h"
+#include <map>
 
 // NOTE: mesh optimizations prior to chunking the model up are done in parser.cpp via 'meshopt_optimizeVertexCache'
 
 namespace {
-  typedef std::array<int8_t, 3> Tri;
-  typedef std::vector<Tri> TriList;
+  using T3DM::Tri;
+  using T3DM::TriList;
 
   bool triHasIndex(const Tri &tri, int idx) {
     return tri[0] == idx || tri[1] == idx || tri[2] == idx;
@@ -55,48 +54,6 @@ namespace {
     return res;
   }
 
-  // stripify the input triangle list into multiple strips
-  std::vector<std::vector<int8_t>> stripify(const TriList& tris, int vertexCount)
-  {
-    std::vector<std::vector<int8_t>> res{};
-    triangle_stripper::primitive_vector PrimitivesVector{};
-    std::vector<triangle_stripper::index> indices{};
-    for(auto &tri : tris) {
-      indices.push_back(tri[0]);
-      indices.push_back(tri[1]);
-      indices.push_back(tri[2]);
-    }
-    triangle_stripper::tri_stripper TriStripper(indices);
-
-		TriStripper.SetMinStripSize(2);
-		TriStripper.SetCacheSize(0);
-		TriStripper.SetBackwardSearch(false); // seems to be broken(?)
-		TriStripper.Strip(&PrimitivesVector);
-
-		for(auto &v : PrimitivesVector) {
-
-		  if(v.Type == triangle_stripper::primitive_type::TRIANGLES)  {
-		    for(int i=0; i<v.Indices.size(); i+=3) {
-		      res.push_back({(int8_t)v.Indices[i], (int8_t)v.Indices[i+1], (int8_t)v.Indices[i+2]});
-		    }
-      } else {
-        std::vector<int8_t> strip{};
-        for(auto idx : v.Indices) {
-          strip.push_back(idx);
-        }
-        res.push_back(strip);
-      }
-		}
-		// sort res by the highest index inside of the individual array
-		std::sort(res.begin(), res.end(), [](const std::vector<int8_t> &a, const std::vector<int8_t> &b) {
-      auto minA = *std::max_element(a.begin(), a.end());
-      auto minB = *std::max_element(b.begin(), b.end());
-      return minA < minB;
-    });
-
-		return res;
-  }
-
   std::vector<int8_t> destripify(const std::vector<int8_t> &strip)
   {
     std::vector<int8_t> res{};
@@ -146,57 +103,29 @@ namespace {
 
     return bestRes;
   }
-}
 
-void T3DM::optimizeModelChunk(const Config &config, ModelChunked &model)
-{
-  for(auto &chunk : model.chunks)
-  {
-    // avoid skinned mesh parts with bones, these use partial loads and indices
-    // which mess up the used index detection (@TODO: handle this)
-    if(chunk.boneCount > 0)continue;
-
-    // convert indices into split up triangles, then clear old indices
-    TriList tris{}; // input tris
-    {
-      auto &idx = chunk.indices;
-      for(int i=0; i<idx.size(); i+=3) {
-        // store rotated so that the smallest index always comes first
-        // this makes index sequence detection easier later on
-        int8_t smallest = std::min({idx[i+0], idx[i+1], idx[i+2]});
-        if(idx[i+0] == smallest) {
-          tris.push_back({idx[i+0], idx[i+1], idx[i+2]});
-        } else if(idx[i+1] == smallest) {
-          tris.push_back({idx[i+1], idx[i+2], idx[i+0]});
-        } else {
-          tris.push_back({idx[i+2], idx[i+0], idx[i+1]});
-        }
-      }
-    }
-    chunk.indices.clear();
+  // settings for a single candidate encoding of a part, see 'encodeChunk'
+  struct EncodeParams {
+    bool useSequence{false};
+    uint8_t stripBackend{T3DM::StripBackend::TRI_STRIPPER};
+    int maxStripCmds{0};      // 0 only emits regular triangles
+    int minStripIndices{7};   // stop emitting strip commands if less indices are left
+    int targetFreeVerts{2};   // vertex slots to free at the end of the cache before stripping
+  };
 
-    auto seq = extractSequenceTris(tris);
-    if(
-      // at least 3 triangles in a sequence to pay off the fixed-cost
-      seq.seqCount >= 3
-      // and must cut down a lot of tris not make strips worse
-      && (seq.tris.size() < (tris.size() / 2))
-    )
-    {
-      if(config.verbose) {
-        printf("Sequence:\n  Tris: ");
-        for(auto &tri : seq.tris) {
-          printf("%d %d %d | ", tri[0], tri[1], tri[2]);
-        }
-        printf("\n  Sequence start: %d, count: %d\n", seq.seqStart, seq.seqCount);
-      }
+  // stripifying is the slowest part, and many candidates share the same input triangles
+  typedef std::map<std::pair<uint8_t, TriList>, T3DM::StripList> StripCache;
 
+  void encodeChunk(
+    T3DM::MeshChunk &chunk, TriList tris, const SequenceRes &seq,
+    const EncodeParams &params, StripCache &stripCache
+  ) {
+    if(params.useSequence) {
       tris = seq.tris;
       chunk.seqStart = seq.seqStart;
       chunk.seqCount = seq.seqCount;
     }
 
-
     // writes out a single triangle (3 indices ina command, no DMAs)
     auto emitTri = [&chunk](const Tri &tri) {
       chunk.indices.push_back(tri[0]);
@@ -228,6 +157,11 @@ void T3DM::optimizeModelChunk(const Config &config, ModelChunked &model)
       }
     };
 
+    if(params.maxStripCmds == 0) {
+      for(auto &tri : tris)emitTri(tri);
+      return;
+    }
+
     // Strip encoding:
     // First we stripify the entire triangle array, resulting in an array of strips.
     // Since we have to fight with the vertex cache for DMEM, we need to make sure that the strips we write don't get too big.
@@ -238,11 +172,10 @@ void T3DM::optimizeModelChunk(const Config &config, ModelChunked &model)
     // check how many vertex slots we are free to use (end of the buffer)
     auto vertUsage = getVertexUsage(tris);
     int freeVertsEnd = countFreeVertsAtEnd(vertUsage);
-    int targetFreeVerts = 2;
 
     // now free until the last slots are free
-    if(freeVertsEnd < targetFreeVerts) {
-      for(int i=T3DM::MAX_VERTEX_COUNT-targetFreeVerts; i<T3DM::MAX_VERTEX_COUNT; ++i) {
+    if(freeVertsEnd < params.targetFreeVerts) {
+      for(int i=T3DM::MAX_VERTEX_COUNT-params.targetFreeVerts; i<T3DM::MAX_VERTEX_COUNT; ++i) {
         freeVertexUsage(i);
       }
       vertUsage = getVertexUsage(tris);
@@ -251,12 +184,17 @@ void T3DM::optimizeModelChunk(const Config &config, ModelChunked &model)
 
     int freeIndices = calcUsableIndices(freeVertsEnd);
 
-    auto stipChunks = stripify(tris, chunk.vertexCount);
+    auto cacheKey = std::make_pair(params.stripBackend, tris);
+    auto cacheIt = stripCache.find(cacheKey);
+    if(cacheIt == stripCache.end()) {
+      cacheIt = stripCache.emplace(cacheKey, T3DM::stripify(params.stripBackend, tris)).first;
+    }
+    auto stipChunks = cacheIt->second;
     std::reverse(stipChunks.begin(), stipChunks.end()); // puts larger indices first
 
     // don't do any fancy algorithms here, we want to prefer the first entries (larger indices) in order
     // to free up as much vertex space. meaning the next batch has way more space to work with
-    for(int s=0; s<4 && !stipChunks.empty(); ++s)
+    for(int s=0; s<params.maxStripCmds && !stipChunks.empty(); ++s)
     {
       // check if it makes sense to emit the strip
       // too few triangles are slower as strips than as regular triangles
@@ -264,15 +202,12 @@ void T3DM::optimizeModelChunk(const Config &config, ModelChunked &model)
       for(auto &strip : stipChunks) {
         totalStripIndices += strip.size();
       }
-      if(totalStripIndices < 7)break;
+      if(totalStripIndices < params.minStripIndices)break;
 
       // if there are enough indices, emit the strip
       for(size_t i=0; i<stipChunks.size(); ++i) {
         int size = (int)stipChunks[i].size()+1;
         if(freeIndices - size >= 0) {
-          /*printf("Emitting strip %d, space: %d: ", i, freeIndices);
-          for(auto idx : stipChunks[i])printf(" %d", idx);
-          printf("\n");*/
           freeIndices -= emitStrip(stipChunks[i], s);
           stipChunks.erase(stipChunks.begin() + i);
           --i;
@@ -282,15 +217,133 @@ void T3DM::optimizeModelChunk(const Config &config, ModelChunked &model)
       vertUsage = getVertexUsage(stipChunks);
       freeVertsEnd = countFreeVertsAtEnd(vertUsage);
       freeIndices = calcUsableIndices(freeVertsEnd);
-      //printf("strip indices: %d\n", chunk.stripIndices[s].size());
     }
 
     // if we have some triangles left, de-stripify them and emit regular triangles
-    if(!stipChunks.empty()) {
-      for(auto &strip : stipChunks) {
-        auto indices = destripify(strip);
-        chunk.indices.insert(chunk.indices.end(), indices.begin(), indices.end());
+    for(auto &strip : stipChunks) {
+      auto indices = destripify(strip);
+      chunk.indices.insert(chunk.indices.end(), indices.begin(), indices.end());
+    }
+  }
+
+  // Checks that each strip command fits into the free space at the end of the vertex cache.
+  // Regular triangles and sequences are drawn before any strip, so only vertices
+  // referenced by the current and any following strip command need to stay alive.
+  bool fitsIndexBudget(const T3DM::MeshChunk &chunk)
+  {
+    for(int s=0; s<4; ++s) {
+      if(chunk.stripIndices[s].empty())break;
+      std::array<int, T3DM::MAX_VERTEX_COUNT> usedVerts{};
+      for(int t=s; t<4; ++t) {
+        for(auto idx : chunk.stripIndices[t])++usedVerts[idx & 0x7FFF];
+      }
+      int freeIndices = calcUsableIndices(countFreeVertsAtEnd(usedVerts));
+      if((int)chunk.stripIndices[s].size()+1 > freeIndices)return false;
+    }
+    return true;
+  }
+
+  // Estimates the cost of drawing a part with the given encoding, see 'T3DM::CostModel'
+  float calcEncodingCost(const T3DM::CostModel &cm, const T3DM::MeshChunk &chunk)
+  {
+    float cost = (chunk.indices.size() / 3) * (cm.cmdBase + cm.triDraw);
+    cost += chunk.indices.size() * cm.dataByte;
+
+    if(chunk.seqCount != 0) {
+      cost += cm.cmdBase + cm.seqBase + chunk.seqCount * cm.seqPerTri;
+    }
+
+    bool hasStrips = false;
+    for(const auto &strip : chunk.stripIndices) {
+      if(strip.empty())break;
+      hasStrips = true;
+      int restarts = std::count_if(strip.begin(), strip.end(), [](int16_t idx) { return idx < 0; });
+      int byteSize = (strip.size() * 2 + 7) & ~7; // each strip is aligned to 8 bytes
+      cost += cm.cmdBase + cm.stripBase;
+      cost += strip.size() * cm.stripPerIndex;
+      cost += restarts * cm.stripRestart;
+      cost += byteSize * (cm.stripPerByte + cm.dataByte);
+    }
+
+    // the last strip command and sequences already sync, otherwise an extra command is needed
+    if(!hasStrips && chunk.seqCount == 0)cost += cm.cmdBase + cm.sync;
+    return cost;
+  }
+}
+
+void T3DM::optimizeModelChunk(const Config &config, ModelChunked &model, bool allowStrips)
+{
+  for(auto &chunk : model.chunks)
+  {
+    // avoid skinned mesh parts with bones, these use partial loads and indices
+    // which mess up the used index detection (@TODO: handle this)
+    if(chunk.boneCount > 0)continue;
+
+    // convert indices into split up triangles, then clear old indices
+    TriList tris{}; // input tris
+    {
+      auto &idx = chunk.indices;
+      for(int i=0; i<idx.size(); i+=3) {
+        // store rotated so that the smallest index always comes first
+        // this makes index sequence detection easier later on
+        int8_t smallest = std::min({idx[i+0], idx[i+1], idx[i+2]});
+        if(idx[i+0] == smallest) {
+          tris.push_back({idx[i+0], idx[i+1], idx[i+2]});
+        } else if(idx[i+1] == smallest) {
+          tris.push_back({idx[i+1], idx[i+2], idx[i+0]});
+        } else {
+          tris.push_back({idx[i+2], idx[i+0], idx[i+1]});
+        }
       }
     }
+    chunk.indices.clear();
+
+    auto seq = extractSequenceTris(tris);
+
+    // Instead of fixed thresholds, try out a set of encodings (triangles, sequences, strips)
+    // and keep the cheapest one according to the cost-model that also fits into DMEM.
+    // Plain triangles always fit, so there is always at least one valid result.
+    MeshChunk bestChunk{};
+    float bestCost = INFINITY;
+    StripCache stripCache{};
+    auto tryEncoding = [&](const EncodeParams &params) {
+      MeshChunk candidate = chunk;
+      encodeChunk(candidate, tris, seq, params, stripCache);
+      if(!fitsIndexBudget(candidate))return;
+
+      float cost = calcEncodingCost(config.costModel, candidate);
+      if(cost < bestCost) {
+        bestCost = cost;
+        bestChunk = std::move(candidate);
+      }
+    };
+
+    for(bool useSeq : {false, true}) {
+      if(useSeq && seq.seqCount == 0)break;
+      tryEncoding({.useSequence = useSeq});
+      if(!allowStrips)continue;
+
+      for(uint8_t backend=0; backend<StripBackend::COUNT; ++backend) {
+        for(int maxStripCmds=1; maxStripCmds<=4; ++maxStripCmds) {
+          for(int targetFreeVerts : {2, 4, 8}) {
+            for(int minStripIndices : {3, 7, 16}) {
+              tryEncoding({
+                .useSequence = useSeq,
+                .stripBackend = backend,
+                .maxStripCmds = maxStripCmds,
+                .minStripIndices = minStripIndices,
+                .targetFreeVerts = targetFreeVerts
+              });
+            }
+          }
+        }
+      }
+    }
+
+    chunk = std::move(bestChunk);
+
+    if(config.verbose && chunk.seqCount != 0) {
+      printf("Sequence: start: %d, count: %d (cost: %.2f)\n", chunk.seqStart, chunk.seqCount, bestCost);
+    }
   }
-}
\ No newline at end of file
+}
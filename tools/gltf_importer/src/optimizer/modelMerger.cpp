@@ -0,0 +1,103 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include "../parser/rdp.h"
+
+namespace {
+  struct ModelBounds {
+    int32_t min[3]{INT32_MAX, INT32_MAX, INT32_MAX};
+    int32_t max[3]{INT32_MIN, INT32_MIN, INT32_MIN};
+  };
+
+  ModelBounds getBounds(const T3DM::Model &model) {
+    ModelBounds res{};
+    for(auto &tri : model.triangles) {
+      for(auto &v : tri.vert) {
+        for(int i=0; i<3; ++i) {
+          res.min[i] = std::min(res.min[i], (int32_t)v.pos[i]);
+          res.max[i] = std::max(res.max[i], (int32_t)v.pos[i]);
+        }
+      }
+    }
+    return res;
+  }
+
+  bool canMerge(const T3DM::T3DMData &t3dm, const T3DM::Model &model) {
+    if(model.triangles.empty() || !model.instances.empty())return false;
+
+    // the draw order inside an object is fixed, keep transparent objects separate
+    auto mat = t3dm.materials.find(model.materialName);
+    if(mat == t3dm.materials.end() || mat->second.blendMode == RDP::BLEND::MULTIPLY)return false;
+
+    // skinned meshes are in bone space
+    for(auto &tri : model.triangles) {
+      for(auto &v : tri.vert) {
+        if(v.boneIndex >= 0)return false;
+      }
+    }
+    return true;
+  }
+}
+
+/**
+ * Merges small objects with the same material into one, if they are close to each other.
+ * Objects are put into a grid with cells half the size of the limit, based on their center.
+ * Only objects no larger than a cell are merged, so a merged object never exceeds the limit on any axis.
+ */
+void T3DM::mergeStaticModels(const Config &config, T3DMData &t3dm)
+{
+  const float cellSize = config.mergeStaticSize * config.globalScale * 0.5f;
+  if(cellSize < 1.0f)return;
+
+  typedef std::tuple<std::string, int32_t, int32_t, int32_t> CellKey;
+  std::map<CellKey, size_t> cellModel{}; // cell -> index of the merged model in 'res'
+  std::vector<Model> res{};
+  res.reserve(t3dm.models.size());
+
+  uint32_t mergeCount = 0;
+  for(auto &model : t3dm.models)
+  {
+    if(!canMerge(t3dm, model)) {
+      res.push_back(std::move(model));
+      continue;
+    }
+
+    auto bounds = getBounds(model);
+    int32_t cell[3];
+    bool isSmall = true;
+    for(int i=0; i<3; ++i) {
+      isSmall = isSmall && (float)(bounds.max[i] - bounds.min[i]) <= cellSize;
+      cell[i] = (int32_t)floorf((float)(bounds.min[i] + bounds.max[i]) * 0.5f / cellSize);
+    }
+    if(!isSmall) {
+      res.push_back(std::move(model));
+      continue;
+    }
+
+    CellKey key{model.materialName, cell[0], cell[1], cell[2]};
+    auto it = cellModel.find(key);
+    if(it == cellModel.end()) {
+      cellModel[key] = res.size();
+      res.push_back(std::move(model));
+      continue;
+    }
+
+    auto &target = res[it->second];
+    if(config.verbose) {
+      printf("[Merge] '%s' -> '%s' (%s)\n", model.name.c_str(), target.name.c_str(), model.materialName.c_str());
+    }
+    target.triangles.insert(target.triangles.end(), model.triangles.begin(), model.triangles.end());
+    ++mergeCount;
+  }
+
+  if(config.verbose) {
+    printf("[Merge] Objects: %ld -> %ld (merged: %d)\n", t3dm.models.size(), res.size(), mergeCount);
+  }
+  t3dm.models = std::move(res);
+}
@@ -4,10 +4,63 @@
 */
 
 #pragma once
+#include <array>
 #include "../structs.h"
 
 namespace T3DM
 {
-  void optimizeModelChunk(const Config &config, ModelChunked &model);
-  std::vector<int16_t> createMeshBVH(const std::vector<ModelChunked> &modelChunks);
+  namespace StripBackend {
+    constexpr uint8_t TRI_STRIPPER = 0;
+    constexpr uint8_t MESHOPT      = 1;
+    constexpr uint8_t GREEDY       = 2;
+
+    constexpr uint8_t COUNT = 3;
+  }
+
+  typedef std::array<int8_t, 3> Tri;
+  typedef std::vector<Tri> TriList;
+  typedef std::vector<std::vector<int8_t>> StripList;
+
+  /**
+   * Turns a triangle list into separate strips (no degenerate triangles).
+   * Each strip starts with the winding order of a regular triangle.
+   * Triangles that could not be connected are returned as a strip with 3 indices.
+   */
+  StripList stripify(uint8_t backend, const TriList &tris);
+
+  /**
+   * Merges small, close-by objects sharing a material ('--merge-static').
+   * Transparent, skinned and instanced objects are never merged.
+   */
+  void mergeStaticModels(const Config &config, T3DMData &t3dm);
+
+  /**
+   * Picks the cheapest index encoding for each part of a model.
+   * Strips can be disabled for instanced objects, which are drawn with an instanced vertex-load.
+   */
+  void optimizeModelChunk(const Config &config, ModelChunked &model, bool allowStrips = true);
+  BinaryFile createMeshBVH(const std::vector<ModelChunked> &modelChunks);
+  BinaryFile createCollisionBVH(
+    const Config &config, const std::vector<Model> &models, const std::vector<Model> &regionModels = {}
+  );
+
+  /**
+   * Creates a potentially-visible-set ('--pvs') over a grid of cells covering the model.
+   * Visibility is sampled with random rays against all static triangles.
+   */
+  BinaryFile createPVS(const Config &config, const std::vector<Model> &models);
+
+  /**
+   * Moves all static objects into regions of a grid ('--regions') based on their center.
+   * Skinned and instanced objects stay in 't3dm', each region only contains the materials it uses.
+   * The moved objects are kept in 't3dm.regionModels' so the resident collision still covers the whole level.
+   */
+  std::vector<T3DMData> splitRegions(const Config &config, T3DMData &t3dm);
+  void loadCostModel(const std::string &path, CostModel &costModel);
+
+  /**
+   * Encodes the vertex and index chunk into a single compressed chunk ('Z').
+   * Uses meshoptimizer's vertex codec, decoded at runtime in 't3d_model_load'.
+   */
+  BinaryFile encodeMeshChunk(const BinaryFile &chunkVerts, const BinaryFile &chunkIndices, bool verbose);
 }
\ No newline at end of file
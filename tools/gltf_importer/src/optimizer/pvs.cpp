@@ -0,0 +1,263 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <random>
+#include <thread>
+
+#include "bvh/v2/bvh.h"
+#include "bvh/v2/vec.h"
+#include "bvh/v2/ray.h"
+#include "bvh/v2/node.h"
+#include "bvh/v2/tri.h"
+#include "bvh/v2/stack.h"
+#include "bvh/v2/default_builder.h"
+
+namespace
+{
+  using Scalar  = float;
+  using BVec3   = bvh::v2::Vec<Scalar, 3>;
+  using BBox    = bvh::v2::BBox<Scalar, 3>;
+  using BTri    = bvh::v2::Tri<Scalar, 3>;
+  using PreTri  = bvh::v2::PrecomputedTri<Scalar>;
+  using Node    = bvh::v2::Node<Scalar, 3>;
+  using Bvh     = bvh::v2::Bvh<Node>;
+  using Ray     = bvh::v2::Ray<Scalar, 3>;
+
+  constexpr uint32_t MAX_CELL_COUNT = 0x4000;
+  constexpr uint32_t RAYS_PER_OBJECT = 128; // max. rays per cell and object, stops at the first visible one
+
+  struct PVSObject {
+    std::vector<BTri> tris{};
+    std::vector<float> areaSum{}; // running sum of triangle areas, used to pick random points
+    BBox bbox{BBox::make_empty()};
+    bool alwaysVisible{false};
+  };
+
+  struct PVSScene {
+    std::vector<PVSObject> objects{};
+    std::vector<PreTri> tris{};
+    std::vector<uint16_t> triObject{};
+    Bvh bvh{};
+  };
+
+  BVec3 randomPointInTri(const BTri &tri, std::mt19937 &rng) {
+    std::uniform_real_distribution<Scalar> dist{0.0f, 1.0f};
+    Scalar u = dist(rng);
+    Scalar v = dist(rng);
+    if(u + v > 1.0f) {
+      u = 1.0f - u;
+      v = 1.0f - v;
+    }
+    return tri.p0 + (tri.p1 - tri.p0) * u + (tri.p2 - tri.p0) * v;
+  }
+
+  BVec3 randomPointOnObject(const PVSObject &obj, std::mt19937 &rng) {
+    std::uniform_real_distribution<Scalar> dist{0.0f, obj.areaSum.back()};
+    auto it = std::lower_bound(obj.areaSum.begin(), obj.areaSum.end(), dist(rng));
+    size_t triIdx = std::min((size_t)(it - obj.areaSum.begin()), obj.tris.size() - 1);
+    return randomPointInTri(obj.tris[triIdx], rng);
+  }
+
+  /**
+   * Checks if a point on 'objectIdx' can be seen from 'from'.
+   * Hits on the object itself are ignored, since that would still mean the object is visible.
+   */
+  bool isPointVisible(const PVSScene &scene, const BVec3 &from, const BVec3 &to, uint32_t objectIdx) {
+    BVec3 dir = to - from;
+    Scalar len = bvh::v2::length(dir);
+    if(len < 1.0f)return true;
+
+    Ray ray{from, dir * (1.0f / len), 0.0f, len - 0.5f};
+    bvh::v2::SmallStack<Bvh::Index, 64> stack;
+    bool occluded = false;
+    scene.bvh.intersect<true, false>(ray, scene.bvh.get_root().index, stack, [&](size_t begin, size_t end) {
+      for(size_t i=begin; i<end; ++i) {
+        size_t triIdx = scene.bvh.prim_ids[i];
+        if(scene.triObject[triIdx] == objectIdx)continue;
+        Ray rayTest = ray;
+        if(scene.tris[triIdx].intersect(rayTest)) {
+          occluded = true;
+          return true;
+        }
+      }
+      return false;
+    });
+    return !occluded;
+  }
+
+  bool isObjectVisible(const PVSScene &scene, const BBox &cell, uint32_t objectIdx, std::mt19937 &rng) {
+    const auto &obj = scene.objects[objectIdx];
+    if(obj.alwaysVisible)return true;
+    if(obj.tris.empty())return false;
+
+    // objects touching the cell are always visible
+    bool overlaps = true;
+    for(int i=0; i<3; ++i) {
+      overlaps = overlaps && obj.bbox.min[i] <= cell.max[i] && obj.bbox.max[i] >= cell.min[i];
+    }
+    if(overlaps)return true;
+
+    std::uniform_real_distribution<Scalar> dist{0.0f, 1.0f};
+    for(uint32_t r=0; r<RAYS_PER_OBJECT; ++r) {
+      BVec3 from{};
+      for(int i=0; i<3; ++i)from[i] = cell.min[i] + (cell.max[i] - cell.min[i]) * dist(rng);
+      if(isPointVisible(scene, from, randomPointOnObject(obj, rng), objectIdx))return true;
+    }
+    return false;
+  }
+}
+
+/**
+ * Creates a potentially-visible-set (PVS) over a uniform grid of cells.
+ * For each cell and object, random rays between the two are tested against all static triangles.
+ * Each cell then references a bitset of visible objects, identical bitsets are shared.
+ * Skinned objects are never used as occluders and are always visible.
+ */
+BinaryFile T3DM::createPVS(const Config &config, const std::vector<Model> &models)
+{
+  BinaryFile res{};
+  if(models.empty())return res;
+  if(models.size() > 0xFFFF) {
+    throw std::runtime_error("Too many objects for a PVS (max. 65535)!");
+  }
+
+  PVSScene scene{};
+  std::vector<BBox> aabbs;
+  std::vector<BVec3> centers;
+  BBox sceneBBox = BBox::make_empty();
+
+  for(uint32_t m=0; m<models.size(); ++m)
+  {
+    auto &model = models[m];
+    auto &obj = scene.objects.emplace_back();
+    std::vector<Mat4> instances = model.instances;
+    if(instances.empty())instances.push_back(Mat4{});
+
+    for(auto &tri : model.triangles)
+    {
+      if(tri.vert[0].boneIndex >= 0 || tri.vert[1].boneIndex >= 0 || tri.vert[2].boneIndex >= 0) {
+        obj.alwaysVisible = true; // skinned, can move anywhere
+        continue;
+      }
+
+      for(auto &mat : instances) {
+        BVec3 pos[3];
+        for(int v=0; v<3; ++v) {
+          Vec3 p{(float)tri.vert[v].pos[0], (float)tri.vert[v].pos[1], (float)tri.vert[v].pos[2]};
+          if(!model.instances.empty()) {
+            p = (mat * (p / config.globalScale) * config.globalScale).round();
+          }
+          pos[v] = BVec3(p[0], p[1], p[2]);
+        }
+
+        BTri t{pos[0], pos[1], pos[2]};
+        Scalar area = bvh::v2::length(bvh::v2::cross(t.p1 - t.p0, t.p2 - t.p0)) * 0.5f;
+        if(area <= 0.0f)continue;
+
+        obj.tris.push_back(t);
+        obj.areaSum.push_back((obj.areaSum.empty() ? 0.0f : obj.areaSum.back()) + area);
+        obj.bbox.extend(t.get_bbox());
+
+        scene.tris.emplace_back(t);
+        scene.triObject.push_back(m);
+        aabbs.push_back(t.get_bbox());
+        centers.push_back(t.get_center());
+      }
+    }
+    if(!obj.tris.empty())sceneBBox.extend(obj.bbox);
+  }
+
+  if(scene.tris.empty())return res;
+
+  typename bvh::v2::DefaultBuilder<Node>::Config bvhConfig;
+  bvhConfig.quality = bvh::v2::DefaultBuilder<Node>::Quality::High;
+  scene.bvh = bvh::v2::DefaultBuilder<Node>::build(aabbs, centers, bvhConfig);
+
+  // grid setup, if there would be too many cells the size is increased
+  Scalar cellSize = std::max(std::round(config.pvsCellSize * config.globalScale), 1.0f);
+  uint32_t cellCount[3];
+  for(;;) {
+    for(int i=0; i<3; ++i) {
+      cellCount[i] = std::max((uint32_t)std::ceil((sceneBBox.max[i] - sceneBBox.min[i]) / cellSize), 1u);
+    }
+    if(cellCount[0] * cellCount[1] * cellCount[2] <= MAX_CELL_COUNT)break;
+    cellSize *= 2.0f;
+    printf("[PVS] Warning: too many cells, increasing cell size to %.0f\n", cellSize);
+  }
+  if(cellSize > 0xFFFF) {
+    throw std::runtime_error("PVS cell size too large!");
+  }
+
+  int16_t origin[3];
+  for(int i=0; i<3; ++i)origin[i] = (int16_t)std::floor(sceneBBox.min[i]);
+
+  uint32_t totalCells = cellCount[0] * cellCount[1] * cellCount[2];
+  uint32_t rowSize = (models.size() + 7) / 8;
+  std::vector<std::vector<uint8_t>> cellBits(totalCells, std::vector<uint8_t>(rowSize, 0));
+
+  // each cell is independent, and uses its own deterministic random sequence
+  std::atomic<uint32_t> nextCell{0};
+  auto worker = [&]() {
+    for(uint32_t c = nextCell++; c < totalCells; c = nextCell++) {
+      uint32_t cellPos[3] = {c % cellCount[0], (c / cellCount[0]) % cellCount[1], c / (cellCount[0] * cellCount[1])};
+      BBox cell = BBox::make_empty();
+      for(int i=0; i<3; ++i) {
+        cell.min[i] = origin[i] + cellPos[i] * cellSize;
+        cell.max[i] = cell.min[i] + cellSize;
+      }
+
+      std::mt19937 rng{c};
+      for(uint32_t o=0; o<scene.objects.size(); ++o) {
+        if(isObjectVisible(scene, cell, o, rng)) {
+          cellBits[c][o / 8] |= 1 << (o % 8);
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads{};
+  uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+  for(uint32_t t=0; t<threadCount; ++t)threads.emplace_back(worker);
+  for(auto &t : threads)t.join();
+
+  // identical cells share the same row of bits
+  std::unordered_map<std::string, uint16_t> rowMap{};
+  std::vector<uint16_t> cellRows{};
+  std::vector<const std::vector<uint8_t>*> rows{};
+  for(auto &bits : cellBits) {
+    auto [it, isNew] = rowMap.try_emplace(std::string(bits.begin(), bits.end()), rows.size());
+    if(isNew) {
+      if(rows.size() >= 0xFFFF) {
+        throw std::runtime_error("Too many unique PVS cells (max. 65535)!");
+      }
+      rows.push_back(&bits);
+    }
+    cellRows.push_back(it->second);
+  }
+
+  res.writeArray(origin, 3);
+  res.write<uint16_t>((uint16_t)cellSize);
+  for(auto count : cellCount)res.write<uint16_t>(count);
+  res.write<uint16_t>(models.size());
+  res.write<uint16_t>(rowSize);
+  res.write<uint16_t>(rows.size());
+  for(auto row : cellRows)res.write(row);
+  res.align(4);
+  for(auto row : rows)res.writeArray(row->data(), row->size());
+
+  if(config.verbose) {
+    uint64_t visibleSum = 0;
+    for(auto &bits : cellBits) {
+      for(auto b : bits)visibleSum += std::popcount(b);
+    }
+    printf("[PVS] Cells: %dx%dx%d (size: %.0f), unique: %ld, avg. visible: %.1f/%ld, Size: %d bytes\n",
+      cellCount[0], cellCount[1], cellCount[2], cellSize, rows.size(),
+      (double)visibleSum / totalCells, models.size(), res.getSize());
+  }
+  return res;
+}
@@ -0,0 +1,83 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <map>
+
+namespace {
+  bool isStatic(const T3DM::Model &model) {
+    if(model.triangles.empty() || !model.instances.empty())return false;
+    for(auto &tri : model.triangles) {
+      for(auto &v : tri.vert) {
+        if(v.boneIndex >= 0)return false;
+      }
+    }
+    return true;
+  }
+
+  void copyMaterial(const T3DM::T3DMData &src, T3DM::T3DMData &dst, const std::string &name) {
+    auto mat = src.materials.find(name);
+    if(mat != src.materials.end())dst.materials[name] = mat->second;
+  }
+}
+
+/**
+ * Splits a level into a grid of regions, objects are assigned by the center of their bounds.
+ * Objects are never split, so regions can overlap by the size of their largest object.
+ * The original order of objects (sorted by material) is kept within each region.
+ */
+std::vector<T3DM::T3DMData> T3DM::splitRegions(const Config &config, T3DMData &t3dm)
+{
+  float cellSize = std::max(std::round(config.regionSize * config.globalScale), 1.0f);
+
+  std::vector<T3DMData> regions{};
+  std::map<std::array<int32_t, 3>, uint32_t> cellMap{};
+  T3DMData resident{};
+
+  for(auto &model : t3dm.models)
+  {
+    T3DMData *target = &resident;
+    if(isStatic(model)) {
+      int32_t min[3]{INT32_MAX, INT32_MAX, INT32_MAX};
+      int32_t max[3]{INT32_MIN, INT32_MIN, INT32_MIN};
+      for(auto &tri : model.triangles) {
+        for(auto &v : tri.vert) {
+          for(int i=0; i<3; ++i) {
+            min[i] = std::min(min[i], (int32_t)v.pos[i]);
+            max[i] = std::max(max[i], (int32_t)v.pos[i]);
+          }
+        }
+      }
+
+      std::array<int32_t, 3> cell{};
+      for(int i=0; i<3; ++i) {
+        cell[i] = (int32_t)std::floor((min[i] + max[i]) * 0.5f / cellSize);
+      }
+      auto [it, isNew] = cellMap.try_emplace(cell, regions.size());
+      if(isNew)regions.emplace_back();
+      target = &regions[it->second];
+    }
+
+    target->models.push_back(model);
+    copyMaterial(t3dm, *target, model.materialName);
+    if(target != &resident)resident.regionModels.push_back(model);
+  }
+
+  if(regions.size() > 0xFFFF) {
+    throw std::runtime_error("Too many regions (max. 65535)!");
+  }
+
+  t3dm.models = resident.models;
+  t3dm.materials = resident.materials;
+  t3dm.regionModels = resident.regionModels;
+
+  if(config.verbose) {
+    printf("[Regions] Cell size: %.0f, regions: %ld, resident objects: %ld\n",
+      cellSize, regions.size(), t3dm.models.size());
+  }
+  return regions;
+}
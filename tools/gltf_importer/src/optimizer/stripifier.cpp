@@ -0,0 +1,263 @@
+/**
+* @copyright 2025 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+#include <algorithm>
+#include <map>
+
+#include "../lib/tristrip/tri_stripper.h"
+#include "../lib/meshopt/meshoptimizer.h"
+
+namespace {
+  using T3DM::Tri;
+  using T3DM::TriList;
+  using T3DM::StripList;
+
+  bool isDegenerate(const Tri &tri) {
+    return tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2];
+  }
+
+  // returns the directed edge the next triangle must contain to continue the strip
+  std::pair<int8_t, int8_t> getOpenEdge(const std::vector<int8_t> &strip) {
+    auto n = strip.size();
+    // triangles at odd positions are flipped, so the edge is too
+    return (n % 2 == 0)
+      ? std::pair{strip[n-2], strip[n-1]}
+      : std::pair{strip[n-1], strip[n-2]};
+  }
+
+  // returns the vertex to append if 'tri' contains the directed edge, otherwise -1
+  int getEdgeContinuation(const Tri &tri, std::pair<int8_t, int8_t> edge) {
+    for(int i=0; i<3; ++i) {
+      if(tri[i] == edge.first && tri[(i+1) % 3] == edge.second)return tri[(i+2) % 3];
+    }
+    return -1;
+  }
+
+  // tries to append a triangle to a strip, a strip with only one triangle may get rotated for that
+  bool tryAppend(std::vector<int8_t> &strip, const Tri &tri) {
+    int rotations = strip.size() == 3 ? 3 : 1;
+    for(int r=0; r<rotations; ++r) {
+      int next = getEdgeContinuation(tri, getOpenEdge(strip));
+      if(next >= 0) {
+        strip.push_back((int8_t)next);
+        return true;
+      }
+      if(rotations > 1)std::rotate(strip.begin(), strip.begin()+1, strip.end());
+    }
+    return false;
+  }
+
+  // converts a triangle list (in order) into strips, ignoring degenerate triangles
+  void appendTriangles(const TriList &tris, StripList &res) {
+    std::vector<int8_t> strip{};
+    for(auto &tri : tris) {
+      if(isDegenerate(tri))continue;
+      if(!strip.empty() && tryAppend(strip, tri))continue;
+      if(!strip.empty())res.push_back(strip);
+      strip = {tri[0], tri[1], tri[2]};
+    }
+    if(!strip.empty())res.push_back(strip);
+  }
+
+  // returns the triangles of a strip in order, with the winding order restored
+  TriList unpackStrip(const std::vector<uint32_t> &strip) {
+    TriList res{};
+    for(size_t i=0; i+2<strip.size(); ++i) {
+      if(i % 2 == 0) {
+        res.push_back({(int8_t)strip[i], (int8_t)strip[i+1], (int8_t)strip[i+2]});
+      } else {
+        res.push_back({(int8_t)strip[i+2], (int8_t)strip[i+1], (int8_t)strip[i]});
+      }
+    }
+    return res;
+  }
+
+  StripList stripifyTriStripper(const TriList &tris)
+  {
+    StripList res{};
+    triangle_stripper::primitive_vector PrimitivesVector{};
+    std::vector<triangle_stripper::index> indices{};
+    for(auto &tri : tris) {
+      indices.push_back(tri[0]);
+      indices.push_back(tri[1]);
+      indices.push_back(tri[2]);
+    }
+    triangle_stripper::tri_stripper TriStripper(indices);
+
+    TriStripper.SetMinStripSize(2);
+    TriStripper.SetCacheSize(0);
+    TriStripper.SetBackwardSearch(false); // seems to be broken(?)
+    TriStripper.Strip(&PrimitivesVector);
+
+    for(auto &v : PrimitivesVector) {
+      if(v.Type == triangle_stripper::primitive_type::TRIANGLES)  {
+        for(int i=0; i<v.Indices.size(); i+=3) {
+          res.push_back({(int8_t)v.Indices[i], (int8_t)v.Indices[i+1], (int8_t)v.Indices[i+2]});
+        }
+      } else {
+        std::vector<int8_t> strip{};
+        for(auto idx : v.Indices) {
+          strip.push_back(idx);
+        }
+        res.push_back(strip);
+      }
+    }
+    return res;
+  }
+
+  StripList stripifyMeshopt(const TriList &tris)
+  {
+    if(tris.empty())return {};
+    constexpr uint32_t RESTART_IDX = ~0u;
+    std::vector<uint32_t> indices{};
+    uint32_t vertexCount = 0;
+    for(auto &tri : tris) {
+      for(auto idx : tri) {
+        indices.push_back(idx);
+        vertexCount = std::max(vertexCount, (uint32_t)idx + 1);
+      }
+    }
+
+    std::vector<uint32_t> stripData(meshopt_stripifyBound(indices.size()));
+    stripData.resize(meshopt_stripify(
+      stripData.data(), indices.data(), indices.size(), vertexCount, RESTART_IDX
+    ));
+
+    // meshopt uses degenerate triangles to swap the winding order inside a strip,
+    // which is not supported by the ucode, so split up those strips again
+    StripList res{};
+    std::vector<uint32_t> strip{};
+    stripData.push_back(RESTART_IDX);
+    for(auto idx : stripData) {
+      if(idx != RESTART_IDX) {
+        strip.push_back(idx);
+        continue;
+      }
+      appendTriangles(unpackStrip(strip), res);
+      strip.clear();
+    }
+    return res;
+  }
+
+  /**
+   * Greedy strip builder tuned for the restart-index and vertex-cache setup of the ucode.
+   * Strips are started at triangles with the fewest free neighbours (fewer restarts later on),
+   * ties are broken by preferring triangles with larger indices.
+   * Since strips with large indices are emitted first, this frees up vertex slots as early as possible.
+   * Each start is tried in all 3 rotations, the longest resulting strip is kept.
+   */
+  StripList stripifyGreedy(const TriList &tris)
+  {
+    StripList res{};
+    std::vector<bool> used(tris.size(), false);
+    std::multimap<std::pair<int8_t, int8_t>, uint32_t> edgeMap{}; // directed edge -> triangle
+
+    for(uint32_t t=0; t<tris.size(); ++t) {
+      if(isDegenerate(tris[t])) {
+        used[t] = true;
+        continue;
+      }
+      for(int i=0; i<3; ++i) {
+        edgeMap.insert({{tris[t][i], tris[t][(i+1) % 3]}, t});
+      }
+    }
+
+    auto getMaxIndex = [&](uint32_t t) {
+      return std::max({tris[t][0], tris[t][1], tris[t][2]});
+    };
+
+    // amount of unused triangles that could directly continue a strip from this one
+    auto getFreeNeighbours = [&](uint32_t t) {
+      int count = 0;
+      for(int i=0; i<3; ++i) {
+        auto range = edgeMap.equal_range({tris[t][(i+1) % 3], tris[t][i]});
+        for(auto it = range.first; it != range.second; ++it) {
+          if(!used[it->second])++count;
+        }
+      }
+      return count;
+    };
+
+    // follows the open edge of the strip until no unused triangle continues it
+    auto extendStrip = [&](std::vector<int8_t> &strip, std::vector<uint32_t> &stripTris) {
+      for(;;) {
+        auto range = edgeMap.equal_range(getOpenEdge(strip));
+        int bestTri = -1;
+        int bestNeighbours = 0;
+        for(auto it = range.first; it != range.second; ++it) {
+          uint32_t t = it->second;
+          if(used[t] || std::find(stripTris.begin(), stripTris.end(), t) != stripTris.end())continue;
+          int neighbours = getFreeNeighbours(t);
+          if(bestTri < 0 || neighbours < bestNeighbours) {
+            bestTri = (int)t;
+            bestNeighbours = neighbours;
+          }
+        }
+        if(bestTri < 0)return;
+
+        strip.push_back((int8_t)getEdgeContinuation(tris[bestTri], getOpenEdge(strip)));
+        stripTris.push_back(bestTri);
+      }
+    };
+
+    for(;;)
+    {
+      int startTri = -1;
+      int startNeighbours = 0;
+      for(uint32_t t=0; t<tris.size(); ++t) {
+        if(used[t])continue;
+        int neighbours = getFreeNeighbours(t);
+        if(startTri < 0 || neighbours < startNeighbours ||
+          (neighbours == startNeighbours && getMaxIndex(t) > getMaxIndex(startTri))
+        ) {
+          startTri = (int)t;
+          startNeighbours = neighbours;
+        }
+      }
+      if(startTri < 0)break;
+
+      std::vector<int8_t> bestStrip{};
+      std::vector<uint32_t> bestStripTris{};
+      const auto &tri = tris[startTri];
+      for(int r=0; r<3; ++r) {
+        std::vector<int8_t> strip{tri[r], tri[(r+1) % 3], tri[(r+2) % 3]};
+        std::vector<uint32_t> stripTris{(uint32_t)startTri};
+        extendStrip(strip, stripTris);
+        if(strip.size() > bestStrip.size()) {
+          bestStrip = strip;
+          bestStripTris = stripTris;
+        }
+      }
+
+      for(auto t : bestStripTris)used[t] = true;
+      res.push_back(bestStrip);
+    }
+
+    // keep degenerate triangles as they are to not change the output
+    for(auto &tri : tris) {
+      if(isDegenerate(tri))res.push_back({tri[0], tri[1], tri[2]});
+    }
+    return res;
+  }
+}
+
+T3DM::StripList T3DM::stripify(uint8_t backend, const TriList &tris)
+{
+  StripList res{};
+  switch(backend) {
+    case StripBackend::TRI_STRIPPER: res = stripifyTriStripper(tris); break;
+    case StripBackend::MESHOPT:      res = stripifyMeshopt(tris);     break;
+    case StripBackend::GREEDY:       res = stripifyGreedy(tris);      break;
+    default: throw std::runtime_error("Invalid strip backend!");
+  }
+
+  // sort res by the highest index inside of the individual array
+  std::sort(res.begin(), res.end(), [](const std::vector<int8_t> &a, const std::vector<int8_t> &b) {
+    auto maxA = *std::max_element(a.begin(), a.end());
+    auto maxB = *std::max_element(b.begin(), b.end());
+    return maxA < maxB;
+  });
+  return res;
+}
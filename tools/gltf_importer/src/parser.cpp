@@ -20,6 +20,7 @@
 
 #include "parser/rdp.h"
 #include "converter/converter.h"
+#include "optimizer/optimizer.h"
 
 void printBoneTree(const T3DM::Bone &bone, int depth)
 {
@@ -144,15 +145,25 @@ T3DM::T3DMData T3DM::parseGLTF(const char *gltfPath, const T3DM::Config &config)
   // Animations
   //printf("Animations: %d\n", data->animations_count);
 
-  for(int i=0; i<data->animations_count; ++i) {
+  for(int i=0; i<data->animations_count && !config.ignoreAnimations; ++i) {
     auto anim = parseAnimation(data->animations[i], boneMap, config.animSampleRate, config.globalScale);
     if(anim.duration < 0.0001f)continue; // ignore empty animations
-    convertAnimation(anim, boneMap);
+    convertAnimation(config, anim, boneMap);
     t3dm.animations.push_back(anim);
   }
 
-  // Meshes
-  for(int i=0; i<data->nodes_count; ++i)
+  // Instancing: meshes referenced by multiple (non-skinned) nodes are only converted once,
+  // each node then only adds its transform to the models of the first one
+  std::unordered_map<const cgltf_mesh*, uint32_t> meshUseCount{};
+  std::unordered_map<const cgltf_mesh*, std::vector<size_t>> meshModels{};
+  if(config.instancing) {
+    for(int i=0; i<data->nodes_count; ++i) {
+      if(data->nodes[i].mesh && !data->nodes[i].skin)++meshUseCount[data->nodes[i].mesh];
+    }
+  }
+
+  // Meshes, an animation library only contains the skeleton and animations
+  for(int i=0; i<data->nodes_count && !config.animLibrary; ++i)
   {
     auto node = &data->nodes[i];
     //printf("- Node %d: %s\n", i, node->name);
@@ -164,6 +175,19 @@ T3DM::T3DMData T3DM::parseGLTF(const char *gltfPath, const T3DM::Config &config)
     auto mesh = node->mesh;
     if(!mesh)continue;
 
+    bool isInstanced = meshUseCount[mesh] > 1 && !node->skin;
+    Mat4 nodeMat = config.ignoreTransforms ? Mat4{} : parseNodeMatrix(node, true);
+    if(isInstanced) {
+      auto existingModels = meshModels.find(mesh);
+      if(existingModels != meshModels.end()) {
+        for(auto modelIdx : existingModels->second) {
+          t3dm.models[modelIdx].instances.push_back(nodeMat);
+        }
+        continue;
+      }
+      meshModels[mesh] = {};
+    }
+
     // printf(" - Mesh %d: %s\n", i, mesh->name);
 
     bool hasMat = false;
@@ -200,6 +224,11 @@ T3DM::T3DMData T3DM::parseGLTF(const char *gltfPath, const T3DM::Config &config)
         continue;
       }
 
+      if(isInstanced) {
+        model.instances.push_back(nodeMat);
+        meshModels[mesh].push_back(t3dm.models.size() - 1);
+      }
+
       // find vertex count
       int vertexCount = 0;
       for(int k = 0; k < prim->attributes_count; k++) {
@@ -343,7 +372,7 @@ T3DM::T3DMData T3DM::parseGLTF(const char *gltfPath, const T3DM::Config &config)
       if(matInfo.texSizeY == 0)matInfo.texSizeY = 32;
 
       // convert vertices
-      Mat4 mat = config.ignoreTransforms ? Mat4{} : parseNodeMatrix(node, true);
+      Mat4 mat = isInstanced ? Mat4{} : nodeMat;
       for(int k = 0; k < vertices.size(); k++) {
         convertVertex(
           config.globalScale, matInfo.texSizeX, matInfo.texSizeY, vertices[k], verticesT3D[k],
@@ -375,6 +404,10 @@ T3DM::T3DMData T3DM::parseGLTF(const char *gltfPath, const T3DM::Config &config)
 
   cgltf_free(data);
 
+  if(config.mergeStaticSize > 0.0f) {
+    mergeStaticModels(config, t3dm);
+  }
+
   // sort models by transparency mode (opaque -> cutout -> transparent)
   // within the same transparency mode, sort by material
   std::sort(t3dm.models.begin(), t3dm.models.end(), [&t3dm](const T3DM::Model &a, const T3DM::Model &b) {
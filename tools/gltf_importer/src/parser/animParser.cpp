@@ -84,16 +84,17 @@ T3DM::Anim T3DM::parseAnimation(
 
     bool isRot = channel.target_path == cgltf_animation_path_type_rotation;
     bool isTranslate = channel.target_path == cgltf_animation_path_type_translation;
+    bool isStep = channel.sampler->interpolation == cgltf_interpolation_type_step;
 
     // create channels, rotation is always combined, the rest (translation, scale) are separate for each axis
     res.channelMap.push_back({
       .targetName = targetName, .targetType = getTarget(channel.target_path),
-      .attributeIdx = 0,
+      .attributeIdx = 0, .isStep = isStep
     });
 
     if(!isRot) {
-      res.channelMap.push_back({.targetName = targetName, .targetType = getTarget(channel.target_path), .attributeIdx = 1});
-      res.channelMap.push_back({.targetName = targetName, .targetType = getTarget(channel.target_path), .attributeIdx = 2});
+      res.channelMap.push_back({.targetName = targetName, .targetType = getTarget(channel.target_path), .attributeIdx = 1, .isStep = isStep});
+      res.channelMap.push_back({.targetName = targetName, .targetType = getTarget(channel.target_path), .attributeIdx = 2, .isStep = isStep});
     }
 
     uint8_t *dataInput = ((uint8_t*)samplerIn.buffer_view->buffer->data) + samplerIn.offset + samplerIn.buffer_view->offset;
@@ -114,6 +115,25 @@ T3DM::Anim T3DM::parseAnimation(
     printf("    - Output[%s]: %d @ %d\n", Gltf::getTypeString(samplerOut.type), samplerOut.count, samplerOut.stride, samplerOut.type);
     printf("    - Time Range: %.4fs -> %.4fs\n", timeStart, timeEnd);
 */
+    // STEP channels keep their original keyframes, resampling them would only turn each jump into a ramp
+    if(isStep) {
+      for(uint32_t k=0; k<samplerIn.count; ++k) {
+        float keyTime = Gltf::readAsFloat(dataInput + k * samplerIn.stride, samplerIn.component_type);
+        uint8_t *keyOutput = dataOutputStart + k * samplerOut.stride;
+        if(isRot) {
+          Quat value = Gltf::readAsVec4(keyOutput, samplerOut.type, samplerOut.component_type);
+          res.channelMap.back().keyframes.push_back({.time = keyTime, .valQuat = value});
+        } else {
+          Vec3 value = Gltf::readAsVec3(keyOutput, samplerOut.type, samplerOut.component_type);
+          insertScalarKeyframe(res, keyTime, chIdx, value, isTranslate, globalScale);
+        }
+      }
+
+      chIdx += isRot ? 1 : 3;
+      res.duration = std::max(timeEnd - timeStart, res.duration);
+      continue;
+    }
+
     uint32_t frame = 0;
     float t;
     for(t=timeStart; t<=(timeEnd+sampleStep); t += sampleStep)
@@ -161,12 +161,19 @@ namespace T3DM
     uint32_t boneIndex{0};
     uint32_t boneCount{0};
     std::string name{};
+
+    // bounding sphere & normal cone for culling, a cutoff of 127 disables it
+    int16_t coneCenter[3]{};
+    int16_t coneRadius{0};
+    int8_t coneAxis[3]{};
+    int8_t coneCutoff{127};
   };
 
   struct Model {
     std::vector<TriangleT3D> triangles{};
     std::string name{};
     std::string materialName{};
+    std::vector<Mat4> instances{}; // if set, triangles are in mesh space and drawn once per matrix
   };
 
   struct ModelChunked {
@@ -218,8 +225,8 @@ namespace T3DM
     Quat valQuat;
     float valScalar;
 
-    uint32_t valQuantSize = 0;
-    uint16_t valQuant[2];
+    uint32_t valQuantSize = 0; // in bytes, see 'AnimChannelMapping::dataSize'
+    uint8_t valQuant[6];
   };
 
   struct AnimChannelMapping {
@@ -230,6 +237,8 @@ namespace T3DM
 
     float valueMin{INFINITY};
     float valueMax{-INFINITY};
+    uint8_t dataSize{}; // bytes per quantized value, picked against 'AnimErrorBudget'
+    bool isStep{false}; // holds each value until the next keyframe, no interpolation
 
     std::vector<Keyframe> keyframes{}; // temp. storage after parsing
 
@@ -245,6 +254,7 @@ namespace T3DM
     uint32_t channelCountScalar{};
     std::vector<Keyframe> keyframes{}; // output used for writing to the file
     std::vector<AnimChannelMapping> channelMap{};
+    std::vector<AnimChannelMapping> channelMapConst{}; // constant channels, only the first keyframe is used
   };
 
   struct CustomChunk
@@ -253,11 +263,45 @@ namespace T3DM
     std::vector<uint8_t> data{};
   };
 
+  // Part of a level streamed in at runtime ('--regions'), each one is a complete model in the region file
+  struct Region {
+    s16 aabbMin[3]{};
+    s16 aabbMax[3]{};
+    uint32_t offset{}; // in the region file
+    uint32_t size{}; // in the region file (padded)
+    uint32_t memSize{}; // size once loaded, larger than 'size' if the mesh is compressed
+  };
+
   struct T3DMData {
     std::vector<Model> models{};
     std::vector<Bone> skeletons{};
     std::vector<Anim> animations{};
     std::unordered_map<std::string, Material> materials{};
+    std::vector<Region> regions{};
+    std::vector<Model> regionModels{}; // static objects moved into regions, only used for collision
+  };
+
+  // Relative costs used to pick the cheapest index encoding of a mesh part.
+  // Values are roughly in RSP cycles and can be calibrated via '--cost-model=<file.json>'
+  struct CostModel {
+    float cmdBase{16.0f};       // fixed cost of any command (fetch + dispatch + buffer write)
+    float triDraw{12.0f};       // T3D_CMD_TRI_DRAW, per triangle
+    float seqBase{8.0f};        // T3D_CMD_TRI_SEQ, setup
+    float seqPerTri{4.0f};      // T3D_CMD_TRI_SEQ, per triangle
+    float stripBase{48.0f};     // T3D_CMD_TRI_STRIP, setup + DMA latency
+    float stripPerIndex{6.0f};  // T3D_CMD_TRI_STRIP, per index
+    float stripPerByte{0.5f};   // T3D_CMD_TRI_STRIP, DMA transfer per byte
+    float stripRestart{4.0f};   // T3D_CMD_TRI_STRIP, per strip restart
+    float sync{16.0f};          // T3D_CMD_TRI_SYNC, only needed if nothing else syncs
+    float dataByte{0.1f};       // size of the index data in the file / RDRAM
+  };
+
+  // Max. error allowed when picking the bit-width of animation channels,
+  // all values are scaled by '--anim-error=<factor>'
+  struct AnimErrorBudget {
+    float translation{0.05f}; // model units
+    float scale{0.0005f};
+    float rotation{0.25f}; // degrees
   };
 
   struct Config {
@@ -265,8 +309,19 @@ namespace T3DM
     uint32_t animSampleRate{30};
     bool ignoreMaterials{false};
     bool createBVH{false};
+    bool createCollision{false};
     bool verbose{false};
     bool ignoreTransforms{false};
+    bool ignoreAnimations{false};
+    bool animLibrary{false}; // only write the skeleton and animations, to be shared by multiple models
+    bool animArchive{false}; // write all animation streams into a single file
+    bool compressMesh{false};
+    bool instancing{false};
+    float mergeStaticSize{0.0f}; // max. size of merged objects (blender units), 0 to disable
+    float pvsCellSize{0.0f}; // size of the PVS grid cells (blender units), 0 to disable
+    float regionSize{0.0f}; // size of streamed regions (blender units), 0 to disable
+    CostModel costModel{};
+    AnimErrorBudget animErrorBudget{};
     std::string assetPath{};
     std::string assetPathFull{};
     std::filesystem::path projectPath{};
@@ -292,7 +347,9 @@ namespace T3DM
 
   constexpr int MAX_VERTEX_COUNT = 70;
   constexpr int CACHE_VERTEX_SIZE = 36;
-  constexpr u8 T3DM_VERSION = 0x04;
+  constexpr int MAX_INSTANCED_VERTEX_COUNT = 30; // see 'T3D_VERTEX_INSTANCED_MAX' in t3d.h
+  constexpr u8 T3DM_VERSION = 0x09;
+  constexpr uint16_t COLL_OBJECT_REGION = 0xFFFF; // see 'T3D_COLL_OBJECT_REGION' in t3dmodel.h
 
   void writeT3DM(
     const Config &config,
@@ -300,4 +357,16 @@ namespace T3DM
     const std::string &t3dmPath,
     const std::vector<CustomChunk> &customChunks = {}
   );
+
+  /**
+   * Creates a T3DM file in memory, used by 'writeT3DM' for the main model and each region.
+   * Streamed animation data is appended to 'streamFiles'.
+   */
+  BinaryFile createT3DM(
+    const Config &config,
+    const T3DMData &t3dm,
+    const std::string &t3dmPath,
+    const std::vector<CustomChunk> &customChunks,
+    std::vector<BinaryFile> &streamFiles
+  );
 }
\ No newline at end of file
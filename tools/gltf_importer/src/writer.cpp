@@ -19,6 +19,32 @@
 namespace fs = std::filesystem;
 
 namespace {
+  constexpr uint32_t ANIM_RUN_MAX = 128;
+  constexpr uint32_t ANIM_CHANNEL_DELTA_MAX = 15;
+  constexpr uint32_t ANIM_TIME_INLINE_MAX = 6;
+  constexpr uint8_t ANIM_CHANNEL_FLAG_STEP = 1 << 0;
+  constexpr uint32_t ANIM_ARCHIVE_ALIGN = 16;
+  constexpr uint32_t REGION_ALIGN = 16;
+  constexpr float TEX_REPEAT_INFINITE = 2048.0f; // must match REPEAT_INFINITE in libdragon
+  constexpr uint32_t HEADER_AABB_OFFSET = 0x20;
+  constexpr uint32_t HEADER_CHUNK_TABLE_OFFSET = 0x34;
+
+  // What the value in a pointer slot is relative to, resolved to a file offset once all chunks are written
+  enum class RelocBase : uint8_t {
+    FILE,     // already a file offset
+    STRINGS,  // offset into the string table (names of objects, materials and animations)
+    RESIDENT, // offset into the resident string table (file paths and bone names, never freed)
+    VERTICES, // offset into the vertex chunk
+    INDICES,  // offset into the index chunk
+    CHUNK,    // chunk index
+    MATERIAL, // material index
+  };
+
+  struct Reloc {
+    uint32_t pos{};
+    RelocBase base{};
+  };
+
   uint32_t insertString(std::string &stringTable, const std::string &newString) {
     auto strPos = stringTable.find(newString + '\0');
     if(strPos == std::string::npos) {
@@ -29,10 +55,67 @@ namespace {
     return strPos;
   }
 
-  int writeBone(BinaryFile &file, const T3DM::Bone &bone, std::string &stringTable, float globalScale, int level) {
+  /**
+   * Creates the lookup chunk: chunk indices grouped by type, and the name hashes of
+   * all named chunks (sorted by hash) to find them with a binary search at runtime.
+   */
+  BinaryFile createLookup(const std::vector<char> &chunkTypes, const std::vector<std::string> &chunkNames) {
+    std::vector<char> types{};
+    for(char type : chunkTypes) {
+      if(std::find(types.begin(), types.end(), type) == types.end())types.push_back(type);
+    }
+
+    std::vector<std::pair<uint32_t, uint16_t>> names{};
+    for(uint32_t i=0; i<chunkNames.size(); ++i) {
+      if(!chunkNames[i].empty())names.push_back({nameHash(chunkNames[i]), (uint16_t)i});
+    }
+    std::sort(names.begin(), names.end());
+
+    BinaryFile res{};
+    res.write<uint16_t>(types.size());
+    res.write<uint16_t>(names.size());
+    for(auto &[hash, chunkIdx] : names) {
+      res.write(hash);
+      res.write(chunkIdx);
+      res.write<uint16_t>(0);
+    }
+
+    uint16_t start = 0;
+    for(char type : types) {
+      uint16_t count = std::count(chunkTypes.begin(), chunkTypes.end(), type);
+      res.write<uint8_t>(type);
+      res.write<uint8_t>(0);
+      res.write(count);
+      res.write(start);
+      start += count;
+    }
+
+    for(char type : types) {
+      for(uint32_t i=0; i<chunkTypes.size(); ++i) {
+        if(chunkTypes[i] == type)res.write<uint16_t>(i);
+      }
+    }
+    return res;
+  }
+
+  /**
+   * Writes strip indices in the format the ucode expects (see 't3d_indexbuffer_convert'):
+   * byte offsets into the vertex buffer, with the restart and end flags set.
+   * Only the DMEM address of the vertex buffer is added at runtime.
+   */
+  void writeStripIndices(BinaryFile &file, const std::vector<int16_t> &indices) {
+    for(size_t i=0; i<indices.size(); ++i) {
+      uint16_t flags = indices[i] & 0x8000; // restarts a new strip
+      if(i == indices.size()-1)flags |= 0x4000; // end of buffer marker
+      file.write<uint16_t>(((indices[i] & 0x7FFF) * T3DM::CACHE_VERTEX_SIZE) | flags);
+    }
+  }
+
+  int writeBone(BinaryFile &file, const T3DM::Bone &bone, std::string &residentTable, std::vector<Reloc> &relocs, float globalScale, int level) {
     //printf("Bone[%d]: %s -> %d\n", bone.index, bone.name.c_str(), bone.parentIndex);
 
-    file.write(insertString(stringTable, bone.name));
+    relocs.push_back({file.getPos(), RelocBase::RESIDENT});
+    file.write(insertString(residentTable, bone.name));
     file.write<uint16_t>(bone.parentIndex);
     file.write<uint16_t>(level); // level
 
@@ -43,11 +126,72 @@ namespace {
 
     int boneCount = 1;
     for(const auto& child : bone.children) {
-      boneCount += writeBone(file, *child, stringTable, globalScale, level+1);
+      boneCount += writeBone(file, *child, residentTable, relocs, globalScale, level+1);
     }
     return boneCount;
   };
 
+  void writeVarInt(BinaryFile &file, uint32_t value) {
+    do {
+      uint8_t byte = value & 0x7F;
+      value >>= 7;
+      file.write<uint8_t>(value ? (byte | 0x80) : byte);
+    } while(value);
+  }
+
+  /**
+   * Writes the keyframe stream of an animation.
+   * Each keyframe is relative to the previous one, storing the channel as a delta and the ticks inline if small.
+   * Header byte:
+   *   0b0TTTCCCC: single KF, C = channel delta - 1 (15: absolute varint follows), T = ticks (7: varint follows)
+   *   0b1NNNNNNN: run of N+1 KFs, each using the next channel and the same ticks as the KF before
+   * The header is followed by the data of each KF, the size of it is set by the channel.
+   */
+  void writeAnimStream(BinaryFile &file, const T3DM::Anim &anim) {
+    uint32_t channelCount = anim.channelMap.size();
+    uint32_t lastChannel = channelCount - 1;
+    uint32_t lastTicks = 0;
+
+    auto isRunKF = [&](const T3DM::Keyframe &kf, uint32_t prevChannel, uint32_t prevTicks) {
+      return kf.chanelIdx == (prevChannel + 1) % channelCount && kf.timeNextInChannelTicks == prevTicks;
+    };
+
+    for(uint32_t k=0; k<anim.keyframes.size();)
+    {
+      // check how many KFs follow the simple pattern of the run-length encoding
+      uint32_t runLength = 0;
+      for(uint32_t prevChannel = lastChannel; k + runLength < anim.keyframes.size() && runLength < ANIM_RUN_MAX; ++runLength) {
+        const auto &kf = anim.keyframes[k + runLength];
+        if(!isRunKF(kf, prevChannel, lastTicks))break;
+        prevChannel = kf.chanelIdx;
+      }
+
+      if(runLength > 1) {
+        file.write<uint8_t>(0x80 | (runLength - 1));
+      } else {
+        runLength = 1;
+        const auto &kf = anim.keyframes[k];
+        uint32_t channelDelta = (kf.chanelIdx + channelCount - lastChannel) % channelCount;
+        if(channelDelta == 0)channelDelta = channelCount;
+
+        uint8_t codeChannel = channelDelta <= ANIM_CHANNEL_DELTA_MAX ? (channelDelta - 1) : 0x0F;
+        uint8_t codeTime = kf.timeNextInChannelTicks <= ANIM_TIME_INLINE_MAX ? kf.timeNextInChannelTicks : 0x07;
+        file.write<uint8_t>((codeTime << 4) | codeChannel);
+
+        if(codeChannel == 0x0F)writeVarInt(file, kf.chanelIdx);
+        if(codeTime == 0x07)writeVarInt(file, kf.timeNextInChannelTicks);
+      }
+
+      for(uint32_t r=0; r<runLength; ++r, ++k) {
+        const auto &kf = anim.keyframes[k];
+        //printf("KF[%d]: %.4f, needed: %.4f, next: %.4f\n", k, kf.time, kf.timeNeeded, kf.timeNextInChannel);
+        file.writeArray(kf.valQuant, kf.valQuantSize);
+        lastChannel = kf.chanelIdx;
+        lastTicks = kf.timeNextInChannelTicks;
+      }
+    }
+  }
+
   std::string getRomPath(const std::string &path) {
     std::string basDir = "filesystem/";
     auto fsPos = path.find(basDir);
@@ -57,37 +201,124 @@ namespace {
     return path;
   }
 
-  std::string getStreamDataPath(const char* filePath, uint32_t idx) {
+  struct InstanceAABB {
+    int16_t aabbMin[3];
+    int16_t aabbMax[3];
+  };
+
+  // transforms the (already scaled) mesh AABB of an instanced model into model space
+  InstanceAABB getInstanceAABB(const Mat4 &mat, const T3DM::ModelChunked &chunks, float globalScale) {
+    Vec3 resMin{INFINITY, INFINITY, INFINITY};
+    Vec3 resMax{-INFINITY, -INFINITY, -INFINITY};
+    for(int c=0; c<8; ++c) {
+      Vec3 corner{
+        (float)((c & 1) ? chunks.aabbMax[0] : chunks.aabbMin[0]),
+        (float)((c & 2) ? chunks.aabbMax[1] : chunks.aabbMin[1]),
+        (float)((c & 4) ? chunks.aabbMax[2] : chunks.aabbMin[2]),
+      };
+      corner = mat * (corner / globalScale) * globalScale;
+      for(int i=0; i<3; ++i) {
+        resMin[i] = std::min(resMin[i], corner[i]);
+        resMax[i] = std::max(resMax[i], corner[i]);
+      }
+    }
+
+    InstanceAABB res{};
+    for(int i=0; i<3; ++i) {
+      res.aabbMin[i] = (int16_t)std::clamp(floorf(resMin[i]), -32768.0f, 32767.0f);
+      res.aabbMax[i] = (int16_t)std::clamp(ceilf(resMax[i]), -32768.0f, 32767.0f);
+    }
+    return res;
+  }
+
+  // writes a matrix in the layout of 'T3DMat4FP' (s16.16, integer and fraction parts split)
+  void writeMatrixFP(BinaryFile &file, const Mat4 &mat, float globalScale) {
+    for(int col=0; col<4; ++col) {
+      int32_t fixed[4];
+      for(int row=0; row<4; ++row) {
+        float val = mat.data[col][row];
+        if(col == 3 && row < 3)val *= globalScale;
+        fixed[row] = (int32_t)(val * 65536.0f);
+      }
+      for(auto f : fixed)file.write<int16_t>((int16_t)(f >> 16));
+      for(auto f : fixed)file.write<uint16_t>((uint16_t)(f & 0xFFFF));
+    }
+  }
+
+  // if 'idx' is negative, the path of the archive containing all streams is returned
+  std::string getStreamDataPath(const char* filePath, int32_t idx) {
     auto sdataPath = std::string(filePath).substr(0, std::string(filePath).size()-5);
     std::replace(sdataPath.begin(), sdataPath.end(), '\\', '/');
+    if(idx < 0)return sdataPath + ".sdata";
     return sdataPath + "." + std::to_string(idx) + ".sdata";
   }
+
+  std::string getRegionDataPath(const std::string &filePath) {
+    auto regionPath = filePath.substr(0, filePath.size()-5) + ".t3dr";
+    std::replace(regionPath.begin(), regionPath.end(), '\\', '/');
+    return regionPath;
+  }
+
+  // End of a compressed mesh once decoded at runtime, the data following it starts there (see 'model_decode_mesh')
+  uint32_t getDecodedMeshEnd(uint32_t offset, uint32_t vertSize, uint32_t indexSize) {
+    return (offset + vertSize + ((indexSize + 7) & ~7) + 15) & ~15;
+  }
+
+  // Size of a model once loaded, larger than the file if the mesh is compressed
+  uint32_t getLoadedSize(const BinaryFile &model) {
+    uint32_t chunkCount = model.read<uint32_t>(4);
+    for(uint32_t i=0; i<chunkCount; ++i) {
+      uint32_t chunk = model.read<uint32_t>(HEADER_CHUNK_TABLE_OFFSET + i * sizeof(uint32_t));
+      if((chunk >> 24) != 'Z')continue;
+
+      uint32_t offset = chunk & 0xFF'FFFF;
+      uint32_t vertCount = model.read<uint32_t>(offset);
+      uint32_t indexSize = model.read<uint32_t>(offset + 4);
+      uint32_t encodedSize = 16 + model.read<uint32_t>(offset + 8) + model.read<uint32_t>(offset + 12);
+      uint32_t metaOffset = (offset + encodedSize + 15) & ~15;
+      uint32_t decodedEnd = getDecodedMeshEnd(offset, vertCount * T3DM::VertexT3D::byteSize(), indexSize);
+      return model.getSize() - metaOffset + decodedEnd;
+    }
+    return model.getSize();
+  }
 }
 
-void T3DM::writeT3DM(
+BinaryFile T3DM::createT3DM(
   const Config &config,
   const T3DMData &t3dm,
   const std::string &t3dmPath,
-  const std::vector<CustomChunk> &customChunks
+  const std::vector<CustomChunk> &customChunks,
+  std::vector<BinaryFile> &streamFiles
 )
 {
   int16_t aabbMin[3] = {32767, 32767, 32767};
   int16_t aabbMax[3] = {-32768, -32768, -32768};
 
   uint32_t chunkIndex = 0;
-  uint32_t chunkCount = 2; // vertices + indices
+  uint32_t chunkCount = 3; // vertices + indices + lookup
   if(config.createBVH)chunkCount += 1;
+  if(config.compressMesh)chunkCount += 1;
   chunkCount += t3dm.materials.size();
   chunkCount += customChunks.size();
 
   std::vector<ModelChunked> modelChunks{};
+  std::vector<std::vector<InstanceAABB>> instanceAABBs{};
   modelChunks.reserve(t3dm.models.size());
   for(const auto & model : t3dm.models) {
-    auto chunks = chunkUpModel(model);
+    // parts facing away can only be skipped if the RSP would cull their triangles anyway
+    auto mat = t3dm.materials.find(model.materialName);
+    bool useCones = mat != t3dm.materials.end() && (mat->second.drawFlags & DrawFlags::CULL_BACK);
+
+    auto chunks = useCones ? chunkUpModelCulled(model) : chunkUpModel(model);
     if(config.verbose) {
       printf("[%s] Vertices out: %ld\n", model.name.c_str(), chunks.vertices.size());
     }
-    optimizeModelChunk(config, chunks);
+
+    // small instanced objects are drawn with an instanced vertex-load ('t3d_model_draw_object_instanced'),
+    // strips can't be used there as they point to fixed slots in the vertex cache
+    bool instancedLoad = !model.instances.empty() && std::all_of(chunks.chunks.begin(), chunks.chunks.end(),
+      [](const MeshChunk &c) { return c.vertexCount <= MAX_INSTANCED_VERTEX_COUNT; });
+    optimizeModelChunk(config, chunks, !instancedLoad);
 
     if(config.verbose) {
       int totalIdx=0, totalStrips=0, totalStripCmd = 0;
@@ -108,6 +339,27 @@ void T3DM::writeT3DM(
     }
 
     chunks.triCount = model.triangles.size();
+
+    // instanced objects keep their mesh in local space,
+    // the object AABB (also used by the BVH) covers all instances instead
+    auto &instAABBs = instanceAABBs.emplace_back();
+    for(const auto &mat : model.instances) {
+      instAABBs.push_back(getInstanceAABB(mat, chunks, config.globalScale));
+    }
+    if(!instAABBs.empty()) {
+      for(int i=0; i<3; ++i) {
+        chunks.aabbMin[i] = instAABBs[0].aabbMin[i];
+        chunks.aabbMax[i] = instAABBs[0].aabbMax[i];
+      }
+      for(const auto &aabb : instAABBs) {
+        for(int i=0; i<3; ++i) {
+          chunks.aabbMin[i] = std::min(chunks.aabbMin[i], aabb.aabbMin[i]);
+          chunks.aabbMax[i] = std::max(chunks.aabbMax[i], aabb.aabbMax[i]);
+        }
+      }
+      chunkCount += 1; // instances
+    }
+
     modelChunks.push_back(chunks);
     chunkCount += 1; // object
 
@@ -121,8 +373,26 @@ void T3DM::writeT3DM(
   }
   chunkCount += t3dm.skeletons.empty() ? 0 : 1;
   chunkCount += t3dm.animations.size();
+  chunkCount += t3dm.regions.empty() ? 0 : 1;
 
-  std::vector<BinaryFile> streamFiles{};
+  for(const auto &region : t3dm.regions) {
+    for(int i=0; i<3; ++i) {
+      aabbMin[i] = std::min(aabbMin[i], region.aabbMin[i]);
+      aabbMax[i] = std::max(aabbMax[i], region.aabbMax[i]);
+    }
+  }
+
+  BinaryFile chunkCollision{};
+  if(config.createCollision) {
+    chunkCollision = createCollisionBVH(config, t3dm.models, t3dm.regionModels);
+    if(chunkCollision.getSize() > 0)chunkCount += 1;
+  }
+
+  BinaryFile chunkPVS{};
+  if(config.pvsCellSize > 0.0f) {
+    chunkPVS = createPVS(config, t3dm.models);
+    if(chunkPVS.getSize() > 0)chunkCount += 1;
+  }
 
   // Main file
   BinaryFile file{};
@@ -143,11 +413,34 @@ void T3DM::writeT3DM(
   file.writeArray(aabbMin, 3);
   file.writeArray(aabbMax, 3);
 
+  uint32_t offsetLookupPtr = file.getPos();
+  file.skip(sizeof(uint32_t)); // lookup chunk offset (filled later)
+
+  uint32_t offsetRelocTable = file.getPos();
+  file.skip(sizeof(uint32_t)); // relocation table offset (filled later)
+
   uint32_t offsetChunkTable = file.getPos();
+  const uint32_t offsetChunkTableStart = offsetChunkTable;
+  assert(offsetChunkTableStart == HEADER_CHUNK_TABLE_OFFSET);
   file.skip(chunkCount * sizeof(uint32_t)); // chunk-table
 
-  auto addToChunkTable = [&](char type) {
-    uint32_t offset = file.posPush();
+  // type and name of each chunk, used to create the lookup chunk
+  std::vector<char> chunkTypes{};
+  std::vector<std::string> chunkNames{};
+  std::vector<uint32_t> chunkOffsets{};
+
+  // file position of the first chunk after the compressed mesh, and how far it is moved once decoded
+  uint32_t metaOffsetFile = UINT32_MAX;
+  int32_t metaShift = 0;
+  auto toLoaded = [&](uint32_t pos) -> uint32_t {
+    return pos >= metaOffsetFile ? pos + metaShift : pos;
+  };
+
+  auto addToChunkTable = [&](char type, const std::string &name = "") {
+    chunkTypes.push_back(type);
+    chunkNames.push_back(name);
+    uint32_t offset = toLoaded(file.posPush());
+    chunkOffsets.push_back(offset);
       file.setPos(offsetChunkTable);
       file.writeChunkPointer(type, offset);
       offsetChunkTable = file.getPos();
@@ -168,9 +461,23 @@ void T3DM::writeT3DM(
   BinaryFile chunkIndices{};
   BinaryFile chunkBVH{};
   std::vector<std::shared_ptr<BinaryFile>> chunkMaterials{};
+  std::vector<std::string> chunkMaterialNames{}; // empty for custom materials
+  std::vector<std::vector<Reloc>> chunkMaterialRelocs{}; // relative to the material chunk
   std::vector<BinaryFile> chunkSkeletons{};
+  std::vector<Reloc> skeletonRelocs{}; // relative to the skeleton chunk
+  std::vector<BinaryFile> chunkAnims{};
+  std::vector<std::vector<Reloc>> chunkAnimRelocs{}; // relative to the animation chunk
+
+  // all pointers in the file, plus the strip buffers as '(offset << 8) | count' (relative to the index chunk)
+  std::vector<Reloc> relocs{};
+  std::vector<uint32_t> stripBuffers{};
+
+  auto addReloc = [&](RelocBase base) {
+    relocs.push_back({file.getPos(), base});
+  };
 
   std::string stringTable = "S";
+  std::string residentTable = "R";
 
   // now write out each model (aka. collection of mesh-parts + materials)
   int m=0;
@@ -184,7 +491,7 @@ void T3DM::writeT3DM(
 
     int boneCount = 0;
     for(auto &skel : t3dm.skeletons) {
-      boneCount += writeBone(chunkBone, skel, stringTable, config.globalScale, 0);
+      boneCount += writeBone(chunkBone, skel, residentTable, skeletonRelocs, config.globalScale, 0);
     }
 
     chunkBone.setPos(0);
@@ -192,8 +499,7 @@ void T3DM::writeT3DM(
   }
 
   if(config.createBVH) {
-    auto bvhData = createMeshBVH(modelChunks);
-    chunkBVH.writeArray(bvhData.data(), bvhData.size());
+    chunkBVH = createMeshBVH(modelChunks);
   }
 
   // write used materials
@@ -204,9 +510,11 @@ void T3DM::writeT3DM(
     uint32_t matIdx = materialMap.size();
     materialMap[material.name] = matIdx;
     auto f = std::make_shared<BinaryFile>();
+    auto &matRelocs = chunkMaterialRelocs.emplace_back();
 
     if(config.materialWriter && config.materialWriter(f, material, matIdx)) {
       chunkMaterials.push_back(f);
+      chunkMaterialNames.push_back("");
       continue;
     }
 
@@ -228,6 +536,7 @@ void T3DM::writeT3DM(
     f->writeArray(material.primColor, 4);
     f->writeArray(material.envColor, 4);
     f->writeArray(material.blendColor, 4);
+    matRelocs.push_back({f->getPos(), RelocBase::STRINGS});
     f->write(insertString(stringTable, material.name));
 
     std::vector materials{&material.texA, &material.texB};
@@ -238,10 +547,11 @@ void T3DM::writeT3DM(
 
       if(!mat.texPathRom.empty()) {
         // check if string already exits
-        auto strPos = insertString(stringTable, mat.texPathRom);
+        auto strPos = insertString(residentTable, mat.texPathRom);
 
         uint32_t hash = stringHash(mat.texPathRom);
         //printf("Texture: %s (%d)\n", texPath.c_str(), hash);
+        matRelocs.push_back({f->getPos(), RelocBase::RESIDENT});
         f->write((uint32_t)strPos);
         f->write(hash);
 
@@ -256,37 +566,53 @@ void T3DM::writeT3DM(
       f->write((uint16_t)mat.texWidth);
       f->write((uint16_t)mat.texHeight);
 
-      auto writeTile = [&](const T3DM::TileParam &tile) {
+      // repeats are stored as expected by 'rdpq_texparms_t', clamping NPOT textures only works without repeats
+      auto writeTile = [&](const T3DM::TileParam &tile, uint32_t texSize) {
+        float repeats = TEX_REPEAT_INFINITE;
+        if(tile.clamp) {
+          bool isPowerOfTwo = texSize != 0 && (texSize & (texSize - 1)) == 0;
+          repeats = isPowerOfTwo ? ((tile.high - tile.low + 1) / (float)texSize) : 1.0f;
+        }
         f->write(tile.low);
-        f->write(tile.high);
+        f->write(repeats);
         f->write(tile.mask);
         f->write(tile.shift);
         f->write(tile.mirror);
         f->write(tile.clamp);
       };
-      writeTile(mat.s);
-      writeTile(mat.t);
+      writeTile(mat.s, mat.texWidth);
+      writeTile(mat.t, mat.texHeight);
     }
+    f->write((uint32_t)0); // runtime block, see 't3d_model_record_materials'
 
     chunkMaterials.push_back(f);
+    chunkMaterialNames.push_back(material.name);
   }
 
+  std::vector<uint32_t> objectChunkIdx{};
+
   file.align(8);
   for(auto &model : t3dm.models)
   {
-    addToChunkTable('O');
+    objectChunkIdx.push_back(chunkIndex);
+    const auto &chunks = modelChunks[m];
+    addToChunkTable('O', chunks.chunks.back().name);
     uint32_t matIdx = materialMap[model.materialName];
 
     // write object chunk
-    const auto &chunks = modelChunks[m];
+    addReloc(RelocBase::STRINGS);
     file.write(insertString(stringTable, chunks.chunks.back().name));
     file.write((uint16_t)chunks.chunks.size());
     file.write(chunks.triCount);
+    addReloc(RelocBase::MATERIAL);
     file.write(matIdx);
     file.write<uint32_t>(0); // block, set at runtime
-    file.write<uint32_t>(0); // visibility, set at runtime + padding
+    file.write<uint8_t>(0); // visibility, set at runtime
+    file.write<uint8_t>(model.instances.empty() ? 0 : 1);
+    file.write<uint16_t>(0); // user values
     file.writeArray(chunks.aabbMin, 3);
     file.writeArray(chunks.aabbMax, 3);
+    file.write<uint32_t>(0); // draw block, set at runtime
 
     //printf("Object %d: %d vert offset\n", m, chunkVerts.getPos());
 
@@ -297,9 +623,11 @@ void T3DM::writeT3DM(
       uint32_t partVertOffset = (chunk.vertexOffset * T3DM::VertexT3D::byteSize());
       partVertOffset += chunkVerts.getPos();
 
+      addReloc(RelocBase::VERTICES);
       file.write(partVertOffset);
       file.write<uint16_t>(chunk.vertexCount);
       file.write<uint16_t>(chunk.vertexDestOffset);
+      addReloc(RelocBase::INDICES);
       file.write(chunkIndices.getPos());
       file.write((uint16_t)chunk.indices.size());
       file.write<uint16_t>(chunk.boneIndex); // Matrix/Bone index
@@ -311,13 +639,21 @@ void T3DM::writeT3DM(
       file.write(chunk.seqCount);
       file.write<uint8_t>(0);
       file.write<uint8_t>(0);
+      file.writeArray(chunk.coneCenter, 3);
+      file.write(chunk.coneRadius);
+      file.writeArray(chunk.coneAxis, 3);
+      file.write(chunk.coneCutoff);
 
       // write indices data
       chunkIndices.writeArray(chunk.indices.data(), chunk.indices.size());
       for(const auto & stripIndex : chunk.stripIndices) {
         if(stripIndex.empty())break;
         chunkIndices.align(8);
-        chunkIndices.writeArray(stripIndex.data(), stripIndex.size());
+        if(chunkIndices.getPos() > 0xFF'FFFF) {
+          throw std::runtime_error("Index chunk too large for strip relocation (max. 16MB)!");
+        }
+        stripBuffers.push_back((chunkIndices.getPos() << 8) | stripIndex.size());
+        writeStripIndices(chunkIndices, stripIndex);
       }
 
       totalIndexCount += chunk.indices.size();
@@ -357,84 +693,146 @@ void T3DM::writeT3DM(
   uint16_t animIdx = 0;
   for(const auto &anim : t3dm.animations) {
     BinaryFile streamFile{};
-    file.align(4);
-    addToChunkTable('A');
-
-    file.write(insertString(stringTable, anim.name));
-    file.write<float>(anim.duration);
-    file.write<uint32_t>(anim.keyframes.size());
-    file.write<uint16_t>(anim.channelCountQuat);
-    file.write<uint16_t>(anim.channelCountScalar);
-    file.write<uint32_t>(insertString(stringTable,
-      getRomPath(getStreamDataPath(t3dmPath.c_str(), animIdx))
+    writeAnimStream(streamFile, anim);
+
+    // in an archive each stream starts aligned, otherwise each one is a separate file
+    uint32_t streamOffset = 0;
+    if(config.animArchive) {
+      if(streamFiles.empty())streamFiles.emplace_back();
+      streamFiles[0].align(ANIM_ARCHIVE_ALIGN);
+      streamOffset = streamFiles[0].getSize();
+      streamFiles[0].writeMemFile(streamFile);
+    } else {
+      streamFiles.push_back(streamFile);
+    }
+
+    // written after all render data, so they can be freed at runtime (see 't3d_model_compact')
+    auto &chunkAnim = chunkAnims.emplace_back();
+    auto &animRelocs = chunkAnimRelocs.emplace_back();
+    animRelocs.push_back({chunkAnim.getPos(), RelocBase::STRINGS});
+    chunkAnim.write(insertString(stringTable, anim.name));
+    chunkAnim.write<float>(anim.duration);
+    chunkAnim.write<uint32_t>(anim.keyframes.size());
+    chunkAnim.write<uint16_t>(anim.channelCountQuat);
+    chunkAnim.write<uint16_t>(anim.channelCountScalar);
+    animRelocs.push_back({chunkAnim.getPos(), RelocBase::RESIDENT});
+    chunkAnim.write<uint32_t>(insertString(residentTable,
+      getRomPath(getStreamDataPath(t3dmPath.c_str(), config.animArchive ? -1 : animIdx))
     ));
+    chunkAnim.write<uint16_t>(anim.channelMapConst.size());
+    chunkAnim.write<uint16_t>(0);
+    chunkAnim.write<uint32_t>(streamOffset);
+    chunkAnim.write<uint32_t>(streamFile.getSize());
+    chunkAnim.write<uint32_t>(0); // ROM address, set at runtime
 
-    std::unordered_set<uint32_t> channelHasKF{};
-    for(int k=0; k<anim.keyframes.size(); ++k) {
-      bool isLastKF = (k >= anim.keyframes.size()-1);
-      const auto &kf = anim.keyframes[k];
-      const auto &kfNext = isLastKF ? kf : anim.keyframes[k+1];
+    for(const auto &ch : anim.channelMap) {
+      float maxValue = ch.isRotation() ? 1.0f : (float)((1u << (ch.dataSize * 8)) - 1);
+      chunkAnim.write(ch.targetIdx);
+      chunkAnim.write(ch.targetType);
+      chunkAnim.write(ch.attributeIdx);
+      chunkAnim.write(ch.dataSize);
+      chunkAnim.write<uint8_t>(ch.isStep ? ANIM_CHANNEL_FLAG_STEP : 0);
+      chunkAnim.write<uint16_t>(0);
+      chunkAnim.write((ch.valueMax - ch.valueMin) / maxValue);
+      chunkAnim.write(ch.valueMin);
+    }
 
-      bool nextIsLarge = kfNext.valQuantSize > 1;
+    for(const auto &ch : anim.channelMapConst) {
+      const auto &kf = ch.keyframes[0];
+      chunkAnim.write(ch.targetIdx);
+      chunkAnim.write(ch.targetType);
+      chunkAnim.write(ch.attributeIdx);
+      for(int i=0; i<4; ++i) {
+        chunkAnim.write(ch.isRotation() ? kf.valQuat[i] : (i == 0 ? kf.valScalar : 0.0f));
+      }
+    }
 
-      uint16_t timeNext = kf.timeNextInChannelTicks;
-      assert(timeNext < (1 << 15)); // prevent conflicts with size flag
-      if(nextIsLarge)timeNext |= (1 << 15); // encode size of the next KF here
+    ++animIdx;
+  }
 
-      //printf("KF[%d]: %.4f, needed: %.4f, next: %.4f\n", k, kf.time, kf.timeNeeded, kf.timeNextInChannel);
+  // Now patch all chunks together and write out the chunk-table.
+  // Render data comes first, metadata that can be freed at runtime (see 't3d_model_compact') is placed last.
 
-      streamFile.write<uint16_t>(timeNext);
-      streamFile.write<uint16_t>(kf.chanelIdx);
-      for(int v=0; v<kf.valQuantSize; ++v) {
-        streamFile.write<uint16_t>(kf.valQuant[v]);
-      }
+  if(chunkCollision.getSize() > 0) {
+    file.align(8);
+    addToChunkTable('C');
+    file.writeMemFile(chunkCollision);
+  }
 
-      // force the first keyframe to have 2 values, this is to have a known initial state
-      if(k == 0 && kf.valQuantSize == 1) {
-        streamFile.write<uint16_t>(0);
-      }
-    }
-    streamFiles.push_back(streamFile);
+  if(chunkPVS.getSize() > 0) {
+    file.align(8);
+    addToChunkTable('P');
+    file.writeMemFile(chunkPVS);
+  }
 
-    for(const auto &ch : anim.channelMap) {
-      file.write(ch.targetIdx);
-      file.write(ch.targetType);
-      file.write(ch.attributeIdx);
-      file.write((ch.valueMax - ch.valueMin) / (float)0xFFFF);
-      file.write(ch.valueMin);
+  // regions, each one is a complete model streamed in from the region file at runtime
+  if(!t3dm.regions.empty()) {
+    file.align(4);
+    addToChunkTable('R');
+    addReloc(RelocBase::RESIDENT);
+    file.write(insertString(residentTable, getRomPath(getRegionDataPath(t3dmPath))));
+    file.write<uint32_t>(0); // ROM address, set at runtime
+    file.write<uint16_t>(t3dm.regions.size());
+    file.write<uint16_t>(0);
+    for(const auto &region : t3dm.regions) {
+      file.writeArray(region.aabbMin, 3);
+      file.writeArray(region.aabbMax, 3);
+      file.write(region.offset);
+      file.write(region.size);
+      file.write(region.memSize);
     }
-
-    ++animIdx;
   }
 
-  // Now patch all chunks together and write out the chunk-table
+  // instance transforms, object index is turned into a pointer at runtime
+  for(size_t i=0; i<t3dm.models.size(); ++i) {
+    const auto &model = t3dm.models[i];
+    if(model.instances.empty())continue;
 
-  if(config.createBVH) {
-    file.align(8);
-    addToChunkTable('B');
-    file.writeMemFile(chunkBVH);
+    file.align(16);
+    addToChunkTable('N');
+    addReloc(RelocBase::CHUNK);
+    file.write<uint32_t>(objectChunkIdx[i]);
+    file.write<uint16_t>(model.instances.size());
+    file.skip(10);
+
+    for(const auto &mat : model.instances) {
+      writeMatrixFP(file, mat, config.globalScale);
+    }
+    for(const auto &aabb : instanceAABBs[i]) {
+      file.writeArray(aabb.aabbMin, 3);
+      file.writeArray(aabb.aabbMax, 3);
+    }
   }
 
+  // if compressed, vertices and indices are only allocated at runtime, offsets are set later
   file.align(16);
   addChunkTypeIndex();
+  uint32_t chunkIdxVertices = chunkIndex;
   addToChunkTable('V');
-  file.writeMemFile(chunkVerts);
+  if(!config.compressMesh)file.writeMemFile(chunkVerts);
 
   file.align(4);
   addChunkTypeIndex();
   addToChunkTable('I');
-  file.writeMemFile(chunkIndices);
+  if(!config.compressMesh)file.writeMemFile(chunkIndices);
 
   addChunkTypeIndex();
-  for(auto &f : chunkMaterials) {
+  uint32_t chunkIdxMaterials = chunkIndex;
+  for(size_t i=0; i<chunkMaterials.size(); ++i) {
     file.align(8);
-    addToChunkTable(config.materialWriter ? 'm' : 'M');
-    file.writeMemFile(*f);
+    addToChunkTable(config.materialWriter ? 'm' : 'M', chunkMaterialNames[i]);
+    for(auto reloc : chunkMaterialRelocs[i]) {
+      relocs.push_back({file.getPos() + reloc.pos, reloc.base});
+    }
+    file.writeMemFile(*chunkMaterials[i]);
   }
 
   for(const auto &chunkSkel : chunkSkeletons) {
     file.align(8);
     addToChunkTable('S');
+    for(auto reloc : skeletonRelocs) {
+      relocs.push_back({file.getPos() + reloc.pos, reloc.base});
+    }
     file.writeMemFile(chunkSkel);
   }
 
@@ -444,24 +842,183 @@ void T3DM::writeT3DM(
     file.writeArray(custom.data.data(), custom.data.size());
   }
 
-  // String table
+  // Lookup, covers all chunks. Only the mesh and metadata follow, their entries are known in advance
+  file.align(4);
+  uint32_t lookupOffset = file.getPos();
+  addToChunkTable('L');
+
+  std::vector<char> lookupTypes = chunkTypes;
+  std::vector<std::string> lookupNames = chunkNames;
+  if(config.compressMesh) {
+    lookupTypes.push_back('Z');
+    lookupNames.push_back("");
+  }
+  for(const auto &anim : t3dm.animations) {
+    lookupTypes.push_back('A');
+    lookupNames.push_back(anim.name);
+  }
+  if(config.createBVH) {
+    lookupTypes.push_back('B');
+    lookupNames.push_back("");
+  }
+  file.writeMemFile(createLookup(lookupTypes, lookupNames));
+
+  // Resident string table, paths of files loaded at runtime (textures, streamed data) and bone names
+  file.align(4);
+  uint32_t residentTableOffset = file.getPos();
+  file.write(residentTable);
+
+  // Compressed vertices + indices, the runtime decodes them in place (growing the buffer).
+  // Anything after it is moved back to make room, so offsets from here on refer to that layout
+  if(config.compressMesh) {
+    file.align(16);
+    uint32_t offsetCodec = file.getPos();
+    addToChunkTable('Z');
+    file.writeMemFile(encodeMeshChunk(chunkVerts, chunkIndices, config.verbose));
+
+    chunkOffsets[chunkIdxVertices] = offsetCodec;
+    chunkOffsets[chunkIdxVertices+1] = offsetCodec + chunkVerts.getSize();
+    file.posPush();
+      file.setPos(offsetChunkTableStart + chunkIdxVertices * sizeof(uint32_t));
+      file.writeChunkPointer('V', chunkOffsets[chunkIdxVertices]);
+      file.writeChunkPointer('I', chunkOffsets[chunkIdxVertices+1]);
+    file.posPop();
+
+    file.align(16);
+    metaOffsetFile = file.getPos();
+    metaShift = (int32_t)getDecodedMeshEnd(offsetCodec, chunkVerts.getSize(), chunkIndices.getSize()) - (int32_t)metaOffsetFile;
+  }
+
+  // Metadata: animations, BVH, names and the relocation table (in that order)
+  for(size_t i=0; i<chunkAnims.size(); ++i) {
+    file.align(4);
+    addToChunkTable('A', t3dm.animations[i].name);
+    for(auto reloc : chunkAnimRelocs[i]) {
+      relocs.push_back({file.getPos() + reloc.pos, reloc.base});
+    }
+    file.writeMemFile(chunkAnims[i]);
+  }
+
+  if(config.createBVH) {
+    file.align(8);
+    addToChunkTable('B');
+
+    // objects referenced by leafs are stored as chunk indices after the nodes
+    uint32_t bvhDataCount = chunkBVH.read<uint16_t>(2);
+    uint32_t bvhDataPos = file.getPos() + chunkBVH.getSize() - bvhDataCount * sizeof(uint32_t);
+    for(uint32_t d=0; d<bvhDataCount; ++d) {
+      relocs.push_back({bvhDataPos + d * (uint32_t)sizeof(uint32_t), RelocBase::CHUNK});
+    }
+    file.writeMemFile(chunkBVH);
+  }
+
+  assert(chunkTypes == lookupTypes && chunkNames == lookupNames);
+
+  // String table, only contains names
   file.align(4);
-  uint32_t stringTableOffset = file.getPos();
+  uint32_t stringTableOffset = toLoaded(file.getPos());
   file.write(stringTable);
 
+  // Relocation table, the runtime adds the model address to each pointer and rebases all strips.
+  // It is kept until 't3d_model_compact' is called, which uses it to move the remaining metadata.
+  relocs.push_back({offsetStringTablePtr, RelocBase::FILE});
+  relocs.push_back({offsetLookupPtr, RelocBase::FILE});
+  std::sort(relocs.begin(), relocs.end(), [](const Reloc &a, const Reloc &b) { return a.pos < b.pos; });
+
+  file.align(4);
+  uint32_t relocTableOffset = toLoaded(file.getPos());
+  file.write<uint32_t>(relocs.size());
+  file.write<uint32_t>(stripBuffers.size());
+  for(const auto &reloc : relocs)file.write(toLoaded(reloc.pos));
+  for(auto strip : stripBuffers)file.write(strip);
+
   file.setPos(offsetStringTablePtr);
   file.write(stringTableOffset);
 
+  file.setPos(offsetLookupPtr);
+  file.write(lookupOffset);
+
+  file.setPos(offsetRelocTable);
+  file.write(relocTableOffset);
+
+  // turn all pointers into offsets relative to the file start
+  for(const auto &reloc : relocs) {
+    uint32_t value = file.read<uint32_t>(reloc.pos);
+    switch(reloc.base) {
+      case RelocBase::FILE: break;
+      case RelocBase::STRINGS: value += stringTableOffset; break;
+      case RelocBase::RESIDENT: value += residentTableOffset; break;
+      case RelocBase::VERTICES: value += chunkOffsets[chunkIdxVertices]; break;
+      case RelocBase::INDICES: value += chunkOffsets[chunkIdxVertices+1]; break;
+      case RelocBase::CHUNK: value = chunkOffsets[value]; break;
+      case RelocBase::MATERIAL: value = chunkOffsets[chunkIdxMaterials + value]; break;
+    }
+    file.setPos(reloc.pos);
+    file.write(value);
+  }
+
   // patch vertex/index count
   file.setPos(0x08);
   file.write(totalVertCount);
   file.write(totalIndexCount);
 
-  // write to actual file
+  return file;
+}
+
+void T3DM::writeT3DM(
+  const Config &config,
+  const T3DMData &t3dm,
+  const std::string &t3dmPath,
+  const std::vector<CustomChunk> &customChunks
+)
+{
+  std::vector<BinaryFile> streamFiles{};
+  BinaryFile file{};
+
+  if(config.regionSize > 0.0f) {
+    // skinned/instanced objects, skeletons and animations stay in the main model
+    T3DMData resident = t3dm;
+    auto regions = splitRegions(config, resident);
+
+    // collision is only created for the main model, covering the objects of all regions
+    Config regionConfig = config;
+    regionConfig.regionSize = 0.0f;
+    regionConfig.createCollision = false;
+
+    BinaryFile regionFile{};
+    for(const auto &regionData : regions) {
+      std::vector<BinaryFile> regionStreams{};
+      BinaryFile regionModel = createT3DM(regionConfig, regionData, t3dmPath, {}, regionStreams);
+
+      auto &region = resident.regions.emplace_back();
+      for(int i=0; i<3; ++i) {
+        region.aabbMin[i] = regionModel.read<int16_t>(HEADER_AABB_OFFSET + i * 2);
+        region.aabbMax[i] = regionModel.read<int16_t>(HEADER_AABB_OFFSET + (i + 3) * 2);
+      }
+      region.offset = regionFile.getSize();
+      regionFile.writeMemFile(regionModel);
+      regionFile.align(REGION_ALIGN);
+      region.size = regionFile.getSize() - region.offset;
+      region.memSize = getLoadedSize(regionModel) + (region.size - regionModel.getSize()); // padding is loaded too
+    }
+    if(!regions.empty()) {
+      regionFile.writeToFile(getRegionDataPath(t3dmPath).c_str());
+      if(config.verbose) {
+        printf("[Regions] Region file: %d bytes\n", regionFile.getSize());
+      }
+    }
+    Config residentConfig = config;
+    if(resident.models.empty())residentConfig.createBVH = false; // nothing to build it from
+
+    file = createT3DM(residentConfig, resident, t3dmPath, customChunks, streamFiles);
+  } else {
+    file = createT3DM(config, t3dm, t3dmPath, customChunks, streamFiles);
+  }
+
   file.writeToFile(t3dmPath.c_str());
 
   for(int s=0; s<streamFiles.size(); ++s) {
-    auto sdataPath = getStreamDataPath(t3dmPath.c_str(), s);
+    auto sdataPath = getStreamDataPath(t3dmPath.c_str(), config.animArchive ? -1 : s);
     streamFiles[s].writeToFile(sdataPath.c_str());
   }
 }
\ No newline at end of file